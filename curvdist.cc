@@ -17,8 +17,19 @@
 #include <algorithm>
 #include <limits>
 #include <queue>
+#include <cctype>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
 
 #include <octave/oct.h>
+#include <octave/parse.h>
 
 namespace image
 {
@@ -30,14 +41,1458 @@ namespace image
     quasieuclidean
   };
 
+  // format of T, idx and pred
+  enum class output_type
+  {
+    full,
+    sparse,
+    bbox
+  };
+
   dim_vector operator+(const dim_vector& dim, octave_idx_type val)
   {
-    dim_vector result = dim;
+    dim_vector result = dim;
+
+    for (int i = 0; i < dim.length(); i++)
+      result(i) += val;
+
+    return result;
+  }
+
+  bool
+  iequals (const std::string& a, const std::string& b)
+  {
+    return a.size () == b.size ()
+           && std::equal (a.begin (), a.end (), b.begin (),
+                [] (char x, char y)
+                {
+                  return std::tolower (x) == std::tolower (y);
+                });
+  }
+
+  struct options
+  {
+    double scale = 1;
+
+    double offset = 0;
+
+    double exponent = 1;
+
+    NDArray lookup_table;
+
+    bool has_lookup_table = false;
+
+    // set when the statistics output is requested
+    bool stats = false;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    // interrupts are checked after this many points are processed
+    octave_idx_type interrupt_interval = 4096;
+
+    // true or a function handle when progress should be reported
+    octave_value progress;
+
+    double progress_interval = 1;
+
+    // number of threads of the tiled propagation of 2D images
+    octave_idx_type threads = 1;
+
+    // distance between neighbors along each dimension, empty for unit spacing
+    std::vector<double> spacing;
+
+    // width of the neighborhood, 5 for the chamfer neighborhood of the
+    // quasi-euclidean metric
+    octave_idx_type neighborhood = 3;
+
+    // per-seed region statistics are returned as the second output
+    bool summary = false;
+
+    // points that are farther than this from the seed points are not reached
+    double max_distance = std::numeric_limits<double>::infinity ();
+
+    output_type output = output_type::full;
+
+    bool multichannel = false;
+  };
+
+  bool
+  is_option_name (const octave_value& arg)
+  {
+    if (! arg.is_string ())
+      return false;
+
+    const std::string name = arg.string_value ();
+
+    for (const char* opt : {"Scale", "Offset", "Exponent", "LookupTable", "InterruptInterval", "Progress", "ProgressInterval", "Threads", "Spacing", "Neighborhood", "Summary", "MaxDistance", "Output", "Multichannel"})
+      if (iequals (name, opt))
+        return true;
+
+    return false;
+  }
+
+  // number of leading positional arguments, options start after them
+  octave_idx_type
+  count_positional_args (const octave_value_list& args)
+  {
+    octave_idx_type n = 0;
+
+    while (n < args.length () && ! (n > 0 && is_option_name (args(n))))
+      n++;
+
+    return n;
+  }
+
+  options
+  parse_options (const octave_value_list& args, octave_idx_type first)
+  {
+    options opt;
+
+    if ((args.length () - first) % 2 != 0)
+      error ("curvdist: options should be given as name/value pairs");
+
+    for (octave_idx_type i = first; i < args.length (); i += 2)
+      {
+        const std::string name = args(i).xstring_value ("curvdist: option name should be a string");
+
+        const octave_value& val = args(i+1);
+
+        if (iequals (name, "Scale"))
+          opt.scale = val.xdouble_value ("curvdist: Scale should be a real scalar");
+        else if (iequals (name, "Offset"))
+          opt.offset = val.xdouble_value ("curvdist: Offset should be a real scalar");
+        else if (iequals (name, "Exponent"))
+          opt.exponent = val.xdouble_value ("curvdist: Exponent should be a real scalar");
+        else if (iequals (name, "LookupTable"))
+          {
+            opt.lookup_table = val.xarray_value ("curvdist: LookupTable should be a real vector");
+
+            opt.has_lookup_table = true;
+          }
+        else if (iequals (name, "InterruptInterval"))
+          {
+            opt.interrupt_interval = val.xidx_type_value ("curvdist: InterruptInterval should be a positive integer");
+
+            if (opt.interrupt_interval < 1)
+              error ("curvdist: InterruptInterval should be a positive integer");
+          }
+        else if (iequals (name, "Progress"))
+          {
+            if (val.is_function_handle ())
+              opt.progress = val;
+            else if (val.xbool_value ("curvdist: Progress should be a logical scalar or a function handle"))
+              opt.progress = true;
+          }
+        else if (iequals (name, "ProgressInterval"))
+          opt.progress_interval = val.xdouble_value ("curvdist: ProgressInterval should be a real scalar");
+        else if (iequals (name, "Threads"))
+          {
+            opt.threads = val.xidx_type_value ("curvdist: Threads should be a positive integer");
+
+            if (opt.threads < 1)
+              error ("curvdist: Threads should be a positive integer");
+          }
+        else if (iequals (name, "Spacing"))
+          {
+            const NDArray spacing = val.xarray_value ("curvdist: Spacing should be a real vector");
+
+            opt.spacing.resize (spacing.numel ());
+
+            for (octave_idx_type k = 0; k < spacing.numel (); k++)
+              {
+                if (! (spacing(k) > 0) || ! std::isfinite (spacing(k)))
+                  error ("curvdist: Spacing should contain positive values");
+
+                opt.spacing[k] = spacing(k);
+              }
+          }
+        else if (iequals (name, "Neighborhood"))
+          {
+            opt.neighborhood = val.xidx_type_value ("curvdist: Neighborhood should be 3 or 5");
+
+            if (opt.neighborhood != 3 && opt.neighborhood != 5)
+              error ("curvdist: Neighborhood should be 3 or 5");
+          }
+        else if (iequals (name, "Summary"))
+          opt.summary = val.xbool_value ("curvdist: Summary should be a logical scalar");
+        else if (iequals (name, "MaxDistance"))
+          {
+            opt.max_distance = val.xdouble_value ("curvdist: MaxDistance should be a real scalar");
+
+            if (! (opt.max_distance >= 0))
+              error ("curvdist: MaxDistance should be a non-negative scalar");
+          }
+        else if (iequals (name, "Output"))
+          {
+            const std::string format = val.xstring_value ("curvdist: Output should be a string");
+
+            if (iequals (format, "full"))
+              opt.output = output_type::full;
+            else if (iequals (format, "sparse"))
+              opt.output = output_type::sparse;
+            else if (iequals (format, "bbox"))
+              opt.output = output_type::bbox;
+            else
+              error ("curvdist: unrecognized Output format '%s'", format.c_str ());
+          }
+        else if (iequals (name, "Multichannel"))
+          opt.multichannel = val.xbool_value ("curvdist: Multichannel should be a logical scalar");
+        else
+          error ("curvdist: unrecognized option '%s'", name.c_str ());
+      }
+
+    return opt;
+  }
+
+  template <typename T>
+  struct lut_size
+  {
+    static constexpr octave_idx_type value = 0;
+  };
+
+  template <typename T>
+  struct lut_size<octave_int<T>>
+  {
+    static constexpr octave_idx_type value = sizeof (T) <= 2 ? octave_idx_type (1) << (8 * sizeof (T)) : 0;
+  };
+
+  template <typename T>
+  octave_idx_type
+  lut_index (const T&)
+  {
+    return 0;
+  }
+
+  template <typename T>
+  octave_idx_type
+  lut_index (const octave_int<T>& x)
+  {
+    return octave_idx_type (x.value ()) - std::numeric_limits<T>::min ();
+  }
+
+  // maps gray values of the image to the values used in the step cost.
+  // 8 and 16 bit images are mapped through a table so the raw image is read
+  // directly without creating a transformed copy of it.
+  template <typename T>
+  class cost_transform
+  {
+  public:
+
+    cost_transform () = default;
+
+    template <typename ImageType>
+    cost_transform (const options& opt, const ImageType& image)
+    : scale (opt.scale), offset (opt.offset), exponent (opt.exponent)
+    {
+      using image_elem = typename ImageType::element_type;
+
+      constexpr octave_idx_type nlevels = lut_size<image_elem>::value;
+
+      const bool is_identity = scale == 1 && offset == 0 && exponent == 1;
+
+      if (opt.has_lookup_table)
+        {
+          if (nlevels == 0)
+            error ("LookupTable can only be used with 8 and 16 bit integer images");
+
+          if (opt.lookup_table.numel () != nlevels)
+            error ("LookupTable should have %s elements for this image class", std::to_string (nlevels).c_str ());
+        }
+
+      if (nlevels > 0 && (opt.has_lookup_table || ! is_identity))
+        {
+          table.resize (nlevels);
+
+          for (octave_idx_type i = 0; i < nlevels; i++)
+            {
+              T level = opt.has_lookup_table
+                        ? static_cast<T> (opt.lookup_table.xelem (i))
+                        : static_cast<T> (image_elem (i - lut_index (image_elem ())));
+
+              table[i] = apply (level);
+            }
+
+          mode = transform_mode::table;
+        }
+      else if (is_identity)
+        mode = transform_mode::identity;
+      else if (exponent == 1)
+        mode = transform_mode::affine;
+      else
+        mode = transform_mode::power;
+    }
+
+    template <typename ImageElem>
+    T operator () (const ImageElem& x) const
+    {
+      switch (mode)
+        {
+        case transform_mode::identity:
+          return static_cast<T> (x);
+        case transform_mode::table:
+          return table[lut_index (x)];
+        case transform_mode::affine:
+          return static_cast<T> (scale) * static_cast<T> (x) + static_cast<T> (offset);
+        default:
+          return apply (static_cast<T> (x));
+        }
+    }
+
+    bool is_identity () const
+    {
+      return mode == transform_mode::identity;
+    }
+
+  private:
+
+    T apply (const T& x) const
+    {
+      return static_cast<T> (scale) * std::pow (x, static_cast<T> (exponent)) + static_cast<T> (offset);
+    }
+
+    enum class transform_mode
+    {
+      identity,
+      affine,
+      power,
+      table
+    };
+
+    transform_mode mode = transform_mode::identity;
+
+    double scale = 1;
+
+    double offset = 0;
+
+    double exponent = 1;
+
+    std::vector<T> table;
+  };
+
+  // cost of a step between two neighbors with gray values a and b, w is the
+  // spatial length of the step
+  template <typename T>
+  struct chessboard_step
+  {
+    T operator () (const T& a, const T& b, const T& w) const
+    {
+      return std::abs (a - b) + w;
+    }
+
+    // d2 is the squared distance of the channel vectors
+    T channel (const T& d2, const T& w) const
+    {
+      return sqrt (d2) + w;
+    }
+  };
+
+  // w is the squared spatial length of the step
+  template <typename T>
+  struct quasi_euclidean_step
+  {
+    T operator () (const T& a, const T& b, const T& w) const
+    {
+      return sqrt (w + pow (a - b, 2));
+    }
+
+    T channel (const T& d2, const T& w) const
+    {
+      return sqrt (w + d2);
+    }
+  };
+
+  // step cost kernels used in the propagation loops. key () is computed once
+  // for the index of each visited pixel and the cost of a step is computed
+  // from the keys of its two ends and the class of the neighbor.
+
+  // computes the step cost from the transformed gray levels
+  template <typename T, typename Step, typename ImageElem>
+  class level_cost
+  {
+  public:
+
+    using key_type = T;
+
+    level_cost (const cost_transform<T>& cost, const ImageElem* data, const std::vector<T>& weights)
+    : cost (cost), data (data), weights (weights)
+    { }
+
+    T key (octave_idx_type i) const
+    {
+      return cost (data[i]);
+    }
+
+    T operator () (const T& a, const T& b, int cls) const
+    {
+      return step (a, b, weights[cls]);
+    }
+
+  private:
+
+    const cost_transform<T>& cost;
+
+    const ImageElem* data;
+
+    std::vector<T> weights;
+
+    Step step;
+  };
+
+  // 8 bit images: the step cost of all pairs of gray levels is precomputed
+  // for each class of neighbors
+  template <typename T, typename Step, typename ImageElem>
+  class pair_table_cost
+  {
+  public:
+
+    using key_type = octave_idx_type;
+
+    pair_table_cost (const cost_transform<T>& cost, const ImageElem* data, const std::vector<T>& weights)
+    : data (data), nlevels (lut_size<ImageElem>::value), table (weights.size () * nlevels * nlevels)
+    {
+      std::vector<T> level (nlevels);
+
+      for (octave_idx_type i = 0; i < nlevels; i++)
+        level[i] = cost (ImageElem (i - lut_index (ImageElem ())));
+
+      Step step;
+
+      T* p = table.data ();
+
+      for (const T& w : weights)
+        for (octave_idx_type a = 0; a < nlevels; a++)
+          for (octave_idx_type b = 0; b < nlevels; b++)
+            *p++ = step (level[a], level[b], w);
+    }
+
+    octave_idx_type key (octave_idx_type i) const
+    {
+      return lut_index (data[i]);
+    }
+
+    T operator () (octave_idx_type a, octave_idx_type b, int cls) const
+    {
+      return table[(cls * nlevels + a) * nlevels + b];
+    }
+
+  private:
+
+    const ImageElem* data;
+
+    octave_idx_type nlevels;
+
+    std::vector<T> table;
+  };
+
+  // untransformed 16 bit images: the step cost only depends on the absolute
+  // difference of the gray levels and is precomputed for each class of
+  // neighbors
+  template <typename T, typename Step, typename ImageElem>
+  class difference_table_cost
+  {
+  public:
+
+    using key_type = octave_idx_type;
+
+    difference_table_cost (const ImageElem* data, const std::vector<T>& weights)
+    : data (data), nlevels (lut_size<ImageElem>::value), table (weights.size () * nlevels)
+    {
+      Step step;
+
+      T* p = table.data ();
+
+      for (const T& w : weights)
+        for (octave_idx_type d = 0; d < nlevels; d++)
+          *p++ = step (static_cast<T> (0), static_cast<T> (d), w);
+    }
+
+    octave_idx_type key (octave_idx_type i) const
+    {
+      return lut_index (data[i]);
+    }
+
+    T operator () (octave_idx_type a, octave_idx_type b, int cls) const
+    {
+      return table[cls * nlevels + std::abs (a - b)];
+    }
+
+  private:
+
+    const ImageElem* data;
+
+    octave_idx_type nlevels;
+
+    std::vector<T> table;
+  };
+
+  // multichannel images: the transformed channels of each pixel are stored
+  // contiguously and the step cost is computed from the squared euclidean
+  // distance of the channel vectors
+  template <typename T, typename Step>
+  class channel_cost
+  {
+  public:
+
+    using key_type = const T*;
+
+    template <typename ImageType>
+    channel_cost (const cost_transform<T>& cost, const ImageType& image, octave_idx_type nchannels, const std::vector<T>& weights)
+    : nchannels (nchannels), data (image.numel ()), weights (weights)
+    {
+      const octave_idx_type npixels = image.numel () / nchannels;
+
+      for (octave_idx_type c = 0; c < nchannels; c++)
+        for (octave_idx_type i = 0; i < npixels; i++)
+          data[i * nchannels + c] = cost (image.xelem (c * npixels + i));
+    }
+
+    const T* key (octave_idx_type i) const
+    {
+      return data.data () + i * nchannels;
+    }
+
+    T operator () (const T* a, const T* b, int cls) const
+    {
+      T d2 = 0;
+
+      for (octave_idx_type c = 0; c < nchannels; c++)
+        {
+          T d = a[c] - b[c];
+
+          d2 += d * d;
+        }
+
+      return step.channel (d2, weights[cls]);
+    }
+
+  private:
+
+    octave_idx_type nchannels;
+
+    std::vector<T> data;
+
+    std::vector<T> weights;
+
+    Step step;
+  };
+
+  // the tables pay off when the number of steps exceeds their size
+  template <typename ImageElem>
+  bool
+  use_pair_table (octave_idx_type numel, octave_idx_type nneighbors, octave_idx_type nclasses)
+  {
+    constexpr octave_idx_type nlevels = lut_size<ImageElem>::value;
+
+    return nlevels == 256 && numel * nneighbors >= nclasses * nlevels * nlevels;
+  }
+
+  template <typename ImageElem, typename T>
+  bool
+  use_difference_table (const cost_transform<T>& cost, octave_idx_type numel, octave_idx_type nneighbors, octave_idx_type nclasses)
+  {
+    constexpr octave_idx_type nlevels = lut_size<ImageElem>::value;
+
+    return nlevels == 65536 && cost.is_identity () && numel * nneighbors >= nclasses * nlevels;
+  }
+
+  double
+  elapsed (const std::chrono::steady_clock::time_point& since)
+  {
+    return std::chrono::duration<double> (std::chrono::steady_clock::now () - since).count ();
+  }
+
+  // counters of the propagation loop. They are only updated when the
+  // statistics output is requested, otherwise no_stats is used in their
+  // place and the calls compile to nothing.
+  struct propagation_stats
+  {
+    void start (size_t queue_size)
+    {
+      pushes += queue_size;
+
+      max_queue_size = std::max (max_queue_size, static_cast<octave_idx_type> (queue_size));
+    }
+
+    void pop ()
+    {
+      pops++;
+    }
+
+    void stale_pop ()
+    {
+      stale_pops++;
+    }
+
+    void relax ()
+    {
+      relaxations++;
+    }
+
+    void improve (size_t queue_size)
+    {
+      improvements++;
+
+      pushes++;
+
+      max_queue_size = std::max (max_queue_size, static_cast<octave_idx_type> (queue_size));
+    }
+
+    // adds the counters of a tile, the queue sizes of the tiles are summed
+    void merge (const propagation_stats& other)
+    {
+      pushes += other.pushes;
+
+      pops += other.pops;
+
+      stale_pops += other.stale_pops;
+
+      relaxations += other.relaxations;
+
+      improvements += other.improvements;
+
+      max_queue_size += other.max_queue_size;
+    }
+
+    octave_idx_type pushes = 0;
+
+    octave_idx_type pops = 0;
+
+    octave_idx_type stale_pops = 0;
+
+    octave_idx_type relaxations = 0;
+
+    octave_idx_type improvements = 0;
+
+    octave_idx_type max_queue_size = 0;
+
+    double initialization_time = 0;
+
+    double propagation_time = 0;
+  };
+
+  struct no_stats
+  {
+    void start (size_t) { }
+
+    void pop () { }
+
+    void stale_pop () { }
+
+    void relax () { }
+
+    void improve (size_t) { }
+
+    void merge (const no_stats&) { }
+  };
+
+  // statistics of the region of each seed point, that is the points that
+  // have it as their nearest seed: the number of points, the largest and the
+  // mean distance and the farthest point. The points are added when they are
+  // settled so no second pass over the distance map and idx is needed.
+  template <typename ResultType>
+  class region_summary
+  {
+  public:
+
+    using T = typename ResultType::element_type;
+
+    // seed points as zero based linear indexes
+    void
+    start (std::vector<octave_idx_type> points)
+    {
+      std::sort (points.begin (), points.end ());
+
+      points.erase (std::unique (points.begin (), points.end ()), points.end ());
+
+      seeds = std::move (points);
+
+      // region of each seed point by its linear index, so a settled point
+      // finds its region without a search
+      first_seed = seeds.empty () ? 0 : seeds.front ();
+
+      region.assign (seeds.empty () ? 0 : seeds.back () - first_seed + 1, -1);
+
+      for (size_t r = 0; r < seeds.size (); r++)
+        region[seeds[r] - first_seed] = r;
+
+      area.assign (seeds.size (), 0);
+
+      sum.assign (seeds.size (), T (0));
+
+      max_distance.assign (seeds.size (), T (0));
+
+      farthest.assign (seeds.size (), -1);
+    }
+
+    // seed is the zero based index of the nearest seed point of point
+    void
+    add (octave_idx_type seed, octave_idx_type point, const T& distance)
+    {
+      const octave_idx_type k = seed - first_seed;
+
+      if (k < 0 || k >= static_cast<octave_idx_type> (region.size ()) || region[k] < 0)
+        return;
+
+      const octave_idx_type r = region[k];
+
+      area[r]++;
+
+      sum[r] += distance;
+
+      if (farthest[r] < 0 || distance > max_distance[r])
+        {
+          max_distance[r] = distance;
+
+          farthest[r] = point;
+        }
+    }
+
+    // adds the reached points of a finished distance map, used when the
+    // points are not settled exactly once
+    template <typename IndexType>
+    void
+    collect (const ResultType& dist, const IndexType& idx, const std::vector<octave_idx_type>& points)
+    {
+      for (octave_idx_type i : points)
+        if (idx.xelem (i).value () != 0)
+          add (idx.xelem (i).value () - 1, i, dist.xelem (i));
+    }
+
+    octave_scalar_map
+    get () const
+    {
+      const dim_vector dims (seeds.size (), 1);
+
+      NDArray seed (dims);
+
+      NDArray npoints (dims);
+
+      ResultType max_dist (dims);
+
+      ResultType mean_dist (dims);
+
+      NDArray farthest_point (dims);
+
+      for (size_t k = 0; k < seeds.size (); k++)
+        {
+          seed.xelem (k) = seeds[k] + 1;
+
+          npoints.xelem (k) = area[k];
+
+          max_dist.xelem (k) = max_distance[k];
+
+          mean_dist.xelem (k) = sum[k] / static_cast<T> (area[k]);
+
+          farthest_point.xelem (k) = farthest[k] + 1;
+        }
+
+      octave_scalar_map result;
+
+      result.assign ("seed", seed);
+      result.assign ("area", npoints);
+      result.assign ("max_distance", max_dist);
+      result.assign ("mean_distance", mean_dist);
+      result.assign ("farthest", farthest_point);
+
+      return result;
+    }
+
+  private:
+
+    std::vector<octave_idx_type> seeds;
+
+    octave_idx_type first_seed = 0;
+
+    std::vector<octave_idx_type> region;
+
+    std::vector<octave_idx_type> area;
+
+    std::vector<T> sum;
+
+    std::vector<T> max_distance;
+
+    std::vector<octave_idx_type> farthest;
+  };
+
+  // T, idx and pred of the settled points only. In the sparse format T is a
+  // struct with the linear indexes and the distances of the points and idx
+  // and pred are column vectors with their values at the same points. In
+  // the bbox format they are cropped to the bounding box of the points and
+  // T is a struct with the cropped distances and the offset of the box.
+  template <typename ResultType, typename IndexType>
+  octave_value_list
+  compact_result (output_type output, const ResultType& dist, const IndexType& segment, const IndexType& predecessor, int nargout, std::vector<octave_idx_type> settled)
+  {
+    std::sort (settled.begin (), settled.end ());
+
+    const octave_idx_type n = settled.size ();
+
+    octave_scalar_map T;
+
+    if (output == output_type::sparse)
+      {
+        NDArray ind (dim_vector (n, 1));
+
+        ResultType value (dim_vector (n, 1));
+
+        IndexType idx (dim_vector (nargout >= 2 ? n : 0, 1));
+
+        IndexType pred (dim_vector (nargout >= 3 ? n : 0, 1));
+
+        for (octave_idx_type k = 0; k < n; k++)
+          {
+            ind.xelem (k) = settled[k] + 1;
+
+            value.xelem (k) = dist.xelem (settled[k]);
+
+            if (nargout >= 2)
+              {
+                idx.xelem (k) = segment.xelem (settled[k]);
+
+                if (nargout >= 3)
+                  pred.xelem (k) = predecessor.xelem (settled[k]);
+              }
+          }
+
+        T.assign ("ind", ind);
+        T.assign ("value", value);
+
+        return ovl (T, idx, pred);
+      }
+
+    const dim_vector& dims = dist.dims ();
+
+    const int nd = dims.ndims ();
+
+    std::vector<octave_idx_type> lo (nd, std::numeric_limits<octave_idx_type>::max ());
+
+    std::vector<octave_idx_type> hi (nd, -1);
+
+    for (octave_idx_type p : settled)
+      for (int k = 0; k < nd; k++)
+        {
+          const octave_idx_type sub = p % dims(k);
+
+          p /= dims(k);
+
+          lo[k] = std::min (lo[k], sub);
+
+          hi[k] = std::max (hi[k], sub);
+        }
+
+    dim_vector box = dims;
+
+    NDArray offset (dim_vector (1, nd));
+
+    for (int k = 0; k < nd; k++)
+      {
+        box(k) = n > 0 ? hi[k] - lo[k] + 1 : 0;
+
+        offset.xelem (k) = n > 0 ? lo[k] + 1 : 1;
+      }
+
+    ResultType value (box, std::numeric_limits<typename ResultType::element_type>::infinity ());
+
+    IndexType idx (nargout >= 2 ? box : dim_vector (0, 0), 0);
+
+    IndexType pred (nargout >= 3 ? box : dim_vector (0, 0), 0);
+
+    for (octave_idx_type p : settled)
+      {
+        octave_idx_type q = 0;
+
+        octave_idx_type stride = 1;
+
+        for (octave_idx_type k = 0, r = p; k < nd; k++)
+          {
+            q += (r % dims(k) - lo[k]) * stride;
+
+            r /= dims(k);
+
+            stride *= box(k);
+          }
+
+        value.xelem (q) = dist.xelem (p);
+
+        if (nargout >= 2)
+          {
+            idx.xelem (q) = segment.xelem (p);
+
+            if (nargout >= 3)
+              pred.xelem (q) = predecessor.xelem (p);
+          }
+      }
+
+    T.assign ("value", value);
+    T.assign ("offset", offset);
+
+    return ovl (T, idx, pred);
+  }
+
+  // the bounding box of the squeezed image is mapped to the dimensions of
+  // the outputs, the squeezed singleton dimensions get an offset of 1
+  void
+  unsqueeze_bbox (octave_value_list& retval, int nargout, const dim_vector& dims, const dim_vector& squeezed)
+  {
+    octave_scalar_map T = retval(0).scalar_map_value ();
+
+    const NDArray offset = T.getfield ("offset").array_value ();
+
+    const dim_vector box = T.getfield ("value").dims ();
+
+    dim_vector out = dims;
+
+    NDArray out_offset (dim_vector (1, dims.ndims ()), 1);
+
+    for (int k = 0, j = 0; k < dims.ndims (); k++)
+      {
+        if (dims(k) == 1)
+          {
+            out(k) = box.numel () > 0 ? 1 : 0;
+
+            continue;
+          }
+
+        while (squeezed(j) == 1)
+          j++;
+
+        out(k) = box(j);
+
+        out_offset.xelem (k) = offset.xelem (j);
+
+        j++;
+      }
+
+    T.assign ("value", T.getfield ("value").reshape (out));
+
+    T.assign ("offset", out_offset);
+
+    retval(0) = T;
+
+    if (nargout >= 2)
+      retval(1) = retval(1).reshape (out);
+
+    if (nargout >= 3)
+      retval(2) = retval(2).reshape (out);
+  }
+
+  // spacing of the dimensions that remain after the image is squeezed,
+  // missing trailing elements are 1
+  std::vector<double>
+  squeeze_spacing (const dim_vector& dims, const std::vector<double>& spacing)
+  {
+    std::vector<double> result;
+
+    if (spacing.empty ())
+      return result;
+
+    for (int k = 0; k < dims.ndims (); k++)
+      if (dims(k) != 1)
+        result.push_back (k < static_cast<int> (spacing.size ()) ? spacing[k] : 1);
+
+    return result;
+  }
+
+  // mask of the axes in which a neighbor differs from the center, offset is
+  // the offset of the neighbor in an array with all dimensions equal to 3.
+  // It is decoded as a balanced ternary number.
+  int
+  axes_of_offset (octave_idx_type offset)
+  {
+    int mask = 0;
+
+    for (int k = 0; offset != 0; k++)
+      {
+        const octave_idx_type r = ((offset % 3) + 3) % 3;
+
+        if (r == 1)
+          offset = (offset - 1) / 3;
+        else if (r == 2)
+          offset = (offset + 1) / 3;
+        else
+          offset /= 3;
+
+        if (r != 0)
+          mask |= 1 << k;
+      }
+
+    return mask;
+  }
+
+  // squared euclidean length of a step between neighbors that differ in
+  // the axes of mask
+  double
+  squared_step_length (int mask, const std::vector<double>& spacing)
+  {
+    double sum = 0;
+
+    for (size_t k = 0; k < spacing.size (); k++)
+      if (mask & (1 << k))
+        sum += spacing[k] * spacing[k];
+
+    return sum;
+  }
+
+  // spatial length of a step between neighbors that differ in the axes of
+  // mask. Chessboard and cityblock steps are as long as the largest spacing
+  // of the axes, quasi-euclidean steps are the euclidean distance.
+  double
+  step_length (int mask, const std::vector<double>& spacing, bool quasi)
+  {
+    if (quasi)
+      return std::sqrt (squared_step_length (mask, spacing));
+
+    double longest = 0;
+
+    for (size_t k = 0; k < spacing.size (); k++)
+      if (mask & (1 << k))
+        longest = std::max (longest, spacing[k]);
+
+    return longest;
+  }
+
+  // weights of the neighbor classes with anisotropic spacing. The class of
+  // a neighbor is the mask of its axes minus one, weight maps the mask to
+  // the weight that is used by the step cost.
+  template <typename T, typename Weight>
+  std::vector<T>
+  axis_weights (const std::vector<double>& spacing, const Weight& weight)
+  {
+    std::vector<T> weights ((1 << spacing.size ()) - 1);
+
+    for (size_t mask = 1; mask <= weights.size (); mask++)
+      weights[mask-1] = static_cast<T> (weight (mask));
+
+    return weights;
+  }
+
+  // steps of the chamfer neighborhood of width 5: the neighbors that are at
+  // most two points away in each dimension and are not a multiple of a
+  // shorter step, like the knight moves in 2D
+  std::vector<std::vector<int>>
+  chamfer_steps (int ndims)
+  {
+    std::vector<std::vector<int>> result;
+
+    std::vector<int> step (ndims, -2);
+
+    while (true)
+      {
+        // steps with only even coordinates are twice a step of the 3x3
+        // neighborhood or the center
+        if (std::any_of (step.begin (), step.end (), [] (int c) { return c % 2 != 0; }))
+          result.push_back (step);
+
+        int k = 0;
+
+        for (; k < ndims; k++)
+          {
+            if (++step[k] <= 2)
+              break;
+
+            step[k] = -2;
+          }
+
+        if (k == ndims)
+          break;
+      }
+
+    return result;
+  }
+
+  // functions that free the scratch buffers of each type
+  std::vector<std::function<void ()>>&
+  scratch_releasers ()
+  {
+    static thread_local std::vector<std::function<void ()>> releasers;
+
+    return releasers;
+  }
+
+  // the queue storage and the processed flags are kept per thread between
+  // calls, so repeated calls on images of the same size do not allocate
+  // them again. There is one buffer per element type that keeps the
+  // largest capacity that has been used.
+  template <typename T>
+  std::vector<T>&
+  scratch_slot ()
+  {
+    static thread_local std::vector<T> buffer;
+
+    static thread_local bool registered = false;
+
+    if (! registered)
+      {
+        scratch_releasers ().push_back ([] () { std::vector<T> ().swap (scratch_slot<T> ()); });
+
+        registered = true;
+      }
+
+    return buffer;
+  }
+
+  // an engine takes the buffer for the duration of a call, so a nested call
+  // (for example from a progress callback) allocates its own one
+  template <typename T>
+  std::vector<T>
+  take_scratch ()
+  {
+    std::vector<T> result = std::move (scratch_slot<T> ());
+
+    scratch_slot<T> ().clear ();
+
+    result.clear ();
+
+    return result;
+  }
+
+  template <typename T>
+  void
+  give_back_scratch (std::vector<T>&& buffer)
+  {
+    std::vector<T>& slot = scratch_slot<T> ();
+
+    if (buffer.capacity () > slot.capacity ())
+      slot = std::move (buffer);
+  }
+
+  // working state of the compact outputs that is kept between calls: the
+  // distances, idx, pred and the processed flags of an image of size dims.
+  // layout tells how the flags are laid out for dims. A call on an image of
+  // the same size takes the state and resets only the points that it has
+  // reached when it finishes, so neither the filling of the arrays nor the
+  // output conversion depends on the size of the image.
+  template <typename ResultType, typename IndexType, typename FlagType>
+  struct compact_state
+  {
+    dim_vector dims;
+
+    int layout = 0;
+
+    ResultType dist;
+
+    IndexType segment;
+
+    IndexType predecessor;
+
+    std::vector<FlagType> inheap;
+  };
+
+  template <typename ResultType, typename IndexType, typename FlagType>
+  compact_state<ResultType, IndexType, FlagType>&
+  compact_state_slot ()
+  {
+    static thread_local compact_state<ResultType, IndexType, FlagType> state;
+
+    static thread_local bool registered = false;
+
+    if (! registered)
+      {
+        scratch_releasers ().push_back ([] () { compact_state_slot<ResultType, IndexType, FlagType> () = compact_state<ResultType, IndexType, FlagType> (); });
+
+        registered = true;
+      }
+
+    return state;
+  }
+
+  // the array of the state if it has the size dims, otherwise a new array
+  // filled with val
+  template <typename ArrayType>
+  ArrayType
+  take_state_array (ArrayType& slot, const dim_vector& dims, const typename ArrayType::element_type& val)
+  {
+    if (slot.dims () != dims)
+      return ArrayType (dims, val);
+
+    ArrayType result = slot;
+
+    slot = ArrayType ();
+
+    return result;
+  }
+
+  void
+  clear_scratch ()
+  {
+    for (auto& release : scratch_releasers ())
+      release ();
+  }
+
+  // priority queue that can give its storage back to the arena
+  template <typename T, typename Compare>
+  class scratch_queue : public std::priority_queue<T, std::vector<T>, Compare>
+  {
+  public:
+
+    using std::priority_queue<T, std::vector<T>, Compare>::priority_queue;
+
+    std::vector<T>&&
+    storage ()
+    {
+      return std::move (this->c);
+    }
+  };
+
+  template <typename T>
+  struct nd_queue_elem
+  {
+    octave_idx_type maskindex = 0;
+    octave_idx_type imageindex = 0;
+    T imageval = 0;
+  };
+
+  // checks for interrupts after each interval processed points instead of on
+  // each pop of the queue. The progress is reported at the same checks when
+  // at least progress_interval seconds have passed since the last report.
+  class propagation_monitor
+  {
+  public:
+
+    propagation_monitor (const options& opt)
+    : interval (opt.interrupt_interval), progress (opt.progress),
+      progress_interval (opt.progress_interval)
+    { }
+
+    void start (octave_idx_type npoints)
+    {
+      total = npoints;
+
+      settled = 0;
+
+      next_poll = interval;
+
+      start_time = last_report = std::chrono::steady_clock::now ();
+    }
+
+    void settle ()
+    {
+      if (++settled == next_poll)
+        poll ();
+    }
+
+    void finish ()
+    {
+      if (progress.is_defined ())
+        report (elapsed (start_time));
+    }
+
+    // points that are processed by worker threads, they can be processed
+    // more than once so the count is limited to the number of points
+    void update (octave_idx_type processed)
+    {
+      settled = std::min (processed, total);
+
+      poll ();
+    }
+
+    octave_idx_type poll_interval () const
+    {
+      return interval;
+    }
+
+  private:
+
+    void poll ()
+    {
+      next_poll += interval;
+
+      OCTAVE_QUIT;
+
+      if (progress.is_defined ())
+        {
+          const auto now = std::chrono::steady_clock::now ();
+
+          if (std::chrono::duration<double> (now - last_report).count () >= progress_interval)
+            {
+              last_report = now;
+
+              report (std::chrono::duration<double> (now - start_time).count ());
+            }
+        }
+    }
+
+    void report (double time)
+    {
+      const double fraction = total > 0 ? static_cast<double> (settled) / total : 1;
+
+      const double remaining = settled > 0
+                               ? time * (total - settled) / settled
+                               : std::numeric_limits<double>::infinity ();
+
+      if (progress.is_function_handle ())
+        octave::feval (progress, ovl (fraction, time, remaining));
+      else
+        {
+          std::ostringstream line;
+
+          line << std::fixed << std::setprecision (1)
+               << "curvdist: " << 100 * fraction << "% of points processed, "
+               << time << " s elapsed, ETA " << remaining << " s\n";
+
+          octave_stdout << line.str ();
+
+          flush_octave_stdout ();
+        }
+    }
+
+    const octave_idx_type interval;
+
+    const octave_value progress;
+
+    const double progress_interval;
+
+    octave_idx_type total = 0;
+
+    octave_idx_type settled = 0;
+
+    octave_idx_type next_poll = 0;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    std::chrono::steady_clock::time_point last_report;
+  };
+
+  // runs fn (0) ... fn (n-1) in worker threads. Octave can only be called
+  // from the calling thread, so it waits for the workers and checks for
+  // Ctrl-C and reports the progress each time they have processed another
+  // interval of points. An exception of a worker or of the check makes the
+  // other workers stop and is thrown again after all of them have finished.
+  class parallel_workers
+  {
+  public:
+
+    parallel_workers (propagation_monitor& monitor)
+    : monitor (monitor), interval (monitor.poll_interval ())
+    { }
+
+    template <typename Fn>
+    void run (octave_idx_type n, const Fn& fn)
+    {
+      std::vector<std::exception_ptr> errors (n);
+
+      std::vector<std::thread> workers;
+
+      std::exception_ptr error;
+
+      running = n;
+
+      try
+        {
+          for (octave_idx_type t = 0; t < n; t++)
+            workers.emplace_back ([&, t] ()
+              {
+                try
+                  {
+                    fn (t);
+                  }
+                catch (...)
+                  {
+                    errors[t] = std::current_exception ();
+
+                    stopped = true;
+                  }
+
+                {
+                  std::lock_guard<std::mutex> lock (mutex);
+
+                  running--;
+                }
+
+                wake.notify_one ();
+              });
+
+          std::unique_lock<std::mutex> lock (mutex);
+
+          while (running > 0)
+            {
+              wake.wait (lock, [&] () { return running == 0 || processed >= next_poll; });
+
+              if (processed >= next_poll)
+                {
+                  next_poll = processed + interval;
+
+                  const octave_idx_type count = processed;
+
+                  lock.unlock ();
+
+                  monitor.update (count);
+
+                  lock.lock ();
+                }
+            }
+        }
+      catch (...)
+        {
+          error = std::current_exception ();
+
+          stopped = true;
+        }
+
+      for (auto& w : workers)
+        w.join ();
+
+      for (const auto& e : errors)
+        if (! error && e)
+          error = e;
+
+      if (error)
+        std::rethrow_exception (error);
+    }
+
+    // called by a worker after it has processed count points, returns
+    // false when it should stop
+    bool processed_points (octave_idx_type count)
+    {
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+
+        processed += count;
+      }
+
+      wake.notify_one ();
+
+      return ! stopped;
+    }
+
+    octave_idx_type batch () const
+    {
+      return interval;
+    }
+
+  private:
+
+    propagation_monitor& monitor;
+
+    const octave_idx_type interval;
+
+    std::mutex mutex;
+
+    std::condition_variable wake;
+
+    std::atomic<bool> stopped {false};
+
+    octave_idx_type running = 0;
+
+    octave_idx_type processed = 0;
+
+    octave_idx_type next_poll = 0;
+  };
+
+  // a multichannel image has its channels along the last dimension. The
+  // first channel is used for the spatial layout of the image.
+  template <typename ImageType>
+  ImageType
+  spatial_image (const ImageType& image, bool multichannel)
+  {
+    if (! multichannel)
+      return image;
 
-    for (int i = 0; i < dim.length(); i++)
-      result(i) += val;
+    dim_vector dims = image.dims ();
 
-    return result;
+    dims.resize (dims.ndims () - 1);
+
+    return ImageType (image.linear_slice (0, dims.numel ()).reshape (dims));
   }
 
   template <typename ResultType, typename  IndexType, typename ImageType >
@@ -47,74 +1502,84 @@ namespace image
 
     using element_type = std::pair<octave_idx_type, typename ResultType::element_type>;
 
-    curvdist2D (const ImageType& image, int nargout, const boolNDArray & mask, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdist2D (const ImageType& image, int nargout, const options& opt, const boolNDArray & mask, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (mask);
-          do_curvdist();
+          stats.initialization_time = elapsed (start);
+          run ();
 
         }
 
     }
 
-    curvdist2D (const ImageType& image, int nargout, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdist2D (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (C , R);
-          do_curvdist();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
-    curvdist2D (const ImageType& image, int nargout, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdist2D (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (ind);
-          do_curvdist();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
+    ~curvdist2D ()
+    {
+      if (finished && output != output_type::full)
+        keep_state ();
+      else
+        give_back_scratch (std::move (inheap));
+
+      give_back_scratch (Q.storage ());
+    }
+
     const ResultType&
     value () const
     {
@@ -124,9 +1589,49 @@ namespace image
     octave_value_list
     get_result ()
     {
+      if (output != output_type::full)
+        return compact_result (output, dist_mat, idx_segment, idx_predecessor, nargout, settled);
+
       return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
     }
 
+    octave_scalar_map
+    get_summary () const
+    {
+      return summary.get ();
+    }
+
+    octave_scalar_map
+    get_info (double conversion_time) const
+    {
+      octave_scalar_map bytes;
+
+      bytes.assign ("distance", static_cast<double> (dist_mat.numel () * sizeof (typename ResultType::element_type)));
+      bytes.assign ("inheap", static_cast<double> (inheap.size () * sizeof (char)));
+      bytes.assign ("idx", static_cast<double> (idx_segment.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("pred", static_cast<double> (idx_predecessor.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("queue", static_cast<double> (stats.max_queue_size * sizeof (element_type)));
+
+      octave_scalar_map time;
+
+      time.assign ("conversion", conversion_time);
+      time.assign ("initialization", stats.initialization_time);
+      time.assign ("propagation", stats.propagation_time);
+
+      octave_scalar_map info;
+
+      info.assign ("pushes", static_cast<double> (stats.pushes));
+      info.assign ("pops", static_cast<double> (stats.pops));
+      info.assign ("stale_pops", static_cast<double> (stats.stale_pops));
+      info.assign ("relaxations", static_cast<double> (stats.relaxations));
+      info.assign ("improvements", static_cast<double> (stats.improvements));
+      info.assign ("max_queue_size", static_cast<double> (stats.max_queue_size));
+      info.assign ("bytes", bytes);
+      info.assign ("time", time);
+
+      return info;
+    }
+
   private:
 
     struct PointCmp
@@ -160,7 +1665,7 @@ namespace image
     void
     initialize_from_seed (const Array<octave_idx_type>& ind)
     {
-      std::vector<element_type> cache;
+      std::vector<element_type> cache = take_scratch<element_type> ();
 
       if (f.dim1 () == 1 || f.dim2 () == 1)
         {
@@ -169,7 +1674,7 @@ namespace image
       else
         cache.reserve((f.dim1 () + f.dim2 ()) * 2);
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
+      Q = scratch_queue<element_type, PointCmp>
       {PointCmp{}, std::move(cache)};
 
       try
@@ -182,7 +1687,7 @@ namespace image
                 {
                   idx_segment.xelem(ind(i)-1) = ind(i);
 
-                  if (nargout == 3)
+                  if (nargout >= 3)
                     idx_predecessor.xelem(ind(i)-1) = 0;
                 }
 
@@ -201,7 +1706,7 @@ namespace image
       if (C.numel () != R.numel ())
         error ("C and R should have equal sizes");
 
-      std::vector<element_type> cache;
+      std::vector<element_type> cache = take_scratch<element_type> ();
 
       if (f.dim1 () == 1 || f.dim2 () == 1)
         {
@@ -210,7 +1715,7 @@ namespace image
       else
         cache.reserve((f.dim1 () + f.dim2 ()) * 2);
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
+      Q = scratch_queue<element_type, PointCmp>
       {PointCmp{}, std::move(cache)};
 
       const dim_vector& dim = f.dims();
@@ -227,7 +1732,7 @@ namespace image
                 {
                   idx_segment.xelem(ind) = ind + 1;
 
-                  if (nargout == 3)
+                  if (nargout >= 3)
                     idx_predecessor.xelem(ind) = 0;
                 }
 
@@ -247,7 +1752,7 @@ namespace image
         error ("mask and I should have equal sizes");
 
 
-      std::vector<element_type> cache;
+      std::vector<element_type> cache = take_scratch<element_type> ();
 
       if (f.dim1 () == 1 || f.dim2 () == 1)
         {
@@ -262,7 +1767,7 @@ namespace image
       else
         cache.reserve((f.dim1 () + f.dim2 ()) * 2);
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
+      Q = scratch_queue<element_type, PointCmp>
       {PointCmp{}, std::move(cache)};
 
       for (octave_idx_type i = 0; i < mask.numel () ; i++)
@@ -275,7 +1780,7 @@ namespace image
                 {
                   idx_segment.xelem(i) = i + 1;
 
-                  if (nargout == 3)
+                  if (nargout >= 3)
                     idx_predecessor.xelem(i) = 0;
                 }
 
@@ -284,27 +1789,52 @@ namespace image
         }
     }
 
-    template<typename T>
-    const std::vector<std::vector<T>>&
-    create_quasi_euclidean_chamfer_weights() const
+    // class of each neighbor from the axes in which it differs from the
+    // center, used with anisotropic spacing: 0 for the neighbors in the same
+    // column, 1 for the neighbors in the same row and 2 for the diagonals
+    std::vector<std::vector<char>>
+    create_axis_classes (bool only_direct_neghbors)
+    {
+      const auto& offset = create_offset_to_neighbors (3, only_direct_neghbors);
+
+      std::vector<std::vector<char>> result (offset.size ());
+
+      for (size_t k = 0; k < offset.size (); k++)
+        for (auto o : offset[k])
+          result[k].push_back (axes_of_offset (o) - 1);
+
+      return result;
+    }
+
+    // class of each neighbor in the offset tables. With diagonal_class
+    // direct neighbors are of class 0 and diagonal neighbors of class 1,
+    // otherwise all neighbors are of class 0.
+    std::vector<std::vector<char>>
+    create_neighbor_classes (const std::vector<std::vector<octave_idx_type>>& offset, bool diagonal_class)
     {
-      static const T h {1.0};
-      static const T sq2 {2.0};
-      static const std::vector<std::vector<T>> weight_quasi
+      if (diagonal_class)
         {
-          {},
-            {h,   sq2, h},
-            {h,   h,   sq2, h,   sq2},
-            {h,   sq2, h},
-            {h,   sq2, h,   h,   sq2},
-            {sq2, h,   sq2, h,   h,  sq2, h, sq2},
-            {sq2, h,   h,   sq2, h},
-            {h,   sq2, h},
-            {sq2, h,   sq2, h,   h},
-            {sq2, h,   h}
+          return
+            {
+              {},
+              {0, 0, 1},
+              {0, 0, 1, 0, 1},
+              {0, 1, 0},
+              {0, 1, 0, 0, 1},
+              {1, 0, 1, 0, 0, 1, 0, 1},
+              {1, 0, 0, 1, 0},
+              {0, 1, 0},
+              {1, 0, 1, 0, 0},
+              {1, 0, 0}
+            };
+        }
 
-        };
-      return weight_quasi;
+      std::vector<std::vector<char>> result (offset.size ());
+
+      for (size_t k = 0; k < offset.size (); k++)
+        result[k].assign (offset[k].size (), 0);
+
+      return result;
     }
 
     std::vector<std::vector<octave_idx_type>>
@@ -338,221 +1868,649 @@ namespace image
           {-dim1-1,-dim1,-1}
         };
 
-      if (only_direct_neghbors)
+      if (only_direct_neghbors)
+        {
+          return offset_4;
+        }
+      else
+        {
+          return offset_8;
+        }
+    }
+
+    // allocates the distances, idx, pred and the processed flags. The
+    // compact outputs reuse the arrays that a finished call on an image of
+    // the same size has kept, see keep_state
+    void
+    init_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      const dim_vector& dims = f.dims ();
+
+      auto& state = compact_state_slot<ResultType, IndexType, char> ();
+
+      if (output != output_type::full && state.dims == dims && ! state.inheap.empty ())
+        {
+          dist_mat = take_state_array (state.dist, dims, std::numeric_limits<T>::infinity ());
+
+          if (nargout >= 2)
+            idx_segment = take_state_array (state.segment, dims, typename IndexType::element_type (0));
+
+          if (nargout >= 3)
+            idx_predecessor = take_state_array (state.predecessor, dims, typename IndexType::element_type (0));
+
+          inheap = std::move (state.inheap);
+
+          state.inheap.clear ();
+
+          return;
+        }
+
+      dist_mat = ResultType (dims, std::numeric_limits<T>::infinity ());
+
+      if (f.numel () == 0)
+        return;
+
+      if (nargout >= 2)
+        idx_segment = IndexType (dims);
+
+      if (nargout >= 3)
+        idx_predecessor = IndexType (dims);
+
+      inheap = take_scratch<char> ();
+
+      inheap.assign (f.numel (), 5);
+
+      init_mask2D ();
+    }
+
+    // resets the points that the call has reached and keeps the arrays for
+    // the next call on an image of the same size
+    void
+    keep_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      for (octave_idx_type p : settled)
+        {
+          dist_mat.xelem (p) = std::numeric_limits<T>::infinity ();
+
+          if (nargout >= 2)
+            idx_segment.xelem (p) = 0;
+
+          if (nargout >= 3)
+            idx_predecessor.xelem (p) = 0;
+
+          inheap[p] = position_class (p);
+        }
+
+      auto& state = compact_state_slot<ResultType, IndexType, char> ();
+
+      if (state.dims != f.dims ())
+        state = compact_state<ResultType, IndexType, char> ();
+
+      state.dims = f.dims ();
+
+      state.dist = dist_mat;
+
+      if (nargout >= 2)
+        state.segment = idx_segment;
+
+      if (nargout >= 3)
+        state.predecessor = idx_predecessor;
+
+      state.inheap = std::move (inheap);
+    }
+
+    // the value of inheap of a point that is not processed, as init_mask2D
+    // sets it from the position of the point at the border of the image
+    char
+    position_class (octave_idx_type i) const
+    {
+      const octave_idx_type dim1 = f.dim1 ();
+
+      const octave_idx_type dim2 = f.dim2 ();
+
+      if (dim1 == 1 || dim2 == 1)
+        return 5;
+
+      const octave_idx_type row = i % dim1;
+
+      const octave_idx_type col = i / dim1;
+
+      const int row_class = row == 0 ? 0 : row == dim1 - 1 ? 2 : 1;
+
+      const int col_class = col == 0 ? 0 : col == dim2 - 1 ? 2 : 1;
+
+      return 1 + 3 * col_class + row_class;
+    }
+
+    void
+    init_mask2D()
+    {
+      const octave_idx_type dim1 = f.dim1();
+
+      const octave_idx_type dim2 = f.dim2();
+
+      if (dim1 == 1 || dim2 == 1)
+        return;
+
+      inheap[0] = 1;
+
+      for (octave_idx_type i = 1; i < dim1 -1; i++)
+        inheap[i] = 2;
+
+      inheap[dim1-1] = 3;
+
+      for (octave_idx_type i = 1; i < dim2-1 ; i++)
+        inheap[i*dim1] = 4;
+
+      for (octave_idx_type i = 1; i < dim2 -1; i++)
+        inheap[i*dim1+dim1-1] = 6;
+
+      inheap[dim1*dim2-dim1] = 7;
+
+      for (octave_idx_type i = dim1*dim2-dim1+1; i < dim1*dim2 -1; i++)
+        inheap[i] = 8;
+
+      inheap[dim1*dim2 - 1] = 9;
+    }
+
+    template <typename Kernel, typename Counter>
+    void propagate1D (const Kernel& step, Counter& counter)
+    {
+      octave_idx_type n = f.numel ();
+
+      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
+        {
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          counter.pop ();
+
+          if (! inheap[u.first])
+            {
+              counter.stale_pop ();
+
+              continue;
+            }
+
+          inheap[u.first] = 0;
+
+          monitor.settle ();
+
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.first).value () - 1, u.first, u.second);
+
+          if (output != output_type::full)
+            settled.push_back (u.first);
+
+          const typename Kernel::key_type ku = step.key (u.first);
+
+          for (auto p : {-1, 1})
+            {
+              auto v = u.first + p;
+
+              if (v >= 0 && v < n && inheap[v])
+                {
+                  counter.relax ();
+
+                  typename ResultType::element_type alt = u.second + step (ku, step.key (v), 0);
+
+                  if (alt < dist[v] && alt <= cutoff)
+                    {
+                      dist[v] = alt;
+
+                      if (nargout >= 2)
+                        {
+                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
+
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(v) = u.first + 1;
+                        }
+
+                      Q.push({v, alt});
+
+                      counter.improve (Q.size ());
+                    }
+                }
+            }
+        }
+    }
+
+    // improvement of a point of a neighboring tile
+    struct boundary_message
+    {
+      octave_idx_type target;
+      typename ResultType::element_type dist;
+      typename IndexType::element_type segment;
+      octave_idx_type predecessor;
+    };
+
+    template <typename Counter>
+    struct tile
+    {
+      // range of linear indexes of the points of the tile
+      octave_idx_type first = 0;
+      octave_idx_type last = 0;
+
+      std::priority_queue<element_type, std::vector<element_type>, PointCmp> queue;
+
+      // smallest distances that are sent to the columns on the left and on
+      // the right of the tile
+      std::vector<typename ResultType::element_type> sent[2];
+
+      // messages to the left and to the right tile of the current and of the
+      // previous round
+      std::vector<boundary_message> outbox[2][2];
+
+      Counter counter;
+
+      // points that the tile has processed, a point can be processed again
+      // in a later round
+      std::vector<octave_idx_type> reached;
+    };
+
+    octave_idx_type
+    tile_count () const
+    {
+      return std::min (threads, f.dim2 () / 8);
+    }
+
+    // the image is split into strips of columns that are processed in
+    // parallel. A strip sends the improved distances of the points of its
+    // neighbors to them and they are propagated in the next round, until no
+    // distance changes. Points can be processed again when their distance
+    // improves so the final distances are the same as in the serial
+    // propagation, for equal distances idx and pred can be different. The
+    // reached points are returned in increasing order when they are needed
+    // for the summary or the compact outputs.
+    template <typename Kernel, typename Counter>
+    std::vector<octave_idx_type> propagate2D_tiled (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      const octave_idx_type dim1 = f.dim1 ();
+
+      const octave_idx_type dim2 = f.dim2 ();
+
+      const octave_idx_type ntiles = tile_count ();
+
+      std::vector<tile<Counter>> tiles (ntiles);
+
+      for (octave_idx_type t = 0; t < ntiles; t++)
+        {
+          tiles[t].first = t * dim2 / ntiles * dim1;
+
+          tiles[t].last = (t + 1) * dim2 / ntiles * dim1;
+
+          for (auto& s : tiles[t].sent)
+            s.assign (dim1, std::numeric_limits<T>::infinity ());
+        }
+
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
+        {
+          const element_type u = Q.top ();
+
+          Q.pop ();
+
+          octave_idx_type t = u.first / dim1 * ntiles / dim2;
+
+          while (u.first < tiles[t].first)
+            t--;
+
+          while (u.first >= tiles[t].last)
+            t++;
+
+          tiles[t].queue.push (u);
+        }
+
+      T* dist = dist_mat.fortran_vec ();
+
+      typename IndexType::element_type* segment = nargout >= 2 ? idx_segment.fortran_vec () : nullptr;
+
+      typename IndexType::element_type* predecessor = nargout >= 3 ? idx_predecessor.fortran_vec () : nullptr;
+
+      parallel_workers workers (monitor);
+
+      for (int round = 0; ; round++)
         {
-          return offset_4;
+          workers.run (ntiles, [&] (octave_idx_type t)
+            {
+              propagate_tile (step, offset, neighbor_class, tiles, t, round, dist, segment, predecessor, workers);
+            });
+
+          OCTAVE_QUIT;
+
+          bool changed = false;
+
+          for (const auto& tl : tiles)
+            for (const auto& out : tl.outbox[round % 2])
+              changed = changed || ! out.empty ();
+
+          if (! changed)
+            break;
         }
-      else
+
+      std::vector<octave_idx_type> reached;
+
+      for (const auto& tl : tiles)
         {
-          return offset_8;
+          counter.merge (tl.counter);
+
+          reached.insert (reached.end (), tl.reached.begin (), tl.reached.end ());
         }
+
+      std::sort (reached.begin (), reached.end ());
+
+      reached.erase (std::unique (reached.begin (), reached.end ()), reached.end ());
+
+      return reached;
     }
 
-    void
-    init_mask2D()
+    template <typename Kernel, typename Counter>
+    void propagate_tile (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, std::vector<tile<Counter>>& tiles, octave_idx_type t, int round, typename ResultType::element_type* dist, typename IndexType::element_type* segment, typename IndexType::element_type* predecessor, parallel_workers& workers)
     {
-      const octave_idx_type dim1 = f.dim1();
+      using T = typename ResultType::element_type;
 
-      const octave_idx_type dim2 = f.dim2();
+      tile<Counter>& own = tiles[t];
+      auto& out = own.outbox[round % 2];
 
-      if (dim1 == 1 || dim2 == 1)
-        return;
+      out[0].clear ();
 
-      inheap[0] = 1;
+      out[1].clear ();
 
-      for (octave_idx_type i = 1; i < dim1 -1; i++)
-        inheap[i] = 2;
+      auto receive = [&] (const std::vector<boundary_message>& messages)
+        {
+          for (const auto& m : messages)
+            if (m.dist < dist[m.target])
+              {
+                dist[m.target] = m.dist;
 
-      inheap[dim1-1] = 3;
+                if (nargout >= 2)
+                  {
+                    segment[m.target] = m.segment;
 
-      for (octave_idx_type i = 1; i < dim2-1 ; i++)
-        inheap[i*dim1] = 4;
+                    if (nargout >= 3)
+                      predecessor[m.target] = m.predecessor;
+                  }
 
-      for (octave_idx_type i = 1; i < dim2 -1; i++)
-        inheap[i*dim1+dim1-1] = 6;
+                own.queue.push ({m.target, m.dist});
 
-      inheap[dim1*dim2-dim1] = 7;
+                own.counter.improve (own.queue.size ());
+              }
+        };
 
-      for (octave_idx_type i = dim1*dim2-dim1+1; i < dim1*dim2 -1; i++)
-        inheap[i] = 8;
+      if (round > 0)
+        {
+          if (t > 0)
+            receive (tiles[t-1].outbox[(round - 1) % 2][1]);
 
-      inheap[dim1*dim2 - 1] = 9;
-    }
+          if (t + 1 < static_cast<octave_idx_type> (tiles.size ()))
+            receive (tiles[t+1].outbox[(round - 1) % 2][0]);
+        }
 
-    void do_curvdist1D ()
-    {
-      octave_idx_type n = f.numel ();
+      const octave_idx_type dim1 = f.dim1 ();
 
-      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+      // points processed since the last count that was given to the workers
+      octave_idx_type pending = 0;
 
-      while (! Q.empty ())
+      while (! own.queue.empty ())
         {
-          auto u = Q.top ();
+          auto u = own.queue.top ();
 
-          Q.pop ();
+          own.queue.pop ();
 
-          if (! inheap[u.first])
+          own.counter.pop ();
+
+          if (u.second > dist[u.first])
             {
+              own.counter.stale_pop ();
+
               continue;
             }
 
-          inheap[u.first] = 0;
+          if (want_summary || output != output_type::full)
+            own.reached.push_back (u.first);
+
+          if (++pending == workers.batch ())
+            {
+              pending = 0;
 
-          const bool quasi = method == distance_type::quasieuclidean;
+              if (! workers.processed_points (workers.batch ()))
+                return;
+            }
 
-          typename ResultType::element_type fu = f(u.first);
+          // inheap only holds the position of the points in this mode
+          const auto& neighbor_idx = offset[inheap[u.first]];
 
-          for (auto p : {-1, 1})
+          const auto& cls = neighbor_class[inheap[u.first]];
+
+          const typename Kernel::key_type ku = step.key (u.first);
+
+          for (size_t i = 0 ; i < neighbor_idx.size(); i++)
             {
-              auto v = u.first + p;
+              octave_idx_type v = u.first + neighbor_idx[i];
 
-              if (v >= 0 && v < n && inheap[v])
-                {
-                  typename ResultType::element_type fv = f(v);
+              own.counter.relax ();
 
-                  typename ResultType::element_type alt =
-                    quasi ?
-                    u.second + sqrt (pow(fu - fv,2) + 1) :
-                    u.second + abs (fu - fv) + 1;
+              const T alt = u.second + step (ku, step.key (v), cls[i]);
 
-                  if (alt < dist[v])
+              if (v >= own.first && v < own.last)
+                {
+                  if (alt < dist[v] && alt <= cutoff)
                     {
                       dist[v] = alt;
 
                       if (nargout >= 2)
                         {
-                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
+                          segment[v] = segment[u.first];
 
-                          if (nargout == 3)
-                            idx_predecessor.xelem(v) = u.first + 1;
+                          if (nargout >= 3)
+                            predecessor[v] = u.first + 1;
                         }
 
-                      Q.push({v, alt});
+                      own.queue.push ({v, alt});
+
+                      own.counter.improve (own.queue.size ());
+                    }
+                }
+              else
+                {
+                  const int side = v < own.first ? 0 : 1;
+
+                  T& sent = own.sent[side][v % dim1];
+
+                  if (alt < sent && alt <= cutoff)
+                    {
+                      sent = alt;
+
+                      out[side].push_back ({v, alt, nargout >= 2 ? segment[u.first] : typename IndexType::element_type (), u.first + 1});
                     }
                 }
             }
         }
+
+      workers.processed_points (pending);
     }
 
-    void do_curvdist2D ()
+    template <typename Kernel, typename Counter>
+    void propagate2D (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, Counter& counter)
     {
-      const octave_idx_type dim1 = f.dim1();
-
       typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+      if (tile_count () > 1)
+        {
+          std::vector<octave_idx_type> reached = propagate2D_tiled (step, offset, neighbor_class, counter);
 
-      bool only_direct_neghbors = method == distance_type::cityblock;
+          if (want_summary)
+            summary.collect (dist_mat, idx_segment, reached);
+
+          if (output != output_type::full)
+            settled = std::move (reached);
+
+          return;
+        }
 
-      const auto& offset = create_offset_to_neighbors (dim1, only_direct_neghbors);
 
-      if (method == distance_type::chessboard || method == distance_type::cityblock)
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
         {
-          while (! Q.empty ())
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          counter.pop ();
+
+          auto idx_to_w = inheap[u.first];
+
+          if (! idx_to_w)
             {
-              auto u = Q.top ();
+              counter.stale_pop ();
 
-              Q.pop ();
+              continue;
+            }
 
-              auto idx_to_w = inheap[u.first];
+          inheap[u.first] = 0;
 
-              if (! idx_to_w)
-                {
-                  continue;
-                }
+          monitor.settle ();
+
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.first).value () - 1, u.first, u.second);
+
+          if (output != output_type::full)
+            settled.push_back (u.first);
+
+          const auto& neighbor_idx = offset[idx_to_w];
 
-              inheap[u.first] = 0;
+          const auto& cls = neighbor_class[idx_to_w];
 
-              const auto& neighbor_idx = offset[idx_to_w];
+          const typename Kernel::key_type ku = step.key (u.first);
 
-              typename ResultType::element_type fu = f(u.first);
+          for (size_t i = 0 ; i < neighbor_idx.size(); i++)
+            {
+              octave_idx_type v = u.first + neighbor_idx[i];
 
-              for (size_t i = 0 ; i < neighbor_idx.size(); i++)
+              if (inheap[v])
                 {
-                  octave_idx_type v = u.first + neighbor_idx[i];
+                  counter.relax ();
 
-                  if (inheap[v])
-                    {
-                      typename ResultType::element_type fv = f(v);
+                  typename ResultType::element_type alt = u.second + step (ku, step.key (v), cls[i]);
 
-                      typename ResultType::element_type alt = u.second + abs (fu - fv) + 1;
+                  if (alt < dist[v] && alt <= cutoff)
+                    {
+                      dist[v] = alt;
 
-                      if (alt < dist[v])
+                      if (nargout >= 2)
                         {
-                          dist[v] = alt;
+                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(v) = idx_segment.xelem(u.first);
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(v) = u.first + 1;
+                        }
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(v) = u.first + 1;
-                            }
+                      Q.push({v, alt});
 
-                          Q.push({v, alt});
-                        }
+                      counter.improve (Q.size ());
                     }
                 }
-
-              OCTAVE_QUIT;
             }
         }
-      else if (method == distance_type::quasieuclidean)
-        {
-          const auto& weight_quasi = create_quasi_euclidean_chamfer_weights<typename ResultType::element_type> ();
+    }
 
-          while (! Q.empty ())
-            {
-              auto u = Q.top ();
+    template <typename Step, typename Counter>
+    void select_kernel1D (const std::vector<typename ResultType::element_type>& weights, Counter& counter)
+    {
+      using T = typename ResultType::element_type;
 
-              Q.pop ();
+      using image_elem = typename ImageType::element_type;
 
-              auto idx_to_w = inheap[u.first];
+      if (nchannels > 1)
+        propagate1D (channel_cost<T, Step> (cost, channels, nchannels, weights), counter);
+      else if (use_difference_table<image_elem> (cost, f.numel (), 2, weights.size ()))
+        propagate1D (difference_table_cost<T, Step, image_elem> (f.data (), weights), counter);
+      else if (use_pair_table<image_elem> (f.numel (), 2, weights.size ()))
+        propagate1D (pair_table_cost<T, Step, image_elem> (cost, f.data (), weights), counter);
+      else
+        propagate1D (level_cost<T, Step, image_elem> (cost, f.data (), weights), counter);
+    }
 
-              if (! idx_to_w)
-                {
-                  continue;
-                }
+    template <typename Step, typename Counter>
+    void select_kernel2D (const std::vector<typename ResultType::element_type>& weights, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, octave_idx_type nneighbors, Counter& counter)
+    {
+      using T = typename ResultType::element_type;
 
-              inheap[u.first] = 0;
+      using image_elem = typename ImageType::element_type;
 
-              const auto& neighbor_idx = offset[idx_to_w];
+      if (nchannels > 1)
+        propagate2D (channel_cost<T, Step> (cost, channels, nchannels, weights), offset, neighbor_class, counter);
+      else if (use_difference_table<image_elem> (cost, f.numel (), nneighbors, weights.size ()))
+        propagate2D (difference_table_cost<T, Step, image_elem> (f.data (), weights), offset, neighbor_class, counter);
+      else if (use_pair_table<image_elem> (f.numel (), nneighbors, weights.size ()))
+        propagate2D (pair_table_cost<T, Step, image_elem> (cost, f.data (), weights), offset, neighbor_class, counter);
+      else
+        propagate2D (level_cost<T, Step, image_elem> (cost, f.data (), weights), offset, neighbor_class, counter);
+    }
 
-              const auto& wei = weight_quasi[idx_to_w];
+    template <typename Counter>
+    void do_curvdist1D (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
 
-              typename ResultType::element_type fu = f(u.first);
+      const double length = spacing.empty () ? 1 : spacing[0];
 
-              for (size_t i = 0 ; i < neighbor_idx.size(); i++)
-                {
-                  auto v = u.first + neighbor_idx[i];
+      // the quasi-euclidean step takes the squared length
+      const std::vector<T> weights {static_cast<T> (method == distance_type::quasieuclidean ? length * length : length)};
 
-                  if (inheap[v])
-                    {
-                      typename ResultType::element_type fv = f(v);
+      if (method == distance_type::quasieuclidean)
+        select_kernel1D<quasi_euclidean_step<T>> (weights, counter);
+      else
+        select_kernel1D<chessboard_step<T>> (weights, counter);
+    }
+
+    template <typename Counter>
+    void do_curvdist2D (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
 
-                      typename ResultType::element_type alt = u.second + sqrt(wei[i] + pow(fu - fv, 2));
+      const octave_idx_type dim1 = f.dim1();
 
-                      if (alt < dist[v])
-                        {
-                          dist[v] = alt;
+      bool only_direct_neghbors = method == distance_type::cityblock;
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(v) = idx_segment.xelem(u.first);
+      bool quasi = method == distance_type::quasieuclidean;
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(v) = u.first + 1;
-                            }
+      const auto& offset = create_offset_to_neighbors (dim1, only_direct_neghbors);
 
-                          Q.push({v, alt});
-                        }
-                    }
-                }
+      if (! spacing.empty ())
+        {
+          const auto& neighbor_class = create_axis_classes (only_direct_neghbors);
 
-              OCTAVE_QUIT;
-            }
+          if (quasi)
+            select_kernel2D<quasi_euclidean_step<T>> (axis_weights<T> (spacing, [&] (int mask) { return squared_step_length (mask, spacing); }), offset, neighbor_class, 8, counter);
+          else
+            select_kernel2D<chessboard_step<T>> (axis_weights<T> (spacing, [&] (int mask) { return step_length (mask, spacing, false); }), offset, neighbor_class, only_direct_neghbors ? 4 : 8, counter);
+
+          return;
         }
+
+      const auto& neighbor_class = create_neighbor_classes (offset, quasi);
+
+      if (quasi)
+        select_kernel2D<quasi_euclidean_step<T>> ({static_cast<T> (1), static_cast<T> (2)}, offset, neighbor_class, 8, counter);
+      else
+        select_kernel2D<chessboard_step<T>> ({static_cast<T> (1)}, offset, neighbor_class, only_direct_neghbors ? 4 : 8, counter);
     }
 
-    void do_curvdist()
+    template <typename Counter>
+    void do_curvdist(Counter& counter)
     {
       const octave_idx_type dim1 = f.dim1();
 
@@ -560,25 +2518,90 @@ namespace image
 
       if (dim1 == 1 || dim2 == 1)
         {
-           do_curvdist1D ();
+           do_curvdist1D (counter);
+        }
+      else
+        {
+           do_curvdist2D (counter);
+        }
+    }
+
+    void run ()
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      if (want_summary)
+        {
+          std::vector<octave_idx_type> seeds;
+
+          for (const auto& e : Q.storage ())
+            seeds.push_back (e.first);
+
+          summary.start (std::move (seeds));
         }
+
+      monitor.start (f.numel ());
+
+      if (collect_stats)
+        do_curvdist (stats);
       else
         {
-           do_curvdist2D ();
+          no_stats counter;
+
+          do_curvdist (counter);
         }
+
+      stats.propagation_time = elapsed (start);
+
+      monitor.finish ();
+
+      finished = true;
     }
 
     ImageType f;
 
+    cost_transform<typename ResultType::element_type> cost;
+
+    // multichannel image when nchannels > 1
+    ImageType channels;
+
+    octave_idx_type nchannels = 1;
+
     const int nargout;
 
+    const bool collect_stats;
+
+    propagation_stats stats;
+
+    propagation_monitor monitor;
+
+    const octave_idx_type threads;
+
+    const std::vector<double> spacing;
+
+    const bool want_summary;
+
+    region_summary<ResultType> summary;
+
+    // the neighbors are only improved up to this distance
+    const typename ResultType::element_type cutoff;
+
+    const output_type output;
+
+    // the points in the order they are settled for the compact outputs
+    std::vector<octave_idx_type> settled;
+
+    // the propagation has completed, so the state can be kept for the next
+    // call
+    bool finished = false;
+
     ResultType dist_mat;
 
     IndexType idx_segment;
 
     IndexType idx_predecessor;
 
-    std::priority_queue<std::pair<octave_idx_type, typename ResultType::element_type>,std::vector<std::pair<octave_idx_type, typename ResultType::element_type>>, PointCmp> Q;
+    scratch_queue<element_type, PointCmp> Q;
 
     std::vector<char> inheap;
 
@@ -589,12 +2612,7 @@ namespace image
   class curvdistND
   {
   public:
-    struct queue_elem_type
-    {
-      octave_idx_type maskindex = 0;
-      octave_idx_type imageindex = 0;
-      typename ResultType::element_type imageval = 0;
-    };
+    using queue_elem_type = nd_queue_elem<typename ResultType::element_type>;
 
     struct PointCmpND
     {
@@ -604,69 +2622,82 @@ namespace image
       {return a.imageval > b.imageval;}
     };
 
-    curvdistND (const ImageType& image, int nargout, const boolNDArray & mask, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdistND (const ImageType& image, int nargout, const options& opt, const boolNDArray & mask, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
           initialize_from_seed (mask);
-          do_curvdistND();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
 
     }
-    curvdistND (const ImageType& image, int nargout, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdistND (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
           initialize_from_seed (C , R);
-          do_curvdistND();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
-    curvdistND (const ImageType& image, int nargout, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    curvdistND (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
+    : f (spatial_image (image, opt.multichannel)), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), std::numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
+
+      init_state ();
 
-      if (image.numel () != 0)
+      if (f.numel () != 0)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          nchannels = image.numel () / f.numel ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          if (nchannels > 1)
+            channels = image;
 
-          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
           initialize_from_seed (ind);
-          do_curvdistND();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
+    ~curvdistND ()
+    {
+      if (finished && output != output_type::full)
+        keep_state ();
+      else
+        give_back_scratch (std::move (inheap));
+
+      give_back_scratch (Q.storage ());
+    }
+
     const ResultType&
     value () const
     {
@@ -676,9 +2707,49 @@ namespace image
     octave_value_list
     get_result ()
     {
+      if (output != output_type::full)
+        return compact_result (output, dist_mat, idx_segment, idx_predecessor, nargout, settled);
+
       return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
     }
 
+    octave_scalar_map
+    get_summary () const
+    {
+      return summary.get ();
+    }
+
+    octave_scalar_map
+    get_info (double conversion_time) const
+    {
+      octave_scalar_map bytes;
+
+      bytes.assign ("distance", static_cast<double> (dist_mat.numel () * sizeof (typename ResultType::element_type)));
+      bytes.assign ("inheap", static_cast<double> ((inheap.size () + 7) / 8));
+      bytes.assign ("idx", static_cast<double> (idx_segment.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("pred", static_cast<double> (idx_predecessor.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("queue", static_cast<double> (stats.max_queue_size * sizeof (queue_elem_type)));
+
+      octave_scalar_map time;
+
+      time.assign ("conversion", conversion_time);
+      time.assign ("initialization", stats.initialization_time);
+      time.assign ("propagation", stats.propagation_time);
+
+      octave_scalar_map info;
+
+      info.assign ("pushes", static_cast<double> (stats.pushes));
+      info.assign ("pops", static_cast<double> (stats.pops));
+      info.assign ("stale_pops", static_cast<double> (stats.stale_pops));
+      info.assign ("relaxations", static_cast<double> (stats.relaxations));
+      info.assign ("improvements", static_cast<double> (stats.improvements));
+      info.assign ("max_queue_size", static_cast<double> (stats.max_queue_size));
+      info.assign ("bytes", bytes);
+      info.assign ("time", time);
+
+      return info;
+    }
+
   private:
 
     octave_idx_type
@@ -693,7 +2764,7 @@ namespace image
           idximg %= cumimgdim[n];
         }
 
-      return idxmsk + idximg + sumcummask + 1  ;
+      return idxmsk + idximg + radius * (sumcummask + 1);
     }
 
     std::tuple<std::vector <octave_idx_type>,std::vector <octave_idx_type>, octave_idx_type>
@@ -747,14 +2818,14 @@ namespace image
     {
       const dim_vector& dim = f.dims();
 
-      std::vector<queue_elem_type> cache;
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
 
       cache.reserve(dim.numel() - (dim+(-2)).numel());
 
-       Q =std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
+       Q = scratch_queue<queue_elem_type, PointCmpND>
          {PointCmpND{}, std::move(cache)};
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
 
       try
         {
@@ -766,7 +2837,7 @@ namespace image
                 {
                   idx_segment.xelem(ind(i)-1) = ind(i);
 
-                  if (nargout == 3)
+                  if (nargout >= 3)
                     idx_predecessor.xelem(ind(i)-1) = 0;
                 }
 
@@ -787,14 +2858,14 @@ namespace image
 
       const dim_vector& dim = f.dims();
 
-      std::vector<queue_elem_type> cache;
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
 
       cache.reserve(dim.numel() - (dim+(-2)).numel());
 
-       Q = std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
+       Q = scratch_queue<queue_elem_type, PointCmpND>
          {PointCmpND{}, std::move(cache)};
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
 
       try
         {
@@ -808,7 +2879,7 @@ namespace image
                 {
                   idx_segment.xelem(ind) = ind + 1;
 
-                  if (nargout == 3)
+                  if (nargout >= 3)
                     idx_predecessor.xelem(ind) = 0;
                 }
 
@@ -821,45 +2892,132 @@ namespace image
         }
     }
 
-    void
-    initialize_from_seed (const boolNDArray& mask)
+    void
+    initialize_from_seed (const boolNDArray& mask)
+    {
+      if (mask.numel () != f.numel ())
+        error ("mask and I should have equal sizes");
+
+      const dim_vector& dim = f.dims();
+
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
+
+      cache.reserve(dim.numel() - (dim+(-2)).numel());
+
+      Q = scratch_queue<queue_elem_type, PointCmpND>
+         {PointCmpND{}, std::move(cache)};
+
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
+
+      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+        {
+          if (mask.xelem(i))
+            {
+              dist_mat(i) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(i) = i + 1;
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(i) = 0;
+                }
+              Q.push({image_to_mask_index (i,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), i, 0});
+            }
+        }
+    }
+
+    // offsets of the neighbors of the chamfer neighborhood in the mask and in
+    // the image. Neighbors with the same spatial length are in the same
+    // class, the squared length of each class is returned.
+    std::vector<double>
+    create_chamfer_neighbors (std::vector<octave_idx_type>& mask_neighbor_idx, std::vector<octave_idx_type>& image_neighbor_idx, std::vector<char>& neighbor_class)
+    {
+      const dim_vector& dims = f.dims ();
+
+      const dim_vector mask_dims = dims + 2 * radius;
+
+      std::vector<double> squared_lengths;
+
+      for (const auto& step : chamfer_steps (dims.ndims ()))
+        {
+          octave_idx_type mask_offset = 0;
+
+          octave_idx_type image_offset = 0;
+
+          octave_idx_type mask_stride = 1;
+
+          octave_idx_type image_stride = 1;
+
+          double squared_length = 0;
+
+          for (int k = 0; k < dims.ndims (); k++)
+            {
+              mask_offset += step[k] * mask_stride;
+
+              image_offset += step[k] * image_stride;
+
+              mask_stride *= mask_dims(k);
+
+              image_stride *= dims(k);
+
+              const double length = step[k] * (spacing.empty () ? 1 : spacing[k]);
+
+              squared_length += length * length;
+            }
+
+          auto cls = std::find (squared_lengths.begin (), squared_lengths.end (), squared_length) - squared_lengths.begin ();
+
+          if (cls == static_cast<octave_idx_type> (squared_lengths.size ()))
+            {
+              if (cls > std::numeric_limits<char>::max ())
+                error ("too many neighbor classes for Neighborhood 5");
+
+              squared_lengths.push_back (squared_length);
+            }
+
+          mask_neighbor_idx.push_back (mask_offset);
+
+          image_neighbor_idx.push_back (image_offset);
+
+          neighbor_class.push_back (cls);
+        }
+
+      return squared_lengths;
+    }
+
+    // class of each neighbor from the axes in which it differs from the
+    // center, used with anisotropic spacing
+    std::vector<char>
+    create_axis_classes (bool only_direct_neghbors)
     {
-      if (mask.numel () != f.numel ())
-        error ("mask and I should have equal sizes");
-
-      const dim_vector& dim = f.dims();
-
-      std::vector<queue_elem_type> cache;
+      if (f.ndims () > 7)
+        error ("curvdist: Spacing can only be used with images of up to 7 dimensions");
 
-      cache.reserve(dim.numel() - (dim+(-2)).numel());
+      dim_vector dims = f.dims ();
 
-      Q = std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
-         {PointCmpND{}, std::move(cache)};
+      for (int k = 0; k < dims.ndims (); k++)
+        dims(k) = 3;
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+      const auto& offset = create_offset_to_neighbors (dims, only_direct_neghbors);
 
-      for (octave_idx_type i = 0; i < mask.numel () ; i++)
-        {
-          if (mask.xelem(i))
-            {
-              dist_mat(i) = 0;
+      std::vector<char> result;
 
-              if (nargout >= 2)
-                {
-                  idx_segment.xelem(i) = i + 1;
+      for (auto o : offset)
+        result.push_back (axes_of_offset (o) - 1);
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(i) = 0;
-                }
-              Q.push({image_to_mask_index (i,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), i, 0});
-            }
-        }
+      return result;
     }
 
-    template<typename T>
-    std::vector<T>
-    create_quasi_euclidean_chamfer_weights(const dim_vector& array_dims)
+    // class of each neighbor in the offset table. With distance_class the
+    // class is the number of coordinates in which the neighbor differs from
+    // the center minus one, otherwise all neighbors are of class 0.
+    std::vector<char>
+    create_neighbor_classes (const dim_vector& array_dims, octave_idx_type nneighbors, bool distance_class)
     {
+      if (! distance_class)
+        return std::vector<char> (nneighbors, 0);
+
       MArray<octave_idx_type> start(dim_vector(3,1));
 
       start(0) = 1;
@@ -884,17 +3042,17 @@ namespace image
 
       const octave_idx_type result_size = pow(3,array_dims.length());
 
-      std::vector<T> wei (result_size-1);
+      std::vector<char> cls (result_size-1);
 
       octave_idx_type s = 0;
 
       for (int j = 0; j < result_size; j++)
         {
           if (j != result_size/2)
-            wei[s++] = sqrt(dist(j))/2;
+            cls[s++] = dist(j) - 1;
         }
 
-      return wei;
+      return cls;
     }
 
     std::vector<octave_idx_type>
@@ -959,6 +3117,91 @@ namespace image
       return offset;
     }
 
+    // allocates the distances, idx, pred and the processed flags. The
+    // compact outputs reuse the arrays that a finished call on an image of
+    // the same size and with the same padding has kept, see keep_state
+    void
+    init_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      const dim_vector& dims = f.dims ();
+
+      auto& state = compact_state_slot<ResultType, IndexType, bool> ();
+
+      if (output != output_type::full && state.dims == dims && state.layout == radius && ! state.inheap.empty ())
+        {
+          dist_mat = take_state_array (state.dist, dims, std::numeric_limits<T>::infinity ());
+
+          if (nargout >= 2)
+            idx_segment = take_state_array (state.segment, dims, typename IndexType::element_type (0));
+
+          if (nargout >= 3)
+            idx_predecessor = take_state_array (state.predecessor, dims, typename IndexType::element_type (0));
+
+          inheap = std::move (state.inheap);
+
+          state.inheap.clear ();
+
+          return;
+        }
+
+      dist_mat = ResultType (dims, std::numeric_limits<T>::infinity ());
+
+      if (f.numel () == 0)
+        return;
+
+      if (nargout >= 2)
+        idx_segment = IndexType (dims);
+
+      if (nargout >= 3)
+        idx_predecessor = IndexType (dims);
+
+      inheap = create_zero_padded_maskND (dims);
+    }
+
+    // resets the points that the call has reached and keeps the arrays for
+    // the next call on an image of the same size
+    void
+    keep_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      for (size_t k = 0; k < settled.size (); k++)
+        {
+          const octave_idx_type p = settled[k];
+
+          dist_mat.xelem (p) = std::numeric_limits<T>::infinity ();
+
+          if (nargout >= 2)
+            idx_segment.xelem (p) = 0;
+
+          if (nargout >= 3)
+            idx_predecessor.xelem (p) = 0;
+
+          inheap[settled_mask[k]] = true;
+        }
+
+      auto& state = compact_state_slot<ResultType, IndexType, bool> ();
+
+      if (state.dims != f.dims () || state.layout != radius)
+        state = compact_state<ResultType, IndexType, bool> ();
+
+      state.dims = f.dims ();
+
+      state.layout = radius;
+
+      state.dist = dist_mat;
+
+      if (nargout >= 2)
+        state.segment = idx_segment;
+
+      if (nargout >= 3)
+        state.predecessor = idx_predecessor;
+
+      state.inheap = std::move (inheap);
+    }
+
     std::vector<bool>
     create_zero_padded_maskND( dim_vector dims)
     {
@@ -967,12 +3210,14 @@ namespace image
 
       for (int i = 0 ;i < dims.length (); i++)
         {
-          dims(i) += 2;
+          dims(i) += 2 * radius;
 
           size *= dims(i);
         }
 
-      std::vector<bool> result(size, true);
+      std::vector<bool> result = take_scratch<bool> ();
+
+      result.assign (size, true);
 
       std::vector<std::pair<octave_idx_type,octave_idx_type>> bounds;
 
@@ -990,8 +3235,10 @@ namespace image
       for (octave_idx_type k = 0 ;k < dims.length(); k++)
         {
           sz = sz/dims(k);
-          for (octave_idx_type pad : {octave_idx_type (1), dims(k)})
+          for (octave_idx_type r = 0; r < 2 * radius; r++)
             {
+              const octave_idx_type pad = r < radius ? r + 1 : dims(k) - 2 * radius + r + 1;
+
               bounds[k] = {pad-1, pad};
 
               for (octave_idx_type s = 0 ;s < dims.length(); s++)
@@ -1018,212 +3265,466 @@ namespace image
                   result[compute_index(indexes,dims)] = false;
                 }
             }
-          sz = sz*(dims(k)-2);
+          sz = sz*(dims(k) - 2 * radius);
 
-          bounds[k] = {1, dims(k)-1};
+          bounds[k] = {radius, dims(k) - radius};
         }
 
       return result;
     }
 
+    template <typename Kernel, typename Counter>
     void
-    do_curvdistND ()
+    propagateND (const Kernel& step, const std::vector<octave_idx_type>& mask_neighbor_idx, const std::vector<octave_idx_type>& image_neighbor_idx, const std::vector<char>& neighbor_class, Counter& counter)
     {
       typename ResultType::element_type* dist = dist_mat.fortran_vec ();
 
-      bool only_direct_neghbors = method == distance_type::cityblock;
+      counter.start (Q.size ());
 
-      auto mask_neighbor_idx = create_offset_to_neighbors (f.dims () + 2, only_direct_neghbors);
+      while (! Q.empty ())
+        {
+          auto u = Q.top ();
 
-      auto image_neighbor_idx = create_offset_to_neighbors (f.dims (), only_direct_neghbors);
+          Q.pop ();
 
-      if (method == distance_type::chessboard || method == distance_type::cityblock)
-        {
-          while (! Q.empty ())
+          counter.pop ();
+
+          if (! inheap[u.maskindex])
             {
-              auto u = Q.top ();
+              counter.stale_pop ();
+
+              continue;
+            }
 
-              Q.pop ();
+          inheap[u.maskindex] = 0;
 
-              if (! inheap[u.maskindex])
-                {
-                  continue;
-                }
+          monitor.settle ();
+
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.imageindex).value () - 1, u.imageindex, u.imageval);
+
+          if (output != output_type::full)
+            {
+              settled.push_back (u.imageindex);
+
+              settled_mask.push_back (u.maskindex);
+            }
 
-              inheap[u.maskindex] = 0;
+          const typename Kernel::key_type ku = step.key (u.imageindex);
 
-              typename ResultType::element_type fu = f(u.imageindex);
+          for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
+            {
+              auto vmask = u.maskindex + mask_neighbor_idx[i];
 
-              for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
+              if (inheap[vmask])
                 {
-                  auto vmask = u.maskindex + mask_neighbor_idx[i];
+                  counter.relax ();
 
-                  if (inheap[vmask])
-                    {
-                      auto vimage = u.imageindex + image_neighbor_idx[i];
+                  auto vimage = u.imageindex + image_neighbor_idx[i];
 
-                      typename ResultType::element_type fv = f(vimage);
+                  typename ResultType::element_type alt = u.imageval + step (ku, step.key (vimage), neighbor_class[i]);
 
-                      typename ResultType::element_type alt = u.imageval + abs(fu - fv) + 1;
+                  if (alt < dist[vimage] && alt <= cutoff)
+                    {
+                      dist[vimage] = alt;
 
-                      if (alt < dist[vimage])
+                      if (nargout >= 2)
                         {
-                          dist[vimage] = alt;
+                          idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(vimage) = u.imageindex + 1;
+                        }
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(vimage) = u.imageindex+1;
-                            }
+                      Q.push({vmask, vimage, alt});
 
-                          Q.push({vmask, vimage, alt});
-                        }
+                      counter.improve (Q.size ());
                     }
                 }
-
-              OCTAVE_QUIT;
             }
         }
-      else if (method == distance_type::quasieuclidean)
+    }
+
+    template <typename Step, typename Counter>
+    void
+    select_kernelND (const std::vector<typename ResultType::element_type>& weights, const std::vector<octave_idx_type>& mask_neighbor_idx, const std::vector<octave_idx_type>& image_neighbor_idx, const std::vector<char>& neighbor_class, Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      using image_elem = typename ImageType::element_type;
+
+      const octave_idx_type nneighbors = image_neighbor_idx.size ();
+
+      if (nchannels > 1)
+        propagateND (channel_cost<T, Step> (cost, channels, nchannels, weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+      else if (use_difference_table<image_elem> (cost, f.numel (), nneighbors, weights.size ()))
+        propagateND (difference_table_cost<T, Step, image_elem> (f.data (), weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+      else if (use_pair_table<image_elem> (f.numel (), nneighbors, weights.size ()))
+        propagateND (pair_table_cost<T, Step, image_elem> (cost, f.data (), weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+      else
+        propagateND (level_cost<T, Step, image_elem> (cost, f.data (), weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+    }
+
+    template <typename Counter>
+    void
+    do_curvdistND (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      bool only_direct_neghbors = method == distance_type::cityblock;
+
+      bool quasi = method == distance_type::quasieuclidean;
+
+      if (radius == 2)
         {
-          auto wei = create_quasi_euclidean_chamfer_weights<typename ResultType::element_type> (f.dims ());
+          if (! quasi)
+            error ("curvdist: Neighborhood 5 can only be used with the quasi-euclidean metric");
 
-          while (! Q.empty ())
-            {
-              auto u = Q.top ();
+          std::vector<octave_idx_type> mask_neighbor_idx, image_neighbor_idx;
 
-              Q.pop ();
+          std::vector<char> neighbor_class;
 
-              if (! inheap[u.maskindex])
-                {
-                  continue;
-                }
+          // the quasi-euclidean step takes the squared length
+          std::vector<T> weights;
 
-              inheap[u.maskindex] = 0;
+          for (double squared_length : create_chamfer_neighbors (mask_neighbor_idx, image_neighbor_idx, neighbor_class))
+            weights.push_back (squared_length);
 
-              typename ResultType::element_type fu = f(u.imageindex);
+          select_kernelND<quasi_euclidean_step<T>> (weights, mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
 
-              for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
-                {
-                  auto vmask = u.maskindex + mask_neighbor_idx[i];
+          return;
+        }
 
-                  if (inheap[vmask])
-                    {
-                      auto vimage = u.imageindex + image_neighbor_idx[i];
+      auto mask_neighbor_idx = create_offset_to_neighbors (f.dims () + 2, only_direct_neghbors);
 
-                      typename ResultType::element_type fv = f(vimage);
+      auto image_neighbor_idx = create_offset_to_neighbors (f.dims (), only_direct_neghbors);
 
-                      typename ResultType::element_type alt = u.imageval + sqrt (wei[i] + pow(fu - fv, 2));
+      if (! spacing.empty ())
+        {
+          auto neighbor_class = create_axis_classes (only_direct_neghbors);
 
-                      if (alt < dist[vimage])
-                        {
-                          dist[vimage] = alt;
+          // the quasi-euclidean step takes the squared length
+          if (quasi)
+            select_kernelND<quasi_euclidean_step<T>> (axis_weights<T> (spacing, [&] (int mask) { return squared_step_length (mask, spacing); }), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+          else
+            select_kernelND<chessboard_step<T>> (axis_weights<T> (spacing, [&] (int mask) { return step_length (mask, spacing, false); }), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
+          return;
+        }
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(vimage) = u.imageindex + 1;
-                            }
+      auto neighbor_class = create_neighbor_classes (f.dims (), image_neighbor_idx.size (), quasi);
 
-                          Q.push({vmask, vimage, alt});
-                        }
-                    }
-                }
+      if (quasi)
+        {
+          // squared length of a step along d axes, as with the neighborhood
+          // of width 5
+          std::vector<T> weights (f.ndims ());
 
-              OCTAVE_QUIT;
-            }
+          for (int d = 1; d <= f.ndims (); d++)
+            weights[d-1] = d;
+
+          select_kernelND<quasi_euclidean_step<T>> (weights, mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+        }
+      else
+        select_kernelND<chessboard_step<T>> ({static_cast<T> (1)}, mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+    }
+
+    void run ()
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      if (want_summary)
+        {
+          std::vector<octave_idx_type> seeds;
+
+          for (const auto& e : Q.storage ())
+            seeds.push_back (e.imageindex);
+
+          summary.start (std::move (seeds));
+        }
+
+      monitor.start (f.numel ());
+
+      if (collect_stats)
+        do_curvdistND (stats);
+      else
+        {
+          no_stats counter;
+
+          do_curvdistND (counter);
         }
+
+      stats.propagation_time = elapsed (start);
+
+      monitor.finish ();
+
+      finished = true;
     }
 
     ImageType f;
 
+    cost_transform<typename ResultType::element_type> cost;
+
+    // multichannel image when nchannels > 1
+    ImageType channels;
+
+    octave_idx_type nchannels = 1;
+
     const int nargout;
 
+    const bool collect_stats;
+
+    propagation_stats stats;
+
+    propagation_monitor monitor;
+
+    const std::vector<double> spacing;
+
+    // number of points of the neighborhood on each side of the center, it is
+    // also the width of the padding of the mask
+    const int radius;
+
+    const bool want_summary;
+
+    region_summary<ResultType> summary;
+
+    // the neighbors are only improved up to this distance
+    const typename ResultType::element_type cutoff;
+
+    const output_type output;
+
+    // the points in the order they are settled for the compact outputs and
+    // their indexes in the padded mask
+    std::vector<octave_idx_type> settled;
+
+    std::vector<octave_idx_type> settled_mask;
+
+    // the propagation has completed, so the state can be kept for the next
+    // call
+    bool finished = false;
+
     ResultType dist_mat;
 
     IndexType idx_segment;
 
     IndexType idx_predecessor;
 
-    std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND> Q;
+    scratch_queue<queue_elem_type, PointCmpND> Q;
 
     std::vector<bool> inheap;
 
     distance_type method;
   };
 
+  template <typename Engine, typename ImageType, typename ... Args>
+  octave_value_list
+  run_engine (const ImageType& im, int nargout, const options& opt, octave_scalar_map& info, octave_scalar_map& summary, double conversion_time, Args...args)
+  {
+    Engine engine (im, nargout, opt, args...);
+
+    if (opt.stats)
+      info = engine.get_info (conversion_time);
+
+    if (opt.summary)
+      summary = engine.get_summary ();
+
+    return engine.get_result ();
+  }
+
+  // the statistics are returned as the fourth output
+  void
+  append_info (octave_value_list& retval, const options& opt, octave_scalar_map& info, const std::chrono::steady_clock::time_point& reshape_start)
+  {
+    if (! opt.stats)
+      return;
+
+    octave_scalar_map time = info.getfield ("time").scalar_map_value ();
+
+    time.assign ("reshape", elapsed (reshape_start));
+
+    info.assign ("time", time);
+
+    retval(3) = info;
+  }
+
+  // the summary is inserted as the second output, the other outputs follow
+  // it
+  void
+  insert_summary (octave_value_list& retval, const options& opt, const octave_scalar_map& summary)
+  {
+    if (! opt.summary)
+      return;
+
+    octave_value_list result = ovl (retval(0), summary);
+
+    for (octave_idx_type k = 1; k < retval.length (); k++)
+      result(k+1) = retval(k);
+
+    retval = result;
+  }
+
   template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list do_curvdist (const ImageType& image, int nargout, Args...args)
+  octave_value_list do_curvdist (const ImageType& image, int nargout, const options& opt, Args...args)
   {
+    const double conversion_time = elapsed (opt.start_time);
+
+    octave_scalar_map info;
+
+    octave_scalar_map summary;
+
+    // the engine computes idx for the summary, the outputs after T are
+    // shifted by the summary
+    const int engine_nargout = opt.summary ? std::max (nargout - 1, 2) : nargout;
+
+    if (! opt.spacing.empty () && static_cast<int> (opt.spacing.size ()) != image.ndims () - opt.multichannel)
+      error ("curvdist: Spacing should have one element for each dimension of I");
+
+    if (opt.multichannel)
+      {
+        // the channels are along the last dimension, the result has the
+        // size of the other dimensions
+        dim_vector dims = image.dims ();
+
+        const octave_idx_type nchannels = dims(dims.ndims () - 1);
+
+        if (dims.ndims () == 2)
+          dims(1) = 1;
+        else
+          dims.resize (dims.ndims () - 1);
+
+        options single_channel = opt;
+
+        single_channel.multichannel = false;
+
+        if (! single_channel.spacing.empty ())
+          single_channel.spacing.resize (dims.ndims (), 1);
+
+        if (nchannels == 1)
+          return do_curvdist<ResultType, IndexType> (ImageType (image.reshape (dims)), nargout, single_channel, args...);
+
+        const dim_vector spatial_dims = dims.squeeze ();
+
+        dim_vector channel_dims = spatial_dims;
+
+        channel_dims.resize (spatial_dims.ndims () + 1);
+
+        channel_dims(spatial_dims.ndims ()) = nchannels;
+
+        const ImageType im = image.reshape (channel_dims);
+
+        options engine_opt = opt;
+
+        engine_opt.spacing = squeeze_spacing (dims, opt.spacing);
+
+        octave_value_list retval;
+
+        if (spatial_dims.ndims () <= 2 && opt.neighborhood == 3)
+          retval = run_engine<curvdist2D<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
+        else
+          retval = run_engine<curvdistND<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
+
+        const auto reshape_start = std::chrono::steady_clock::now ();
+
+        if (opt.output == output_type::bbox)
+          unsqueeze_bbox (retval, engine_nargout, dims, spatial_dims);
+        else if (opt.output == output_type::full)
+          {
+            retval(0) = retval(0).reshape(dims);
+
+            if (engine_nargout >= 2)
+              retval(1) = retval(1).reshape(dims);
+
+            if (engine_nargout >= 3)
+              retval(2) = retval(2).reshape(dims);
+          }
+
+        append_info (retval, opt, info, reshape_start);
+
+        insert_summary (retval, opt, summary);
+
+        return retval;
+      }
+
     const ImageType im = image.squeeze();
 
+    options engine_opt = opt;
+
+    engine_opt.spacing = squeeze_spacing (image.dims (), opt.spacing);
+
     octave_value_list retval;
 
-    if (im.ndims () <= 2)
-      retval = curvdist2D<ResultType, IndexType, ImageType>(im, nargout, args...).get_result ();
+    if (im.ndims () <= 2 && opt.neighborhood == 3)
+      retval = run_engine<curvdist2D<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
     else
-      retval = curvdistND<ResultType, IndexType, ImageType>(im, nargout, args...).get_result ();
+      retval = run_engine<curvdistND<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
 
-    retval(0) = retval(0).reshape(image.dims ());
+    const auto reshape_start = std::chrono::steady_clock::now ();
 
-    if (nargout >= 2)
-      retval(1) = retval(1).reshape(image.dims ());
+    if (opt.output == output_type::bbox)
+      unsqueeze_bbox (retval, engine_nargout, image.dims (), im.dims ());
+    else if (opt.output == output_type::full)
+      {
+        retval(0) = retval(0).reshape(image.dims ());
 
-    if (nargout >= 3)
-      retval(2) = retval(2).reshape(image.dims ());
+        if (engine_nargout >= 2)
+          retval(1) = retval(1).reshape(image.dims ());
+
+        if (engine_nargout >= 3)
+          retval(2) = retval(2).reshape(image.dims ());
+      }
+
+    append_info (retval, opt, info, reshape_start);
+
+    insert_summary (retval, opt, summary);
 
     return retval;
   }
 
   template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list dispatch4 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch4 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin == 4)
       {
         if (unprocessed_args(n).is_string ())
-          return do_curvdist<ResultType, IndexType> (image, nargout, args..., unprocessed_args(n).string_value ());
+          return do_curvdist<ResultType, IndexType> (image, nargout, opt, args..., unprocessed_args(n).string_value ());
         else
           error ("invalid type for 'method'");
       }
     else
-      return do_curvdist<ResultType, IndexType> (image, nargout, args...);
+      return do_curvdist<ResultType, IndexType> (image, nargout, opt, args...);
   }
 
   template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list dispatch3 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch3 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin >= 3 && n < 3)
       {
         if (unprocessed_args(n).is_string ())
-          return do_curvdist< ResultType, IndexType> (image, nargout, args..., unprocessed_args(n).string_value ());
+          return do_curvdist< ResultType, IndexType> (image, nargout, opt, args..., unprocessed_args(n).string_value ());
         else if (unprocessed_args(n).isnumeric ())
-          return dispatch4< ResultType, IndexType> (unprocessed_args, n+1, image, nargout, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
+          return dispatch4< ResultType, IndexType> (unprocessed_args, n+1, image, nargout, opt, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
         else
           error ("invalid type for argument number %s", std::to_string (n+1).c_str ());
       }
     else
-      return do_curvdist<ResultType, IndexType> (image, nargout, args...);
+      return do_curvdist<ResultType, IndexType> (image, nargout, opt, args...);
   }
 
   template < typename ResultType, typename IndexType, typename ImageType, typename ... Args>
-  octave_value_list dispatch2 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch2 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin >= 2 && n < 2)
       {
         if (unprocessed_args(n).islogical ())
-          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1, image, nargout, args..., unprocessed_args(n).bool_array_value ());
+          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1, image, nargout, opt, args..., unprocessed_args(n).bool_array_value ());
         else if (unprocessed_args(n).isnumeric ())
-          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1,image, nargout, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
+          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1,image, nargout, opt, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
         else
           error ("invalid type for argument number %s", std::to_string (n+1).c_str ());
       }
@@ -1232,9 +3733,19 @@ namespace image
   }
 
   template <typename IndexType>
-  octave_value_list dispatch (const octave_value_list& args, int nargout)
+  octave_value_list dispatch (const octave_value_list& all_args, int nargout)
   {
-    octave_idx_type nargin = args.length ();
+    const auto start_time = std::chrono::steady_clock::now ();
+
+    const octave_idx_type nargin = count_positional_args (all_args);
+
+    options opt = parse_options (all_args, nargin);
+
+    opt.stats = nargout >= (opt.summary ? 5 : 4);
+
+    opt.start_time = start_time;
+
+    const octave_value_list args = all_args.slice (0, nargin);
 
     if (nargin < 2 || nargin > 4)
       error ("invalid number of arguments");
@@ -1242,29 +3753,29 @@ namespace image
     octave_value im = args(0);
 
     if (im.islogical ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.bool_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.bool_array_value (), nargout, opt);
     else if (im.is_int8_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int8_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int8_array_value (), nargout, opt);
     else if (im.is_int16_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int16_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int16_array_value (), nargout, opt);
     else if (im.is_int32_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int32_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int32_array_value (), nargout, opt);
     else if (im.is_int64_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int64_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int64_array_value (), nargout, opt);
     else if (im.is_uint8_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint8_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint8_array_value (), nargout, opt);
     else if (im.is_uint16_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint16_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint16_array_value (), nargout, opt);
     else if (im.is_uint32_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint32_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint32_array_value (), nargout, opt);
     else if (im.is_uint64_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint64_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint64_array_value (), nargout, opt);
     else if (im.isreal ())
       {
         if (im.is_single_type ())
-          return image::dispatch2 < FloatNDArray,IndexType>(args, 1,im.float_array_value (), nargout);
+          return image::dispatch2 < FloatNDArray,IndexType>(args, 1,im.float_array_value (), nargout, opt);
         else
-          return image::dispatch2 < NDArray,IndexType>(args, 1, im.array_value (), nargout);
+          return image::dispatch2 < NDArray,IndexType>(args, 1, im.array_value (), nargout, opt);
       }
     else if (im.iscomplex ())
       {
@@ -1280,8 +3791,12 @@ DEFUN_DLD (curvdist, args, nargout,
 @deftypefnx {Loadable Function} {T =} curvdist(@var{I}, @var{C}, @var{R})
 @deftypefnx {Loadable Function} {T =} curvdist(@var{I}, @var{ind})
 @deftypefnx {Loadable Function} {T =} curvdist(@var{___}, @var{method})
+@deftypefnx {Loadable Function} {T =} curvdist(@var{___}, @var{name}, @var{value})
 @deftypefnx {Loadable Function} {[T, idx] =} curvdist(@var{___})
 @deftypefnx {Loadable Function} {[T, idx, pred] =} curvdist(@var{___})
+@deftypefnx {Loadable Function} {[T, idx, pred, info] =} curvdist(@var{___})
+@deftypefnx {Loadable Function} {[T, S, idx, pred, info] =} curvdist(@var{___}, "Summary", true)
+@deftypefnx {Loadable Function} {} curvdist("clear")
 
 Compute weighted distance transform on curved space for image.
 
@@ -1345,19 +3860,84 @@ sq2 1@ @ sq2@*
 where sq2 is equal to sqrt(2).
 @end table
 
+The gray values can be transformed on the fly, without creating a transformed copy of the image, using the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"Scale"}, @qcode{"Offset"}, @qcode{"Exponent"}
+I(x) in the step cost is replaced by @code{Scale * I(x)^Exponent + Offset}. Defaults are 1, 0 and 1.
+@item @qcode{"LookupTable"}
+For int8, uint8, int16 and uint16 images a vector of 256 or 65536 elements that I(x) is mapped through before the other transforms are applied. The first element corresponds to the smallest value of the image class.
+@item @qcode{"Multichannel"}
+If true the last dimension of @var{I} holds the channels of a vector valued image, for example the color planes of an RGB image. abs (I(p) - I(q)) in the step cost is replaced by the euclidean distance of the channel vectors of p and q. The seed points and the outputs have the size of the other dimensions. Default is false.
+@end table
+
+Images with anisotropic sampling, like medical volumes with thicker slices, can be computed with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Spacing"}
+A vector with the distance between neighboring points along each dimension of @var{I}. For multichannel images it has no element for the channel dimension. The spatial length of a step to a neighbor is the largest spacing of the dimensions in which they differ for @qcode{"chessboard"} and @qcode{"cityblock"} and the euclidean length of the step for @qcode{"quasi-euclidean"}. Default is 1 for all dimensions.
+@end table
+
+More accurate quasi-euclidean distances can be computed with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Neighborhood"}
+Width of the neighborhood, 3 or 5. With 5 the neighbors of a point are the points that are at most two points away in each dimension and are not in the direction of a nearer neighbor, like the knight moves in 2D, and each step has its euclidean length. The largest relative error of the distance in a constant image falls from about 8% to 3% in 2D and from about 13% to 5% in 3D. It can only be used with the @qcode{"quasi-euclidean"} metric. The @qcode{"Threads"} option is not used with it. Default is 3.
+@end table
+
+Propagations that only need the neighborhood of the seed points can be bounded with the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"MaxDistance"}
+Points whose distance is greater than this value are not processed, their distance is Inf and their @var{idx} and @var{pred} are zero. Default is Inf.
+@item @qcode{"Output"}
+Format of the outputs, @qcode{"full"}, @qcode{"sparse"} or @qcode{"bbox"}. With @qcode{"sparse"} @var{T} is a struct with the column vectors @qcode{ind} and @qcode{value} with the linear indexes and the distances of the points that are reached, in increasing order of index, and @var{idx} and @var{pred} are column vectors of the same points. With @qcode{"bbox"} @var{T} is a struct where @qcode{value} is the distance map cropped to the bounding box of the points that are reached and @qcode{offset} is the subscript of the first point of the box, and @var{idx} and @var{pred} are cropped to the same box. Default is @qcode{"full"}.
+@end table
+
+Long computations can be monitored with the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"InterruptInterval"}
+Number of points that are processed between checks for Ctrl-C. Default is 4096.
+@item @qcode{"Progress"}
+If true a line with the percentage of processed points, the elapsed time and the estimated remaining time is printed periodically. It can also be a function handle that is called as @code{fcn (fraction, elapsed, remaining)} with the times in seconds. After the computation it is called once more. Default is false.
+@item @qcode{"ProgressInterval"}
+Minimum time in seconds between two progress reports. Default is 1.
+@end table
+
+Large 2D images can be computed in parallel with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Threads"}
+Number of threads for 2D images. The image is split into strips of columns that are computed in parallel and exchange the distances at their boundaries until no distance changes. The distances are the same as with one thread, @var{idx} and @var{pred} can differ in points with more than one shortest path. Ctrl-C and the progress are checked while the strips are computed, points that are processed again in a later exchange are counted again in the progress. Default is 1.
+@end table
+
 @var{idx} is index of the nearest seed point. @*
 @var{pred} is the predecessor map. pred(a) is the predecessor of 'a' in the shortest paths tree (that starts from seed points). In other words 'a' is the nearest neghbor to pred(a). Its value in seed points is zero.@*
 The type of @var{T} is double if the type of @var{I} is double. For other input types the type of output is single.@*
-The type of @var{idx} and @var{pred} depends on the size of the image. For an image of size less than 2^32 it is 'uint32' .For larger images it is 'uint64'.
+The type of @var{idx} and @var{pred} depends on the size of the image. For an image of size less than 2^32 it is 'uint32' .For larger images it is 'uint64'.@*
+@var{info} is a struct with statistics of the computation. It contains the number of heap @qcode{pushes} and @qcode{pops}, the number of @qcode{stale_pops} (points that were popped after they were already processed), the number of @qcode{relaxations} (steps to unprocessed neighbors) and @qcode{improvements} (relaxations that decreased a distance), @qcode{max_queue_size}, the number of @qcode{bytes} allocated for the distance map, the processed flags, @var{idx}, @var{pred} and the queue, and the wall-clock @qcode{time} in seconds of the conversion of the arguments, the initialization, the propagation and the reshape of the outputs. The statistics are only collected when @var{info} is requested.
+
+With the @qcode{"Summary"} option set to true the second output @var{S} is a struct with statistics of the region of each seed point, that is the points that have it as their nearest seed. Its fields are column vectors with one element per seed point: the linear index of the @qcode{seed}, the number of points of the region (@qcode{area}), the @qcode{max_distance} and the @qcode{mean_distance} of the points of the region and the linear index of the @qcode{farthest} point. The statistics are accumulated while the points are settled, so @var{idx} does not have to be requested to compute them. @var{idx}, @var{pred} and @var{info} follow @var{S}.
+
+The queue and the processed flags are kept between calls so repeated calls on images of the same size do not allocate them again. With the @qcode{"sparse"} and @qcode{"bbox"} outputs the distance map, @var{idx} and @var{pred} are kept as well and a call only resets the points that it has reached, so repeated calls take time in proportion to the reached region instead of the size of the image. The kept arrays have the size of the image. @code{curvdist ("clear")} frees them.
 
 [1] Fouard C., Gedda M. (2006) An Objective Comparison Between Gray Weighted Distance Transforms and Weighted Distance Transforms on Curved Spaces. In: Kuba A., Nyúl L.G., Palágyi K. (eds) Discrete Geometry for Computer Imagery. DGCI 2006. Lecture Notes in Computer Science, vol 4245. Springer, Berlin, Heidelberg.
 
 @seealso{bwdist, graydist}
 @end deftypefn)helpdoc")
 {
+  if (args.length () == 1 && args(0).is_string ())
+    {
+      if (args(0).string_value () != "clear")
+        error ("curvdist: unrecognized command '%s'", args(0).string_value ().c_str ());
 
+      image::clear_scratch ();
+
+      return ovl ();
+    }
 
-  octave_idx_type nargin = args.length ();
+  octave_idx_type nargin = image::count_positional_args (args);
 
   if (nargin < 2 || nargin > 4)
     error ("invalid number of arguments");
@@ -0,0 +1,263 @@
+// Copyright (C) 2020 Seyyed Hossein Sajjadi
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, see <http://www.gnu.org/licenses/>.
+
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include <octave/oct.h>
+
+namespace image
+{
+  template <typename T>
+  octave_idx_type
+  to_index (const T& x)
+  {
+    return static_cast<octave_idx_type> (x);
+  }
+
+  template <typename T>
+  octave_idx_type
+  to_index (const octave_int<T>& x)
+  {
+    return static_cast<octave_idx_type> (x.value ());
+  }
+
+  // walks the predecessor map from each target to its seed point
+  template <typename PredType>
+  class GeodesicPath
+  {
+  public:
+
+    GeodesicPath (const PredType& pred, const Array<octave_idx_type>& targets, bool want_mask)
+    : pred (pred), offset (targets.numel () + 1)
+    {
+      if (want_mask)
+        mask = boolNDArray (pred.dims (), false);
+
+      offset[0] = 0;
+
+      for (octave_idx_type i = 0; i < targets.numel (); i++)
+        {
+          trace (targets(i) - 1, want_mask);
+
+          offset[i + 1] = path.size ();
+
+          OCTAVE_QUIT;
+        }
+    }
+
+    // path number k as a column vector that starts from the seed point
+    NDArray
+    get_path (octave_idx_type k) const
+    {
+      const octave_idx_type len = offset[k + 1] - offset[k];
+
+      NDArray result (dim_vector (len, 1));
+
+      for (octave_idx_type i = 0; i < len; i++)
+        result.xelem (i) = path[offset[k] + i] + 1;
+
+      return result;
+    }
+
+    Cell
+    get_cell () const
+    {
+      const octave_idx_type npaths = offset.size () - 1;
+
+      Cell result (dim_vector (npaths, 1));
+
+      for (octave_idx_type k = 0; k < npaths; k++)
+        result.xelem (k) = get_path (k);
+
+      return result;
+    }
+
+    NDArray
+    get_concatenated () const
+    {
+      NDArray result (dim_vector (path.size (), 1));
+
+      for (size_t i = 0; i < path.size (); i++)
+        result.xelem (i) = path[i] + 1;
+
+      return result;
+    }
+
+    NDArray
+    get_offset () const
+    {
+      NDArray result (dim_vector (offset.size (), 1));
+
+      for (size_t i = 0; i < offset.size (); i++)
+        result.xelem (i) = offset[i] + 1;
+
+      return result;
+    }
+
+    const boolNDArray&
+    get_mask () const
+    {
+      return mask;
+    }
+
+  private:
+
+    void
+    trace (octave_idx_type v, bool want_mask)
+    {
+      const octave_idx_type n = pred.numel ();
+
+      if (v < 0 || v >= n)
+        error ("geodesicpath: out of range target values");
+
+      const size_t start = path.size ();
+
+      while (v >= 0)
+        {
+          if (static_cast<octave_idx_type> (path.size () - start) >= n)
+            error ("geodesicpath: pred contains a cycle");
+
+          path.push_back (v);
+
+          if (want_mask)
+            mask.xelem (v) = true;
+
+          const octave_idx_type p = to_index (pred.xelem (v));
+
+          if (p < 0 || p > n)
+            error ("geodesicpath: out of range values in pred");
+
+          v = p - 1;
+        }
+
+      std::reverse (path.begin () + start, path.end ());
+    }
+
+    const PredType& pred;
+
+    std::vector<octave_idx_type> path;
+
+    std::vector<octave_idx_type> offset;
+
+    boolNDArray mask;
+  };
+
+  template <typename PredType>
+  octave_value_list
+  do_geodesicpath (const PredType& pred, const Array<octave_idx_type>& targets, bool concatenated, int nargout)
+  {
+    octave_value_list retval;
+
+    if (concatenated)
+      {
+        GeodesicPath<PredType> paths (pred, targets, nargout == 3);
+
+        retval = ovl (paths.get_concatenated (), paths.get_offset ());
+
+        if (nargout == 3)
+          retval(2) = paths.get_mask ();
+      }
+    else
+      {
+        GeodesicPath<PredType> paths (pred, targets, nargout == 2);
+
+        retval = ovl (paths.get_cell ());
+
+        if (nargout == 2)
+          retval(1) = paths.get_mask ();
+      }
+
+    return retval;
+  }
+
+  Array<octave_idx_type>
+  get_targets (const octave_value& arg)
+  {
+    if (arg.islogical ())
+      {
+        const boolNDArray mask = arg.bool_array_value ();
+
+        Array<octave_idx_type> targets (dim_vector (mask.nnz (), 1));
+
+        octave_idx_type k = 0;
+
+        for (octave_idx_type i = 0; i < mask.numel (); i++)
+          if (mask.xelem (i))
+            targets.xelem (k++) = i + 1;
+
+        return targets;
+      }
+    else if (arg.isnumeric ())
+      return arg.octave_idx_type_vector_value ();
+    else
+      error ("geodesicpath: invalid type for targets");
+  }
+}
+
+DEFUN_DLD (geodesicpath, args, nargout,
+           R"helpdoc(-*- texinfo -*-
+@deftypefn {Loadable Function} {P =} geodesicpath(@var{pred}, @var{targets})
+@deftypefnx {Loadable Function} {[P, mask] =} geodesicpath(@var{pred}, @var{targets})
+@deftypefnx {Loadable Function} {[ind, offset] =} geodesicpath(@var{pred}, @var{targets}, "concatenated")
+@deftypefnx {Loadable Function} {[ind, offset, mask] =} geodesicpath(@var{pred}, @var{targets}, "concatenated")
+
+Extract shortest paths from the predecessor map that is returned by graydist, curvdist or graphdist.
+
+@var{pred} is the predecessor map. @var{targets} are linear indexes of the end points of the paths or a logical array with the size of @var{pred} that true values correspond to the end points.
+
+Each path is a column vector of linear indexes that starts from the seed point that is nearest to the target and ends at the target. For seed points and for points that can not be reached the path contains only the point itself.
+
+@var{P} is a cell array with one path for each target.@*
+With the @qcode{"concatenated"} option all paths are concatenated in the column vector @var{ind} and path number k is ind(offset(k):offset(k+1)-1). @var{offset} has one more element than the number of targets.@*
+@var{mask} is a logical array with the size of @var{pred} that is true for the points that are on at least one of the paths. It is computed in the same pass as the paths.
+
+@seealso{graydist, curvdist, graphdist}
+@end deftypefn)helpdoc")
+{
+  octave_idx_type nargin = args.length ();
+
+  if (nargin < 2 || nargin > 3)
+    error ("invalid number of arguments");
+
+  bool concatenated = false;
+
+  if (nargin == 3)
+    {
+      const std::string format = args(2).xstring_value ("geodesicpath: third argument should be a string");
+
+      if (format == "concatenated")
+        concatenated = true;
+      else if (format != "cell")
+        error ("geodesicpath: unrecognized output format '%s'", format.c_str ());
+    }
+
+  if (nargout > (concatenated ? 3 : 2))
+    error ("geodesicpath: too many output arguments");
+
+  const octave_value& pred = args(0);
+
+  const Array<octave_idx_type> targets = image::get_targets (args(1));
+
+  if (pred.is_uint32_type ())
+    return image::do_geodesicpath (pred.uint32_array_value (), targets, concatenated, nargout);
+  else if (pred.is_uint64_type ())
+    return image::do_geodesicpath (pred.uint64_array_value (), targets, concatenated, nargout);
+  else if (pred.isnumeric () && pred.isreal ())
+    return image::do_geodesicpath (pred.array_value (), targets, concatenated, nargout);
+  else
+    error ("geodesicpath: pred should be a real numeric array");
+}
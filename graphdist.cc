@@ -0,0 +1,297 @@
+// Copyright (C) 2020 Seyyed Hossein Sajjadi
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, see <http://www.gnu.org/licenses/>.
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+#include <octave/oct.h>
+
+namespace graph
+{
+  // multi-source shortest paths on the graph of a sparse adjacency matrix.
+  // The edges leaving node j are the nonzero elements of column j, they are
+  // read directly from the compressed column storage of the matrix.
+  template <typename IndexType, typename SparseType>
+  class GraphDist
+  {
+  public:
+
+    using element_type = std::pair<octave_idx_type, double>;
+
+    GraphDist (const SparseType& adjacency, int nargout, const boolNDArray & mask)
+    : A (adjacency), nargout (nargout)
+    {
+      init ();
+
+      initialize_from_seed (mask);
+
+      do_graphdist ();
+    }
+
+    GraphDist (const SparseType& adjacency, int nargout, const Array<octave_idx_type> & ind)
+    : A (adjacency), nargout (nargout)
+    {
+      init ();
+
+      initialize_from_seed (ind);
+
+      do_graphdist ();
+    }
+
+    const NDArray&
+    value () const
+    {
+      return dist_mat;
+    }
+
+    octave_value_list
+    get_result ()
+    {
+      return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
+    }
+
+  private:
+
+    struct PointCmp
+    {
+      PointCmp ()  {}
+
+      bool operator()(const element_type& a , const element_type& b ) const
+      {return a.second > b.second;}
+    };
+
+    void
+    init ()
+    {
+      check_weights ();
+
+      const octave_idx_type n = A.cols ();
+
+      dist_mat = NDArray (dim_vector (n, 1), std::numeric_limits<double>::infinity ());
+
+      if (nargout >= 2)
+        idx_segment = IndexType (dim_vector (n, 1));
+
+      if (nargout == 3)
+        idx_predecessor = IndexType (dim_vector (n, 1));
+
+      inheap = std::vector<bool> (n, true);
+    }
+
+    // the propagation is only correct for non-negative lengths, they are
+    // checked once before it starts since an edge into a node that is
+    // already settled is not read again
+    void
+    check_weights () const
+    {
+      const typename SparseType::element_type* weight = A.data ();
+
+      for (octave_idx_type k = 0; k < A.nnz (); k++)
+        if (! (static_cast<double> (weight[k]) >= 0))
+          error ("graphdist: edge weights should be non-negative");
+    }
+
+    void
+    initialize_from_seed (const Array<octave_idx_type>& ind)
+    {
+      const octave_idx_type n = A.cols ();
+
+      for (octave_idx_type i = 0; i < ind.numel () ; i++)
+        {
+          const octave_idx_type s = ind(i) - 1;
+
+          if (s < 0 || s >= n)
+            error ("graphdist: out of range seed values");
+
+          dist_mat.xelem (s) = 0;
+
+          if (nargout >= 2)
+            {
+              idx_segment.xelem (s) = s + 1;
+
+              if (nargout == 3)
+                idx_predecessor.xelem (s) = 0;
+            }
+
+          Q.push ({s, 0});
+        }
+    }
+
+    void
+    initialize_from_seed (const boolNDArray& mask)
+    {
+      if (mask.numel () != A.cols ())
+        error ("graphdist: mask should have as many elements as nodes of the graph");
+
+      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+        {
+          if (mask.xelem (i))
+            {
+              dist_mat.xelem (i) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem (i) = i + 1;
+
+                  if (nargout == 3)
+                    idx_predecessor.xelem (i) = 0;
+                }
+
+              Q.push ({i, 0});
+            }
+        }
+    }
+
+    void
+    do_graphdist ()
+    {
+      const octave_idx_type* cidx = A.cidx ();
+
+      const octave_idx_type* ridx = A.ridx ();
+
+      const typename SparseType::element_type* weight = A.data ();
+
+      double* dist = dist_mat.fortran_vec ();
+
+      while (! Q.empty ())
+        {
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          if (! inheap[u.first])
+            {
+              continue;
+            }
+
+          inheap[u.first] = false;
+
+          for (octave_idx_type k = cidx[u.first]; k < cidx[u.first + 1]; k++)
+            {
+              const octave_idx_type v = ridx[k];
+
+              if (inheap[v])
+                {
+                  const double w = weight[k];
+
+                  double alt = u.second + w;
+
+                  if (alt < dist[v])
+                    {
+                      dist[v] = alt;
+
+                      if (nargout >= 2)
+                        {
+                          idx_segment.xelem (v) = idx_segment.xelem (u.first);
+
+                          if (nargout == 3)
+                            idx_predecessor.xelem (v) = u.first + 1;
+                        }
+
+                      Q.push ({v, alt});
+                    }
+                }
+            }
+
+          OCTAVE_QUIT;
+        }
+    }
+
+    SparseType A;
+
+    const int nargout;
+
+    NDArray dist_mat;
+
+    IndexType idx_segment;
+
+    IndexType idx_predecessor;
+
+    std::priority_queue<element_type, std::vector<element_type>, PointCmp> Q;
+
+    std::vector<bool> inheap;
+  };
+
+  template <typename IndexType, typename SparseType>
+  octave_value_list
+  do_graphdist (const SparseType& A, const octave_value& seeds, int nargout)
+  {
+    if (seeds.islogical ())
+      return GraphDist<IndexType, SparseType> (A, nargout, seeds.bool_array_value ()).get_result ();
+    else if (seeds.isnumeric ())
+      return GraphDist<IndexType, SparseType> (A, nargout, seeds.octave_idx_type_vector_value ()).get_result ();
+    else
+      error ("graphdist: invalid type for seeds");
+  }
+
+  template <typename IndexType>
+  octave_value_list
+  dispatch (const octave_value_list& args, int nargout)
+  {
+    const octave_value& adj = args(0);
+
+    if (adj.islogical ())
+      return do_graphdist<IndexType> (adj.sparse_bool_matrix_value (), args(1), nargout);
+    else
+      return do_graphdist<IndexType> (adj.sparse_matrix_value (), args(1), nargout);
+  }
+}
+
+DEFUN_DLD (graphdist, args, nargout,
+           R"helpdoc(-*- texinfo -*-
+@deftypefn {Loadable Function} {D =} graphdist(@var{A}, @var{mask})
+@deftypefnx {Loadable Function} {D =} graphdist(@var{A}, @var{ind})
+@deftypefnx {Loadable Function} {[D, idx] =} graphdist(@var{___})
+@deftypefnx {Loadable Function} {[D, idx, pred] =} graphdist(@var{___})
+
+Compute geodesic distance of the nodes of a weighted graph from a set of seed nodes.
+
+@var{A} is a square sparse adjacency matrix. A(i, j) is the length of the edge from node j to node i so the edges leaving node j are stored in column j. For undirected graphs @var{A} should be symmetric. Edge lengths should be non-negative and not NaN. If @var{A} is logical all edges have length 1.
+
+The seed nodes can be provided in two ways:
+
+@table @asis
+@item @qcode{@var{mask}}
+A logical vector with one element per node that true values correspond to seed nodes
+@item @qcode{@var{ind}}
+Indexes of seed nodes
+@end table
+
+The return value @var{D} is a column vector where the value of each node corresponds to the length of its shortest path to the provided seed nodes. Nodes that can not be reached have distance Inf.
+
+@var{idx} is index of the nearest seed node. Its value in nodes that can not be reached is zero.@*
+@var{pred} is the predecessor map. pred(a) is the predecessor of 'a' in the shortest paths tree (that starts from seed nodes). Its value in seed nodes and in nodes that can not be reached is zero.@*
+The type of @var{idx} and @var{pred} depends on the number of nodes. For graphs with less than 2^32 nodes it is 'uint32' .For larger graphs it is 'uint64'.
+
+The edges are read directly from the storage of @var{A} and are not copied so it can be used for large graphs like meshes and superpixel adjacency graphs.
+
+@seealso{graydist, curvdist}
+@end deftypefn)helpdoc")
+{
+  if (args.length () != 2)
+    error ("invalid number of arguments");
+
+  const octave_value& adj = args(0);
+
+  if (! adj.issparse () || adj.iscomplex () || adj.rows () != adj.columns ())
+    error ("graphdist: A should be a real square sparse matrix");
+
+  if (static_cast<unsigned long long> (adj.rows ()) <= 0xFFFFFFFF)
+    return graph::dispatch<uint32NDArray>(args, nargout);
+  else
+    return graph::dispatch<uint64NDArray>(args, nargout);
+}
@@ -17,8 +17,21 @@
 #include <algorithm>
 #include <limits>
 #include <queue>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
 
 #include <octave/oct.h>
+#include <octave/parse.h>
 
 namespace image
 {
@@ -47,6 +60,14 @@ namespace image
     quasieuclidean
   };
 
+  // format of T, idx and pred
+  enum class output_type
+  {
+    full,
+    sparse,
+    bbox
+  };
+
   dim_vector operator+(const dim_vector& dim, octave_idx_type val)
   {
     dim_vector result = dim;
@@ -57,81 +78,2541 @@ namespace image
     return result;
   }
 
-  template <typename ResultType, typename  IndexType, typename ImageType >
-  class GrayDist2D
+  bool
+  iequals (const std::string& a, const std::string& b)
+  {
+    return a.size () == b.size ()
+           && std::equal (a.begin (), a.end (), b.begin (),
+                [] (char x, char y)
+                {
+                  return std::tolower (x) == std::tolower (y);
+                });
+  }
+
+  struct options
+  {
+    double scale = 1;
+
+    double offset = 0;
+
+    double exponent = 1;
+
+    NDArray lookup_table;
+
+    bool has_lookup_table = false;
+
+    // set when the statistics output is requested
+    bool stats = false;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    // interrupts are checked after this many points are processed
+    octave_idx_type interrupt_interval = 4096;
+
+    // true or a function handle when progress should be reported
+    octave_value progress;
+
+    double progress_interval = 1;
+
+    // number of threads of the tiled propagation of 2D images
+    octave_idx_type threads = 1;
+
+    // distance between neighbors along each dimension, empty for unit spacing
+    std::vector<double> spacing;
+
+    // width of the neighborhood, 5 for the chamfer neighborhood of the
+    // quasi-euclidean metric
+    octave_idx_type neighborhood = 3;
+
+    // per-seed region statistics are returned as the second output
+    bool summary = false;
+
+    // points that are farther than this from the seed points are not reached
+    double max_distance = std::numeric_limits<double>::infinity ();
+
+    output_type output = output_type::full;
+
+    // number of levels of the approximation pyramid, -1 for automatic
+    // selection and 0 for exact distances
+    octave_idx_type approximate_levels = 0;
+
+    octave_idx_type band_width = 2;
+  };
+
+  bool
+  is_option_name (const octave_value& arg)
+  {
+    if (! arg.is_string ())
+      return false;
+
+    const std::string name = arg.string_value ();
+
+    for (const char* opt : {"Scale", "Offset", "Exponent", "LookupTable", "InterruptInterval", "Progress", "ProgressInterval", "Threads", "Spacing", "Neighborhood", "Summary", "MaxDistance", "Output", "Approximate", "BandWidth"})
+      if (iequals (name, opt))
+        return true;
+
+    return false;
+  }
+
+  // number of leading positional arguments, options start after them
+  octave_idx_type
+  count_positional_args (const octave_value_list& args)
+  {
+    octave_idx_type n = 0;
+
+    while (n < args.length () && ! (n > 0 && is_option_name (args(n))))
+      n++;
+
+    return n;
+  }
+
+  options
+  parse_options (const octave_value_list& args, octave_idx_type first)
+  {
+    options opt;
+
+    if ((args.length () - first) % 2 != 0)
+      error ("graydist: options should be given as name/value pairs");
+
+    for (octave_idx_type i = first; i < args.length (); i += 2)
+      {
+        const std::string name = args(i).xstring_value ("graydist: option name should be a string");
+
+        const octave_value& val = args(i+1);
+
+        if (iequals (name, "Scale"))
+          opt.scale = val.xdouble_value ("graydist: Scale should be a real scalar");
+        else if (iequals (name, "Offset"))
+          opt.offset = val.xdouble_value ("graydist: Offset should be a real scalar");
+        else if (iequals (name, "Exponent"))
+          opt.exponent = val.xdouble_value ("graydist: Exponent should be a real scalar");
+        else if (iequals (name, "LookupTable"))
+          {
+            opt.lookup_table = val.xarray_value ("graydist: LookupTable should be a real vector");
+
+            opt.has_lookup_table = true;
+          }
+        else if (iequals (name, "InterruptInterval"))
+          {
+            opt.interrupt_interval = val.xidx_type_value ("graydist: InterruptInterval should be a positive integer");
+
+            if (opt.interrupt_interval < 1)
+              error ("graydist: InterruptInterval should be a positive integer");
+          }
+        else if (iequals (name, "Progress"))
+          {
+            if (val.is_function_handle ())
+              opt.progress = val;
+            else if (val.xbool_value ("graydist: Progress should be a logical scalar or a function handle"))
+              opt.progress = true;
+          }
+        else if (iequals (name, "ProgressInterval"))
+          opt.progress_interval = val.xdouble_value ("graydist: ProgressInterval should be a real scalar");
+        else if (iequals (name, "Threads"))
+          {
+            opt.threads = val.xidx_type_value ("graydist: Threads should be a positive integer");
+
+            if (opt.threads < 1)
+              error ("graydist: Threads should be a positive integer");
+          }
+        else if (iequals (name, "Spacing"))
+          {
+            const NDArray spacing = val.xarray_value ("graydist: Spacing should be a real vector");
+
+            opt.spacing.resize (spacing.numel ());
+
+            for (octave_idx_type k = 0; k < spacing.numel (); k++)
+              {
+                if (! (spacing(k) > 0) || ! std::isfinite (spacing(k)))
+                  error ("graydist: Spacing should contain positive values");
+
+                opt.spacing[k] = spacing(k);
+              }
+          }
+        else if (iequals (name, "Neighborhood"))
+          {
+            opt.neighborhood = val.xidx_type_value ("graydist: Neighborhood should be 3 or 5");
+
+            if (opt.neighborhood != 3 && opt.neighborhood != 5)
+              error ("graydist: Neighborhood should be 3 or 5");
+          }
+        else if (iequals (name, "Summary"))
+          opt.summary = val.xbool_value ("graydist: Summary should be a logical scalar");
+        else if (iequals (name, "MaxDistance"))
+          {
+            opt.max_distance = val.xdouble_value ("graydist: MaxDistance should be a real scalar");
+
+            if (! (opt.max_distance >= 0))
+              error ("graydist: MaxDistance should be a non-negative scalar");
+          }
+        else if (iequals (name, "Output"))
+          {
+            const std::string format = val.xstring_value ("graydist: Output should be a string");
+
+            if (iequals (format, "full"))
+              opt.output = output_type::full;
+            else if (iequals (format, "sparse"))
+              opt.output = output_type::sparse;
+            else if (iequals (format, "bbox"))
+              opt.output = output_type::bbox;
+            else
+              error ("graydist: unrecognized Output format '%s'", format.c_str ());
+          }
+        else if (iequals (name, "Approximate"))
+          {
+            if (val.islogical ())
+              opt.approximate_levels = val.xbool_value ("graydist: Approximate should be a logical scalar or a number of levels") ? -1 : 0;
+            else
+              opt.approximate_levels = val.xidx_type_value ("graydist: Approximate should be a logical scalar or a number of levels");
+
+            if (opt.approximate_levels < -1)
+              error ("graydist: Approximate should be a logical scalar or a number of levels");
+          }
+        else if (iequals (name, "BandWidth"))
+          {
+            opt.band_width = val.xidx_type_value ("graydist: BandWidth should be a positive integer");
+
+            if (opt.band_width < 1)
+              error ("graydist: BandWidth should be a positive integer");
+          }
+        else
+          error ("graydist: unrecognized option '%s'", name.c_str ());
+      }
+
+    return opt;
+  }
+
+  template <typename T>
+  struct lut_size
+  {
+    static constexpr octave_idx_type value = 0;
+  };
+
+  template <typename T>
+  struct lut_size<octave_int<T>>
+  {
+    static constexpr octave_idx_type value = sizeof (T) <= 2 ? octave_idx_type (1) << (8 * sizeof (T)) : 0;
+  };
+
+  template <typename T>
+  octave_idx_type
+  lut_index (const T&)
+  {
+    return 0;
+  }
+
+  template <typename T>
+  octave_idx_type
+  lut_index (const octave_int<T>& x)
+  {
+    return octave_idx_type (x.value ()) - std::numeric_limits<T>::min ();
+  }
+
+  // maps gray values of the image to the values used in the step cost.
+  // 8 and 16 bit images are mapped through a table so the raw image is read
+  // directly without creating a transformed copy of it.
+  template <typename T>
+  class cost_transform
+  {
+  public:
+
+    cost_transform () = default;
+
+    template <typename ImageType>
+    cost_transform (const options& opt, const ImageType& image)
+    : scale (opt.scale), offset (opt.offset), exponent (opt.exponent)
+    {
+      using image_elem = typename ImageType::element_type;
+
+      constexpr octave_idx_type nlevels = lut_size<image_elem>::value;
+
+      const bool is_identity = scale == 1 && offset == 0 && exponent == 1;
+
+      if (opt.has_lookup_table)
+        {
+          if (nlevels == 0)
+            error ("LookupTable can only be used with 8 and 16 bit integer images");
+
+          if (opt.lookup_table.numel () != nlevels)
+            error ("LookupTable should have %s elements for this image class", std::to_string (nlevels).c_str ());
+        }
+
+      if (nlevels > 0 && (opt.has_lookup_table || ! is_identity))
+        {
+          table.resize (nlevels);
+
+          for (octave_idx_type i = 0; i < nlevels; i++)
+            {
+              T level = opt.has_lookup_table
+                        ? static_cast<T> (opt.lookup_table.xelem (i))
+                        : static_cast<T> (image_elem (i - lut_index (image_elem ())));
+
+              table[i] = apply (level);
+            }
+
+          mode = transform_mode::table;
+        }
+      else if (is_identity)
+        mode = transform_mode::identity;
+      else if (exponent == 1)
+        mode = transform_mode::affine;
+      else
+        mode = transform_mode::power;
+    }
+
+    template <typename ImageElem>
+    T operator () (const ImageElem& x) const
+    {
+      switch (mode)
+        {
+        case transform_mode::identity:
+          return static_cast<T> (x);
+        case transform_mode::table:
+          return table[lut_index (x)];
+        case transform_mode::affine:
+          return static_cast<T> (scale) * static_cast<T> (x) + static_cast<T> (offset);
+        default:
+          return apply (static_cast<T> (x));
+        }
+    }
+
+  private:
+
+    T apply (const T& x) const
+    {
+      return static_cast<T> (scale) * std::pow (x, static_cast<T> (exponent)) + static_cast<T> (offset);
+    }
+
+    enum class transform_mode
+    {
+      identity,
+      affine,
+      power,
+      table
+    };
+
+    transform_mode mode = transform_mode::identity;
+
+    double scale = 1;
+
+    double offset = 0;
+
+    double exponent = 1;
+
+    std::vector<T> table;
+  };
+
+  // cost of a step between two neighbors with gray values a and b, w is the
+  // weight of the class of the neighbor
+  template <typename T>
+  struct gray_step
+  {
+    T operator () (const T& a, const T& b, const T& w) const
+    {
+      return w * (a + b);
+    }
+  };
+
+  // step cost kernels used in the propagation loops. key () is computed once
+  // for each visited pixel and the cost of a step is computed from the keys
+  // of its two ends and the class of the neighbor.
+
+  // computes the step cost from the transformed gray levels
+  template <typename T, typename Step>
+  class level_cost
+  {
+  public:
+
+    using key_type = T;
+
+    level_cost (const cost_transform<T>& cost, const std::vector<T>& weights)
+    : cost (cost), weights (weights)
+    { }
+
+    template <typename ImageElem>
+    T key (const ImageElem& x) const
+    {
+      return cost (x);
+    }
+
+    T operator () (const T& a, const T& b, int cls) const
+    {
+      return step (a, b, weights[cls]);
+    }
+
+  private:
+
+    const cost_transform<T>& cost;
+
+    std::vector<T> weights;
+
+    Step step;
+  };
+
+  // 8 bit images: the step cost of all pairs of gray levels is precomputed
+  // for each class of neighbors
+  template <typename T, typename Step>
+  class pair_table_cost
+  {
+  public:
+
+    using key_type = octave_idx_type;
+
+    template <typename ImageElem>
+    pair_table_cost (const cost_transform<T>& cost, const std::vector<T>& weights, const ImageElem&)
+    : nlevels (lut_size<ImageElem>::value), table (weights.size () * nlevels * nlevels)
+    {
+      std::vector<T> level (nlevels);
+
+      for (octave_idx_type i = 0; i < nlevels; i++)
+        level[i] = cost (ImageElem (i - lut_index (ImageElem ())));
+
+      Step step;
+
+      T* p = table.data ();
+
+      for (const T& w : weights)
+        for (octave_idx_type a = 0; a < nlevels; a++)
+          for (octave_idx_type b = 0; b < nlevels; b++)
+            *p++ = step (level[a], level[b], w);
+    }
+
+    template <typename ImageElem>
+    octave_idx_type key (const ImageElem& x) const
+    {
+      return lut_index (x);
+    }
+
+    T operator () (octave_idx_type a, octave_idx_type b, int cls) const
+    {
+      return table[(cls * nlevels + a) * nlevels + b];
+    }
+
+  private:
+
+    octave_idx_type nlevels;
+
+    std::vector<T> table;
+  };
+
+  // the pair table pays off when the number of steps exceeds its size
+  template <typename ImageElem>
+  bool
+  use_pair_table (octave_idx_type numel, octave_idx_type nneighbors, octave_idx_type nclasses)
+  {
+    constexpr octave_idx_type nlevels = lut_size<ImageElem>::value;
+
+    return nlevels == 256 && numel * nneighbors >= nclasses * nlevels * nlevels;
+  }
+
+  double
+  elapsed (const std::chrono::steady_clock::time_point& since)
+  {
+    return std::chrono::duration<double> (std::chrono::steady_clock::now () - since).count ();
+  }
+
+  // counters of the propagation loop. They are only updated when the
+  // statistics output is requested, otherwise no_stats is used in their
+  // place and the calls compile to nothing.
+  struct propagation_stats
+  {
+    void start (size_t queue_size)
+    {
+      pushes += queue_size;
+
+      max_queue_size = std::max (max_queue_size, static_cast<octave_idx_type> (queue_size));
+    }
+
+    void pop ()
+    {
+      pops++;
+    }
+
+    void stale_pop ()
+    {
+      stale_pops++;
+    }
+
+    void relax ()
+    {
+      relaxations++;
+    }
+
+    void improve (size_t queue_size)
+    {
+      improvements++;
+
+      pushes++;
+
+      max_queue_size = std::max (max_queue_size, static_cast<octave_idx_type> (queue_size));
+    }
+
+    // adds the counters of a tile, the queue sizes of the tiles are summed
+    void merge (const propagation_stats& other)
+    {
+      pushes += other.pushes;
+
+      pops += other.pops;
+
+      stale_pops += other.stale_pops;
+
+      relaxations += other.relaxations;
+
+      improvements += other.improvements;
+
+      max_queue_size += other.max_queue_size;
+    }
+
+    octave_idx_type pushes = 0;
+
+    octave_idx_type pops = 0;
+
+    octave_idx_type stale_pops = 0;
+
+    octave_idx_type relaxations = 0;
+
+    octave_idx_type improvements = 0;
+
+    octave_idx_type max_queue_size = 0;
+
+    double initialization_time = 0;
+
+    double propagation_time = 0;
+  };
+
+  struct no_stats
+  {
+    void start (size_t) { }
+
+    void pop () { }
+
+    void stale_pop () { }
+
+    void relax () { }
+
+    void improve (size_t) { }
+
+    void merge (const no_stats&) { }
+  };
+
+  // statistics of the region of each seed point, that is the points that
+  // have it as their nearest seed: the number of points, the largest and the
+  // mean distance and the farthest point. The points are added when they are
+  // settled so no second pass over the distance map and idx is needed.
+  template <typename ResultType>
+  class region_summary
   {
   public:
 
-    using element_type = std::pair<octave_idx_type, typename ResultType::element_type>;
+    using T = typename ResultType::element_type;
+
+    // seed points as zero based linear indexes
+    void
+    start (std::vector<octave_idx_type> points)
+    {
+      std::sort (points.begin (), points.end ());
+
+      points.erase (std::unique (points.begin (), points.end ()), points.end ());
+
+      seeds = std::move (points);
+
+      // region of each seed point by its linear index, so a settled point
+      // finds its region without a search
+      first_seed = seeds.empty () ? 0 : seeds.front ();
+
+      region.assign (seeds.empty () ? 0 : seeds.back () - first_seed + 1, -1);
+
+      for (size_t r = 0; r < seeds.size (); r++)
+        region[seeds[r] - first_seed] = r;
+
+      area.assign (seeds.size (), 0);
+
+      sum.assign (seeds.size (), T (0));
+
+      max_distance.assign (seeds.size (), T (0));
+
+      farthest.assign (seeds.size (), -1);
+    }
+
+    // seed is the zero based index of the nearest seed point of point
+    void
+    add (octave_idx_type seed, octave_idx_type point, const T& distance)
+    {
+      const octave_idx_type k = seed - first_seed;
+
+      if (k < 0 || k >= static_cast<octave_idx_type> (region.size ()) || region[k] < 0)
+        return;
+
+      const octave_idx_type r = region[k];
+
+      area[r]++;
+
+      sum[r] += distance;
+
+      if (farthest[r] < 0 || distance > max_distance[r])
+        {
+          max_distance[r] = distance;
+
+          farthest[r] = point;
+        }
+    }
+
+    // adds the reached points of a finished distance map, used when the
+    // points are not settled exactly once
+    template <typename IndexType>
+    void
+    collect (const ResultType& dist, const IndexType& idx, const std::vector<octave_idx_type>& points)
+    {
+      for (octave_idx_type i : points)
+        if (idx.xelem (i).value () != 0)
+          add (idx.xelem (i).value () - 1, i, dist.xelem (i));
+    }
+
+    octave_scalar_map
+    get () const
+    {
+      const dim_vector dims (seeds.size (), 1);
+
+      NDArray seed (dims);
+
+      NDArray npoints (dims);
+
+      ResultType max_dist (dims);
+
+      ResultType mean_dist (dims);
+
+      NDArray farthest_point (dims);
+
+      for (size_t k = 0; k < seeds.size (); k++)
+        {
+          seed.xelem (k) = seeds[k] + 1;
+
+          npoints.xelem (k) = area[k];
+
+          max_dist.xelem (k) = max_distance[k];
+
+          mean_dist.xelem (k) = sum[k] / static_cast<T> (area[k]);
+
+          farthest_point.xelem (k) = farthest[k] + 1;
+        }
+
+      octave_scalar_map result;
+
+      result.assign ("seed", seed);
+      result.assign ("area", npoints);
+      result.assign ("max_distance", max_dist);
+      result.assign ("mean_distance", mean_dist);
+      result.assign ("farthest", farthest_point);
+
+      return result;
+    }
+
+  private:
+
+    std::vector<octave_idx_type> seeds;
+
+    octave_idx_type first_seed = 0;
+
+    std::vector<octave_idx_type> region;
+
+    std::vector<octave_idx_type> area;
+
+    std::vector<T> sum;
+
+    std::vector<T> max_distance;
+
+    std::vector<octave_idx_type> farthest;
+  };
+
+  // T, idx and pred of the settled points only. In the sparse format T is a
+  // struct with the linear indexes and the distances of the points and idx
+  // and pred are column vectors with their values at the same points. In
+  // the bbox format they are cropped to the bounding box of the points and
+  // T is a struct with the cropped distances and the offset of the box.
+  template <typename ResultType, typename IndexType>
+  octave_value_list
+  compact_result (output_type output, const ResultType& dist, const IndexType& segment, const IndexType& predecessor, int nargout, std::vector<octave_idx_type> settled)
+  {
+    std::sort (settled.begin (), settled.end ());
+
+    const octave_idx_type n = settled.size ();
+
+    octave_scalar_map T;
+
+    if (output == output_type::sparse)
+      {
+        NDArray ind (dim_vector (n, 1));
+
+        ResultType value (dim_vector (n, 1));
+
+        IndexType idx (dim_vector (nargout >= 2 ? n : 0, 1));
+
+        IndexType pred (dim_vector (nargout >= 3 ? n : 0, 1));
+
+        for (octave_idx_type k = 0; k < n; k++)
+          {
+            ind.xelem (k) = settled[k] + 1;
+
+            value.xelem (k) = dist.xelem (settled[k]);
+
+            if (nargout >= 2)
+              {
+                idx.xelem (k) = segment.xelem (settled[k]);
+
+                if (nargout >= 3)
+                  pred.xelem (k) = predecessor.xelem (settled[k]);
+              }
+          }
+
+        T.assign ("ind", ind);
+        T.assign ("value", value);
+
+        return ovl (T, idx, pred);
+      }
+
+    const dim_vector& dims = dist.dims ();
+
+    const int nd = dims.ndims ();
+
+    std::vector<octave_idx_type> lo (nd, std::numeric_limits<octave_idx_type>::max ());
+
+    std::vector<octave_idx_type> hi (nd, -1);
+
+    for (octave_idx_type p : settled)
+      for (int k = 0; k < nd; k++)
+        {
+          const octave_idx_type sub = p % dims(k);
+
+          p /= dims(k);
+
+          lo[k] = std::min (lo[k], sub);
+
+          hi[k] = std::max (hi[k], sub);
+        }
+
+    dim_vector box = dims;
+
+    NDArray offset (dim_vector (1, nd));
+
+    for (int k = 0; k < nd; k++)
+      {
+        box(k) = n > 0 ? hi[k] - lo[k] + 1 : 0;
+
+        offset.xelem (k) = n > 0 ? lo[k] + 1 : 1;
+      }
+
+    ResultType value (box, numeric_limits<typename ResultType::element_type>::infinity ());
+
+    IndexType idx (nargout >= 2 ? box : dim_vector (0, 0), 0);
+
+    IndexType pred (nargout >= 3 ? box : dim_vector (0, 0), 0);
+
+    for (octave_idx_type p : settled)
+      {
+        octave_idx_type q = 0;
+
+        octave_idx_type stride = 1;
+
+        for (octave_idx_type k = 0, r = p; k < nd; k++)
+          {
+            q += (r % dims(k) - lo[k]) * stride;
+
+            r /= dims(k);
+
+            stride *= box(k);
+          }
+
+        value.xelem (q) = dist.xelem (p);
+
+        if (nargout >= 2)
+          {
+            idx.xelem (q) = segment.xelem (p);
+
+            if (nargout >= 3)
+              pred.xelem (q) = predecessor.xelem (p);
+          }
+      }
+
+    T.assign ("value", value);
+    T.assign ("offset", offset);
+
+    return ovl (T, idx, pred);
+  }
+
+  // the bounding box of the squeezed image is mapped to the dimensions of
+  // the outputs, the squeezed singleton dimensions get an offset of 1
+  void
+  unsqueeze_bbox (octave_value_list& retval, int nargout, const dim_vector& dims, const dim_vector& squeezed)
+  {
+    octave_scalar_map T = retval(0).scalar_map_value ();
+
+    const NDArray offset = T.getfield ("offset").array_value ();
+
+    const dim_vector box = T.getfield ("value").dims ();
+
+    dim_vector out = dims;
+
+    NDArray out_offset (dim_vector (1, dims.ndims ()), 1);
+
+    for (int k = 0, j = 0; k < dims.ndims (); k++)
+      {
+        if (dims(k) == 1)
+          {
+            out(k) = box.numel () > 0 ? 1 : 0;
+
+            continue;
+          }
+
+        while (squeezed(j) == 1)
+          j++;
+
+        out(k) = box(j);
+
+        out_offset.xelem (k) = offset.xelem (j);
+
+        j++;
+      }
+
+    T.assign ("value", T.getfield ("value").reshape (out));
+
+    T.assign ("offset", out_offset);
+
+    retval(0) = T;
+
+    if (nargout >= 2)
+      retval(1) = retval(1).reshape (out);
+
+    if (nargout >= 3)
+      retval(2) = retval(2).reshape (out);
+  }
+
+  // spacing of the dimensions that remain after the image is squeezed,
+  // missing trailing elements are 1
+  std::vector<double>
+  squeeze_spacing (const dim_vector& dims, const std::vector<double>& spacing)
+  {
+    std::vector<double> result;
+
+    if (spacing.empty ())
+      return result;
+
+    for (int k = 0; k < dims.ndims (); k++)
+      if (dims(k) != 1)
+        result.push_back (k < static_cast<int> (spacing.size ()) ? spacing[k] : 1);
+
+    return result;
+  }
+
+  // mask of the axes in which a neighbor differs from the center, offset is
+  // the offset of the neighbor in an array with all dimensions equal to 3.
+  // It is decoded as a balanced ternary number.
+  int
+  axes_of_offset (octave_idx_type offset)
+  {
+    int mask = 0;
+
+    for (int k = 0; offset != 0; k++)
+      {
+        const octave_idx_type r = ((offset % 3) + 3) % 3;
+
+        if (r == 1)
+          offset = (offset - 1) / 3;
+        else if (r == 2)
+          offset = (offset + 1) / 3;
+        else
+          offset /= 3;
+
+        if (r != 0)
+          mask |= 1 << k;
+      }
+
+    return mask;
+  }
+
+  // spatial length of a step between neighbors that differ in the axes of
+  // mask. Chessboard and cityblock steps are as long as the largest spacing
+  // of the axes, quasi-euclidean steps are the euclidean distance.
+  double
+  step_length (int mask, const std::vector<double>& spacing, bool quasi)
+  {
+    double sum = 0;
+
+    double longest = 0;
+
+    for (size_t k = 0; k < spacing.size (); k++)
+      if (mask & (1 << k))
+        {
+          sum += spacing[k] * spacing[k];
+
+          longest = std::max (longest, spacing[k]);
+        }
+
+    return quasi ? std::sqrt (sum) : longest;
+  }
+
+  // weights of the neighbor classes with anisotropic spacing. The class of
+  // a neighbor is the mask of its axes minus one, weight maps the mask to
+  // the weight that is used by the step cost.
+  template <typename T, typename Weight>
+  std::vector<T>
+  axis_weights (const std::vector<double>& spacing, const Weight& weight)
+  {
+    std::vector<T> weights ((1 << spacing.size ()) - 1);
+
+    for (size_t mask = 1; mask <= weights.size (); mask++)
+      weights[mask-1] = static_cast<T> (weight (mask));
+
+    return weights;
+  }
+
+  // steps of the chamfer neighborhood of width 5: the neighbors that are at
+  // most two points away in each dimension and are not a multiple of a
+  // shorter step, like the knight moves in 2D
+  std::vector<std::vector<int>>
+  chamfer_steps (int ndims)
+  {
+    std::vector<std::vector<int>> result;
+
+    std::vector<int> step (ndims, -2);
+
+    while (true)
+      {
+        // steps with only even coordinates are twice a step of the 3x3
+        // neighborhood or the center
+        if (std::any_of (step.begin (), step.end (), [] (int c) { return c % 2 != 0; }))
+          result.push_back (step);
+
+        int k = 0;
+
+        for (; k < ndims; k++)
+          {
+            if (++step[k] <= 2)
+              break;
+
+            step[k] = -2;
+          }
+
+        if (k == ndims)
+          break;
+      }
+
+    return result;
+  }
+
+  // functions that free the scratch buffers of each type
+  std::vector<std::function<void ()>>&
+  scratch_releasers ()
+  {
+    static thread_local std::vector<std::function<void ()>> releasers;
+
+    return releasers;
+  }
+
+  // the queue storage and the processed flags are kept per thread between
+  // calls, so repeated calls on images of the same size do not allocate
+  // them again. There is one buffer per element type that keeps the
+  // largest capacity that has been used.
+  template <typename T>
+  std::vector<T>&
+  scratch_slot ()
+  {
+    static thread_local std::vector<T> buffer;
+
+    static thread_local bool registered = false;
+
+    if (! registered)
+      {
+        scratch_releasers ().push_back ([] () { std::vector<T> ().swap (scratch_slot<T> ()); });
+
+        registered = true;
+      }
+
+    return buffer;
+  }
+
+  // an engine takes the buffer for the duration of a call, so a nested call
+  // (for example from a progress callback) allocates its own one
+  template <typename T>
+  std::vector<T>
+  take_scratch ()
+  {
+    std::vector<T> result = std::move (scratch_slot<T> ());
+
+    scratch_slot<T> ().clear ();
+
+    result.clear ();
+
+    return result;
+  }
+
+  template <typename T>
+  void
+  give_back_scratch (std::vector<T>&& buffer)
+  {
+    std::vector<T>& slot = scratch_slot<T> ();
+
+    if (buffer.capacity () > slot.capacity ())
+      slot = std::move (buffer);
+  }
+
+  // working state of the compact outputs that is kept between calls: the
+  // distances, idx, pred and the processed flags of an image of size dims.
+  // layout tells how the flags are laid out for dims. A call on an image of
+  // the same size takes the state and resets only the points that it has
+  // reached when it finishes, so neither the filling of the arrays nor the
+  // output conversion depends on the size of the image.
+  template <typename ResultType, typename IndexType, typename FlagType>
+  struct compact_state
+  {
+    dim_vector dims;
+
+    int layout = 0;
+
+    ResultType dist;
+
+    IndexType segment;
+
+    IndexType predecessor;
+
+    std::vector<FlagType> inheap;
+  };
+
+  template <typename ResultType, typename IndexType, typename FlagType>
+  compact_state<ResultType, IndexType, FlagType>&
+  compact_state_slot ()
+  {
+    static thread_local compact_state<ResultType, IndexType, FlagType> state;
+
+    static thread_local bool registered = false;
+
+    if (! registered)
+      {
+        scratch_releasers ().push_back ([] () { compact_state_slot<ResultType, IndexType, FlagType> () = compact_state<ResultType, IndexType, FlagType> (); });
+
+        registered = true;
+      }
+
+    return state;
+  }
+
+  // the array of the state if it has the size dims, otherwise a new array
+  // filled with val
+  template <typename ArrayType>
+  ArrayType
+  take_state_array (ArrayType& slot, const dim_vector& dims, const typename ArrayType::element_type& val)
+  {
+    if (slot.dims () != dims)
+      return ArrayType (dims, val);
+
+    ArrayType result = slot;
+
+    slot = ArrayType ();
+
+    return result;
+  }
+
+  void
+  clear_scratch ()
+  {
+    for (auto& release : scratch_releasers ())
+      release ();
+  }
+
+  // priority queue that can give its storage back to the arena
+  template <typename T, typename Compare>
+  class scratch_queue : public std::priority_queue<T, std::vector<T>, Compare>
+  {
+  public:
+
+    using std::priority_queue<T, std::vector<T>, Compare>::priority_queue;
+
+    std::vector<T>&&
+    storage ()
+    {
+      return std::move (this->c);
+    }
+  };
+
+  template <typename T>
+  struct nd_queue_elem
+  {
+    octave_idx_type maskindex = 0;
+    octave_idx_type imageindex = 0;
+    T imageval = 0;
+  };
+
+  // checks for interrupts after each interval processed points instead of on
+  // each pop of the queue. The progress is reported at the same checks when
+  // at least progress_interval seconds have passed since the last report.
+  class propagation_monitor
+  {
+  public:
+
+    propagation_monitor (const options& opt)
+    : interval (opt.interrupt_interval), progress (opt.progress),
+      progress_interval (opt.progress_interval)
+    { }
+
+    void start (octave_idx_type npoints)
+    {
+      total = npoints;
+
+      settled = 0;
+
+      next_poll = interval;
+
+      start_time = last_report = std::chrono::steady_clock::now ();
+    }
+
+    void settle ()
+    {
+      if (++settled == next_poll)
+        poll ();
+    }
+
+    void finish ()
+    {
+      if (progress.is_defined ())
+        report (elapsed (start_time));
+    }
+
+    // points that are processed by worker threads, they can be processed
+    // more than once so the count is limited to the number of points
+    void update (octave_idx_type processed)
+    {
+      settled = std::min (processed, total);
+
+      poll ();
+    }
+
+    octave_idx_type poll_interval () const
+    {
+      return interval;
+    }
+
+  private:
+
+    void poll ()
+    {
+      next_poll += interval;
+
+      OCTAVE_QUIT;
+
+      if (progress.is_defined ())
+        {
+          const auto now = std::chrono::steady_clock::now ();
+
+          if (std::chrono::duration<double> (now - last_report).count () >= progress_interval)
+            {
+              last_report = now;
+
+              report (std::chrono::duration<double> (now - start_time).count ());
+            }
+        }
+    }
+
+    void report (double time)
+    {
+      const double fraction = total > 0 ? static_cast<double> (settled) / total : 1;
+
+      const double remaining = settled > 0
+                               ? time * (total - settled) / settled
+                               : std::numeric_limits<double>::infinity ();
+
+      if (progress.is_function_handle ())
+        octave::feval (progress, ovl (fraction, time, remaining));
+      else
+        {
+          std::ostringstream line;
+
+          line << std::fixed << std::setprecision (1)
+               << "graydist: " << 100 * fraction << "% of points processed, "
+               << time << " s elapsed, ETA " << remaining << " s\n";
+
+          octave_stdout << line.str ();
+
+          flush_octave_stdout ();
+        }
+    }
+
+    const octave_idx_type interval;
+
+    const octave_value progress;
+
+    const double progress_interval;
+
+    octave_idx_type total = 0;
+
+    octave_idx_type settled = 0;
+
+    octave_idx_type next_poll = 0;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    std::chrono::steady_clock::time_point last_report;
+  };
+
+  // runs fn (0) ... fn (n-1) in worker threads. Octave can only be called
+  // from the calling thread, so it waits for the workers and checks for
+  // Ctrl-C and reports the progress each time they have processed another
+  // interval of points. An exception of a worker or of the check makes the
+  // other workers stop and is thrown again after all of them have finished.
+  class parallel_workers
+  {
+  public:
+
+    parallel_workers (propagation_monitor& monitor)
+    : monitor (monitor), interval (monitor.poll_interval ())
+    { }
+
+    template <typename Fn>
+    void run (octave_idx_type n, const Fn& fn)
+    {
+      std::vector<std::exception_ptr> errors (n);
+
+      std::vector<std::thread> workers;
+
+      std::exception_ptr error;
+
+      running = n;
+
+      try
+        {
+          for (octave_idx_type t = 0; t < n; t++)
+            workers.emplace_back ([&, t] ()
+              {
+                try
+                  {
+                    fn (t);
+                  }
+                catch (...)
+                  {
+                    errors[t] = std::current_exception ();
+
+                    stopped = true;
+                  }
+
+                {
+                  std::lock_guard<std::mutex> lock (mutex);
+
+                  running--;
+                }
+
+                wake.notify_one ();
+              });
+
+          std::unique_lock<std::mutex> lock (mutex);
+
+          while (running > 0)
+            {
+              wake.wait (lock, [&] () { return running == 0 || processed >= next_poll; });
+
+              if (processed >= next_poll)
+                {
+                  next_poll = processed + interval;
+
+                  const octave_idx_type count = processed;
+
+                  lock.unlock ();
+
+                  monitor.update (count);
+
+                  lock.lock ();
+                }
+            }
+        }
+      catch (...)
+        {
+          error = std::current_exception ();
+
+          stopped = true;
+        }
+
+      for (auto& w : workers)
+        w.join ();
+
+      for (const auto& e : errors)
+        if (! error && e)
+          error = e;
+
+      if (error)
+        std::rethrow_exception (error);
+    }
+
+    // called by a worker after it has processed count points, returns
+    // false when it should stop
+    bool processed_points (octave_idx_type count)
+    {
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+
+        processed += count;
+      }
+
+      wake.notify_one ();
+
+      return ! stopped;
+    }
+
+    octave_idx_type batch () const
+    {
+      return interval;
+    }
+
+  private:
+
+    propagation_monitor& monitor;
+
+    const octave_idx_type interval;
+
+    std::mutex mutex;
+
+    std::condition_variable wake;
+
+    std::atomic<bool> stopped {false};
+
+    octave_idx_type running = 0;
+
+    octave_idx_type processed = 0;
+
+    octave_idx_type next_poll = 0;
+  };
+
+  template <typename ResultType, typename  IndexType, typename ImageType >
+  class GrayDist2D
+  {
+  public:
+
+    using element_type = std::pair<octave_idx_type, typename ResultType::element_type>;
+
+    GrayDist2D (const ImageType& image, int nargout, const options& opt, const boolNDArray & mask, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      f = image;
+
+      init_state ();
+
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
+          init_method (method);
+          initialize_from_seed (mask);
+          stats.initialization_time = elapsed (start);
+          run ();
+
+        }
+
+    }
+
+    GrayDist2D (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      f = image;
+
+      init_state ();
+
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
+          init_method (method);
+          initialize_from_seed (C , R);
+          stats.initialization_time = elapsed (start);
+          run ();
+        }
+    }
+
+    GrayDist2D (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (opt.threads), spacing (opt.spacing), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      f = image;
+
+      init_state ();
+
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
+          init_method (method);
+          initialize_from_seed (ind);
+          stats.initialization_time = elapsed (start);
+          run ();
+        }
+    }
+
+    // computes the distances only in band. The distances and idx of the
+    // other points are taken from initial and initial_idx, the points that
+    // border band are the sources of the propagation in addition to seeds.
+    // seeds holds the index of the seed point or zero.
+    GrayDist2D (const ImageType& image, int nargout, const options& opt, const ResultType& initial, const IndexType& initial_idx, const Array<octave_idx_type>& seeds, const boolNDArray& band, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), threads (1), spacing (opt.spacing), want_summary (false), cutoff (opt.max_distance), output (output_type::full)
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      dist_mat = initial;
+
+      dist_mat.make_unique ();
+
+      if (image.numel () != 0)
+        {
+          if (nargout >= 2)
+            {
+              idx_segment = initial_idx;
+
+              idx_segment.make_unique ();
+            }
+
+          if (nargout >= 3)
+                idx_predecessor = IndexType (image.dims ());
+
+          f = image;
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
+          init_method (method);
+          inheap = take_scratch<char> ();
+          inheap.assign (image.numel (), 5);
+          init_mask2D();
+          initialize_from_band (seeds, band);
+          stats.initialization_time = elapsed (start);
+          run ();
+        }
+    }
+
+    ~GrayDist2D ()
+    {
+      if (finished && output != output_type::full)
+        keep_state ();
+      else
+        give_back_scratch (std::move (inheap));
+
+      give_back_scratch (Q.storage ());
+    }
+
+    const ResultType&
+    value () const
+    {
+      return dist_mat;
+    }
+
+    const IndexType&
+    segment () const
+    {
+      return idx_segment;
+    }
+
+    octave_value_list
+    get_result ()
+    {
+      if (output != output_type::full)
+        return compact_result (output, dist_mat, idx_segment, idx_predecessor, nargout, settled);
+
+      return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
+    }
+
+    octave_scalar_map
+    get_summary () const
+    {
+      return summary.get ();
+    }
+
+    octave_scalar_map
+    get_info (double conversion_time) const
+    {
+      octave_scalar_map bytes;
+
+      bytes.assign ("distance", static_cast<double> (dist_mat.numel () * sizeof (typename ResultType::element_type)));
+      bytes.assign ("inheap", static_cast<double> (inheap.size () * sizeof (char)));
+      bytes.assign ("idx", static_cast<double> (idx_segment.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("pred", static_cast<double> (idx_predecessor.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("queue", static_cast<double> (stats.max_queue_size * sizeof (element_type)));
+
+      octave_scalar_map time;
+
+      time.assign ("conversion", conversion_time);
+      time.assign ("initialization", stats.initialization_time);
+      time.assign ("propagation", stats.propagation_time);
+
+      octave_scalar_map info;
+
+      info.assign ("pushes", static_cast<double> (stats.pushes));
+      info.assign ("pops", static_cast<double> (stats.pops));
+      info.assign ("stale_pops", static_cast<double> (stats.stale_pops));
+      info.assign ("relaxations", static_cast<double> (stats.relaxations));
+      info.assign ("improvements", static_cast<double> (stats.improvements));
+      info.assign ("max_queue_size", static_cast<double> (stats.max_queue_size));
+      info.assign ("bytes", bytes);
+      info.assign ("time", time);
+
+      return info;
+    }
+
+  private:
+
+    struct PointCmp
+    {
+      PointCmp ()  {}
+
+      bool operator()(const element_type& a , const element_type& b ) const
+      {return a.second > b.second;}
+    };
+
+    void init_method (const std::string& method)
+    {
+      if (method == "chessboard")
+        {
+          this->method = distance_type::chessboard;
+        }
+      else if (method == "cityblock")
+        {
+          this->method = distance_type::cityblock;
+        }
+      else if (method == "quasi-euclidean")
+        {
+          this->method = distance_type::quasieuclidean;
+        }
+      else
+        {
+          error ("graydist: unregignized distance metric");
+        }
+    }
+
+    void
+    initialize_from_seed (const Array<octave_idx_type>& ind)
+    {
+      std::vector<element_type> cache = take_scratch<element_type> ();
+
+      if (f.dim1 () == 1 || f.dim2 () == 1)
+        {
+          cache.reserve(ind.numel ()*2);
+        }
+      else
+        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+
+      Q = scratch_queue<element_type, PointCmp>
+      {PointCmp{}, std::move(cache)};
+
+      try
+        {
+          for (octave_idx_type i = 0; i < ind.numel () ; i++)
+            {
+              dist_mat.checkelem(ind(i)-1) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(ind(i)-1) = ind(i);
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(ind(i)-1) = 0;
+                }
+
+              Q.push({ind(i)-1, 0});
+            }
+        }
+      catch (...)
+        {
+          error ("out of range seed values");
+        }
+    }
+
+    void
+    initialize_from_seed (const Array<octave_idx_type>& C, const Array<octave_idx_type>& R)
+    {
+      if (C.numel () != R.numel ())
+        error ("C and R should have equal sizes");
+
+      std::vector<element_type> cache = take_scratch<element_type> ();
+
+      if (f.dim1 () == 1 || f.dim2 () == 1)
+        {
+          cache.reserve(C.numel () * 2);
+        }
+      else
+        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+
+      Q = scratch_queue<element_type, PointCmp>
+      {PointCmp{}, std::move(cache)};
+
+      const dim_vector& dim = f.dims();
+
+      try
+        {
+          for (octave_idx_type i = 0; i < C.numel () ; i++)
+            {
+              octave_idx_type ind = ::compute_index (R.xelem(i)-1, C.xelem(i)-1 , dim);
+
+              dist_mat(ind) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(ind) = ind + 1;
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(ind) = 0;
+                }
+
+              Q.push({ind, 0});
+            }
+        }
+      catch (...)
+        {
+          error ("out of range seed values");
+        }
+    }
+
+    void
+    initialize_from_seed (const boolNDArray& mask)
+    {
+      if (mask.numel () != f.numel ())
+        error ("mask and I should have equal sizes");
+
+
+      std::vector<element_type> cache = take_scratch<element_type> ();
+
+      if (f.dim1 () == 1 || f.dim2 () == 1)
+        {
+          octave_idx_type nseed = 0;
+
+          for (octave_idx_type i = 0; i < mask.numel () ; i++)
+            if (mask.xelem(i))
+              ++nseed;
+
+          cache.reserve(nseed * 2);
+        }
+      else
+        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+
+      Q = scratch_queue<element_type, PointCmp>
+      {PointCmp{}, std::move(cache)};
+
+      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+        {
+          if (mask.xelem(i))
+            {
+              dist_mat(i) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(i) = i + 1;
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(i) = 0;
+                }
+
+              Q.push({i, 0});
+            }
+        }
+    }
+
+    void
+    initialize_from_band (const Array<octave_idx_type>& seeds, const boolNDArray& band)
+    {
+      const auto& offset = create_offset_to_neighbors (f.dim1 (), method == distance_type::cityblock);
+
+      const typename ResultType::element_type inf = numeric_limits<typename ResultType::element_type>::infinity ();
+
+      Q = scratch_queue<element_type, PointCmp>
+      {PointCmp{}, take_scratch<element_type> ()};
+
+      for (octave_idx_type i = 0; i < f.numel (); i++)
+        {
+          if (band.xelem (i))
+            {
+              if (seeds.xelem (i))
+                {
+                  dist_mat.xelem (i) = 0;
+
+                  if (nargout >= 2)
+                    idx_segment.xelem (i) = seeds.xelem (i);
+
+                  Q.push ({i, 0});
+                }
+              else
+                dist_mat.xelem (i) = inf;
+
+              continue;
+            }
+
+          bool borders_band = false;
+
+          for (auto d : offset[inheap[i]])
+            if (band.xelem (i + d))
+              {
+                borders_band = true;
+
+                break;
+              }
+
+          // the other points are processed already
+          if (borders_band && dist_mat.xelem (i) < inf)
+            Q.push ({i, dist_mat.xelem (i)});
+          else
+            inheap[i] = 0;
+        }
+    }
+
+    // class of each neighbor from the axes in which it differs from the
+    // center, used with anisotropic spacing: 0 for the neighbors in the same
+    // column, 1 for the neighbors in the same row and 2 for the diagonals
+    std::vector<std::vector<char>>
+    create_axis_classes (bool only_direct_neghbors)
+    {
+      const auto& offset = create_offset_to_neighbors (3, only_direct_neghbors);
+
+      std::vector<std::vector<char>> result (offset.size ());
+
+      for (size_t k = 0; k < offset.size (); k++)
+        for (auto o : offset[k])
+          result[k].push_back (axes_of_offset (o) - 1);
+
+      return result;
+    }
+
+    // class of each neighbor in the offset tables. With diagonal_class
+    // direct neighbors are of class 0 and diagonal neighbors of class 1,
+    // otherwise all neighbors are of class 0.
+    std::vector<std::vector<char>>
+    create_neighbor_classes (const std::vector<std::vector<octave_idx_type>>& offset, bool diagonal_class)
+    {
+      if (diagonal_class)
+        {
+          return
+            {
+              {},
+              {0, 0, 1},
+              {0, 0, 1, 0, 1},
+              {0, 1, 0},
+              {0, 1, 0, 0, 1},
+              {1, 0, 1, 0, 0, 1, 0, 1},
+              {1, 0, 0, 1, 0},
+              {0, 1, 0},
+              {1, 0, 1, 0, 0},
+              {1, 0, 0}
+            };
+        }
+
+      std::vector<std::vector<char>> result (offset.size ());
+
+      for (size_t k = 0; k < offset.size (); k++)
+        result[k].assign (offset[k].size (), 0);
+
+      return result;
+    }
+
+    std::vector<std::vector<octave_idx_type>>
+    create_offset_to_neighbors(octave_idx_type dim1, bool only_direct_neghbors = false)
+    {
+      std::vector<std::vector<octave_idx_type>> offset_4
+        {
+          {},
+          {1,dim1},
+          {-1, 1, dim1},
+          {-1,dim1},
+          {-dim1, 1, dim1},
+          {-dim1, -1 , 1, dim1},
+          {-dim1,-1,dim1},
+          {-dim1, 1},
+          {-dim1,-1,1},
+          {-dim1,-1}
+        };
+
+      std::vector<std::vector<octave_idx_type>> offset_8
+        {
+          {},
+          {1,dim1,dim1+1},
+          {-1,1,dim1 -1, dim1 , dim1 +1},
+          {-1,dim1-1,dim1},
+          {-dim1,-dim1+1, 1, dim1, dim1 +1},
+          {-dim1 -1, -dim1, -dim1 +1, -1 , 1 , dim1-1, dim1 , dim1+1},
+          {-dim1-1,-dim1,-1,dim1-1,dim1},
+          {-dim1, -dim1 +1, 1},
+          {-dim1-1,-dim1,-dim1+1,-1,1},
+          {-dim1-1,-dim1,-1}
+        };
+
+      if (only_direct_neghbors)
+        {
+          return offset_4;
+        }
+      else
+        {
+          return offset_8;
+        }
+    }
+
+    // allocates the distances, idx, pred and the processed flags. The
+    // compact outputs reuse the arrays that a finished call on an image of
+    // the same size has kept, see keep_state
+    void
+    init_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      const dim_vector& dims = f.dims ();
+
+      auto& state = compact_state_slot<ResultType, IndexType, char> ();
+
+      if (output != output_type::full && state.dims == dims && ! state.inheap.empty ())
+        {
+          dist_mat = take_state_array (state.dist, dims, numeric_limits<T>::infinity ());
+
+          if (nargout >= 2)
+            idx_segment = take_state_array (state.segment, dims, typename IndexType::element_type (0));
+
+          if (nargout >= 3)
+            idx_predecessor = take_state_array (state.predecessor, dims, typename IndexType::element_type (0));
+
+          inheap = std::move (state.inheap);
+
+          state.inheap.clear ();
+
+          return;
+        }
+
+      dist_mat = ResultType (dims, numeric_limits<T>::infinity ());
+
+      if (f.numel () == 0)
+        return;
+
+      if (nargout >= 2)
+        idx_segment = IndexType (dims);
+
+      if (nargout >= 3)
+        idx_predecessor = IndexType (dims);
+
+      inheap = take_scratch<char> ();
+
+      inheap.assign (f.numel (), 5);
+
+      init_mask2D ();
+    }
+
+    // resets the points that the call has reached and keeps the arrays for
+    // the next call on an image of the same size
+    void
+    keep_state ()
+    {
+      using T = typename ResultType::element_type;
+
+      for (octave_idx_type p : settled)
+        {
+          dist_mat.xelem (p) = numeric_limits<T>::infinity ();
+
+          if (nargout >= 2)
+            idx_segment.xelem (p) = 0;
+
+          if (nargout >= 3)
+            idx_predecessor.xelem (p) = 0;
+
+          inheap[p] = position_class (p);
+        }
+
+      auto& state = compact_state_slot<ResultType, IndexType, char> ();
+
+      if (state.dims != f.dims ())
+        state = compact_state<ResultType, IndexType, char> ();
+
+      state.dims = f.dims ();
+
+      state.dist = dist_mat;
+
+      if (nargout >= 2)
+        state.segment = idx_segment;
+
+      if (nargout >= 3)
+        state.predecessor = idx_predecessor;
+
+      state.inheap = std::move (inheap);
+    }
+
+    // the value of inheap of a point that is not processed, as init_mask2D
+    // sets it from the position of the point at the border of the image
+    char
+    position_class (octave_idx_type i) const
+    {
+      const octave_idx_type dim1 = f.dim1 ();
+
+      const octave_idx_type dim2 = f.dim2 ();
+
+      if (dim1 == 1 || dim2 == 1)
+        return 5;
+
+      const octave_idx_type row = i % dim1;
+
+      const octave_idx_type col = i / dim1;
+
+      const int row_class = row == 0 ? 0 : row == dim1 - 1 ? 2 : 1;
+
+      const int col_class = col == 0 ? 0 : col == dim2 - 1 ? 2 : 1;
+
+      return 1 + 3 * col_class + row_class;
+    }
+
+    void
+    init_mask2D()
+    {
+      const octave_idx_type dim1 = f.dim1();
+
+      const octave_idx_type dim2 = f.dim2();
+
+      if (dim1 == 1 || dim2 == 1)
+        return;
+
+      inheap[0] = 1;
+
+      for (octave_idx_type i = 1; i < dim1 -1; i++)
+        inheap[i] = 2;
+
+      inheap[dim1-1] = 3;
+
+      for (octave_idx_type i = 1; i < dim2-1 ; i++)
+        inheap[i*dim1] = 4;
+
+      for (octave_idx_type i = 1; i < dim2 -1; i++)
+        inheap[i*dim1+dim1-1] = 6;
+
+      inheap[dim1*dim2-dim1] = 7;
+
+      for (octave_idx_type i = dim1*dim2-dim1+1; i < dim1*dim2 -1; i++)
+        inheap[i] = 8;
+
+      inheap[dim1*dim2 - 1] = 9;
+    }
+
+    template <typename Kernel, typename Counter>
+    void propagate1D (const Kernel& step, Counter& counter)
+    {
+      octave_idx_type n = f.numel ();
+
+      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
+        {
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          counter.pop ();
+
+          if (! inheap[u.first])
+            {
+              counter.stale_pop ();
+
+              continue;
+            }
+
+          inheap[u.first] = 0;
+
+          monitor.settle ();
+
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.first).value () - 1, u.first, u.second);
+
+          if (output != output_type::full)
+            settled.push_back (u.first);
+
+          const typename Kernel::key_type ku = step.key (f(u.first));
+
+          for (auto p : {-1, 1})
+            {
+              auto v = u.first + p;
+
+              if (v >= 0 && v < n && inheap[v])
+                {
+                  counter.relax ();
+
+                  typename ResultType::element_type alt = u.second + step (ku, step.key (f(v)), 0);
+
+                  if (alt < dist[v] && alt <= cutoff)
+                    {
+                      dist[v] = alt;
+
+                      if (nargout >= 2)
+                        {
+                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
+
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(v) = u.first + 1;
+                        }
+
+                      Q.push({v, alt});
+
+                      counter.improve (Q.size ());
+                    }
+                }
+            }
+        }
+    }
+
+    // improvement of a point of a neighboring tile
+    struct boundary_message
+    {
+      octave_idx_type target;
+      typename ResultType::element_type dist;
+      typename IndexType::element_type segment;
+      octave_idx_type predecessor;
+    };
+
+    template <typename Counter>
+    struct tile
+    {
+      // range of linear indexes of the points of the tile
+      octave_idx_type first = 0;
+      octave_idx_type last = 0;
+
+      std::priority_queue<element_type, std::vector<element_type>, PointCmp> queue;
+
+      // smallest distances that are sent to the columns on the left and on
+      // the right of the tile
+      std::vector<typename ResultType::element_type> sent[2];
+
+      // messages to the left and to the right tile of the current and of the
+      // previous round
+      std::vector<boundary_message> outbox[2][2];
+
+      Counter counter;
+
+      // points that the tile has processed, a point can be processed again
+      // in a later round
+      std::vector<octave_idx_type> reached;
+    };
+
+    octave_idx_type
+    tile_count () const
+    {
+      return std::min (threads, f.dim2 () / 8);
+    }
+
+    // the image is split into strips of columns that are processed in
+    // parallel. A strip sends the improved distances of the points of its
+    // neighbors to them and they are propagated in the next round, until no
+    // distance changes. Points can be processed again when their distance
+    // improves so the final distances are the same as in the serial
+    // propagation, for equal distances idx and pred can be different. The
+    // reached points are returned in increasing order when they are needed
+    // for the summary or the compact outputs.
+    template <typename Kernel, typename Counter>
+    std::vector<octave_idx_type> propagate2D_tiled (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      const octave_idx_type dim1 = f.dim1 ();
+
+      const octave_idx_type dim2 = f.dim2 ();
+
+      const octave_idx_type ntiles = tile_count ();
+
+      std::vector<tile<Counter>> tiles (ntiles);
+
+      for (octave_idx_type t = 0; t < ntiles; t++)
+        {
+          tiles[t].first = t * dim2 / ntiles * dim1;
+
+          tiles[t].last = (t + 1) * dim2 / ntiles * dim1;
+
+          for (auto& s : tiles[t].sent)
+            s.assign (dim1, numeric_limits<T>::infinity ());
+        }
+
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
+        {
+          const element_type u = Q.top ();
+
+          Q.pop ();
+
+          octave_idx_type t = u.first / dim1 * ntiles / dim2;
+
+          while (u.first < tiles[t].first)
+            t--;
+
+          while (u.first >= tiles[t].last)
+            t++;
+
+          tiles[t].queue.push (u);
+        }
+
+      T* dist = dist_mat.fortran_vec ();
+
+      typename IndexType::element_type* segment = nargout >= 2 ? idx_segment.fortran_vec () : nullptr;
+
+      typename IndexType::element_type* predecessor = nargout >= 3 ? idx_predecessor.fortran_vec () : nullptr;
+
+      parallel_workers workers (monitor);
+
+      for (int round = 0; ; round++)
+        {
+          workers.run (ntiles, [&] (octave_idx_type t)
+            {
+              propagate_tile (step, offset, neighbor_class, tiles, t, round, dist, segment, predecessor, workers);
+            });
+
+          OCTAVE_QUIT;
+
+          bool changed = false;
+
+          for (const auto& tl : tiles)
+            for (const auto& out : tl.outbox[round % 2])
+              changed = changed || ! out.empty ();
+
+          if (! changed)
+            break;
+        }
+
+      std::vector<octave_idx_type> reached;
+
+      for (const auto& tl : tiles)
+        {
+          counter.merge (tl.counter);
+
+          reached.insert (reached.end (), tl.reached.begin (), tl.reached.end ());
+        }
+
+      std::sort (reached.begin (), reached.end ());
+
+      reached.erase (std::unique (reached.begin (), reached.end ()), reached.end ());
+
+      return reached;
+    }
+
+    template <typename Kernel, typename Counter>
+    void propagate_tile (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, std::vector<tile<Counter>>& tiles, octave_idx_type t, int round, typename ResultType::element_type* dist, typename IndexType::element_type* segment, typename IndexType::element_type* predecessor, parallel_workers& workers)
+    {
+      using T = typename ResultType::element_type;
+
+      tile<Counter>& own = tiles[t];
+
+      const ImageType& img = f;
+      auto& out = own.outbox[round % 2];
+
+      out[0].clear ();
+
+      out[1].clear ();
+
+      auto receive = [&] (const std::vector<boundary_message>& messages)
+        {
+          for (const auto& m : messages)
+            if (m.dist < dist[m.target])
+              {
+                dist[m.target] = m.dist;
+
+                if (nargout >= 2)
+                  {
+                    segment[m.target] = m.segment;
+
+                    if (nargout >= 3)
+                      predecessor[m.target] = m.predecessor;
+                  }
+
+                own.queue.push ({m.target, m.dist});
+
+                own.counter.improve (own.queue.size ());
+              }
+        };
+
+      if (round > 0)
+        {
+          if (t > 0)
+            receive (tiles[t-1].outbox[(round - 1) % 2][1]);
+
+          if (t + 1 < static_cast<octave_idx_type> (tiles.size ()))
+            receive (tiles[t+1].outbox[(round - 1) % 2][0]);
+        }
+
+      const octave_idx_type dim1 = f.dim1 ();
+
+      // points processed since the last count that was given to the workers
+      octave_idx_type pending = 0;
+
+      while (! own.queue.empty ())
+        {
+          auto u = own.queue.top ();
+
+          own.queue.pop ();
+
+          own.counter.pop ();
+
+          if (u.second > dist[u.first])
+            {
+              own.counter.stale_pop ();
+
+              continue;
+            }
+
+          if (want_summary || output != output_type::full)
+            own.reached.push_back (u.first);
+
+          if (++pending == workers.batch ())
+            {
+              pending = 0;
+
+              if (! workers.processed_points (workers.batch ()))
+                return;
+            }
+
+          // inheap only holds the position of the points in this mode
+          const auto& neighbor_idx = offset[inheap[u.first]];
+
+          const auto& cls = neighbor_class[inheap[u.first]];
+
+          const typename Kernel::key_type ku = step.key (img (u.first));
+
+          for (size_t i = 0 ; i < neighbor_idx.size(); i++)
+            {
+              octave_idx_type v = u.first + neighbor_idx[i];
+
+              own.counter.relax ();
+
+              const T alt = u.second + step (ku, step.key (img (v)), cls[i]);
+
+              if (v >= own.first && v < own.last)
+                {
+                  if (alt < dist[v] && alt <= cutoff)
+                    {
+                      dist[v] = alt;
+
+                      if (nargout >= 2)
+                        {
+                          segment[v] = segment[u.first];
+
+                          if (nargout >= 3)
+                            predecessor[v] = u.first + 1;
+                        }
+
+                      own.queue.push ({v, alt});
+
+                      own.counter.improve (own.queue.size ());
+                    }
+                }
+              else
+                {
+                  const int side = v < own.first ? 0 : 1;
+
+                  T& sent = own.sent[side][v % dim1];
+
+                  if (alt < sent && alt <= cutoff)
+                    {
+                      sent = alt;
+
+                      out[side].push_back ({v, alt, nargout >= 2 ? segment[u.first] : typename IndexType::element_type (), u.first + 1});
+                    }
+                }
+            }
+        }
+
+      workers.processed_points (pending);
+    }
+
+    template <typename Kernel, typename Counter>
+    void propagate2D (const Kernel& step, const std::vector<std::vector<octave_idx_type>>& offset, const std::vector<std::vector<char>>& neighbor_class, Counter& counter)
+    {
+      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+      if (tile_count () > 1)
+        {
+          std::vector<octave_idx_type> reached = propagate2D_tiled (step, offset, neighbor_class, counter);
+
+          if (want_summary)
+            summary.collect (dist_mat, idx_segment, reached);
+
+          if (output != output_type::full)
+            settled = std::move (reached);
+
+          return;
+        }
+
+
+      counter.start (Q.size ());
+
+      while (! Q.empty ())
+        {
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          counter.pop ();
+
+          auto idx_to_w = inheap[u.first];
+
+          if (! idx_to_w)
+            {
+              counter.stale_pop ();
+
+              continue;
+            }
+
+          inheap[u.first] = 0;
+
+          monitor.settle ();
+
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.first).value () - 1, u.first, u.second);
+
+          if (output != output_type::full)
+            settled.push_back (u.first);
+
+          const auto& neighbor_idx = offset[idx_to_w];
+
+          const auto& cls = neighbor_class[idx_to_w];
+
+          const typename Kernel::key_type ku = step.key (f(u.first));
+
+          for (size_t i = 0 ; i < neighbor_idx.size(); i++)
+            {
+              octave_idx_type v = u.first + neighbor_idx[i];
+
+              if (inheap[v])
+                {
+                  counter.relax ();
+
+                  typename ResultType::element_type alt = u.second + step (ku, step.key (f(v)), cls[i]);
+
+                  if (alt < dist[v] && alt <= cutoff)
+                    {
+                      dist[v] = alt;
+
+                      if (nargout >= 2)
+                        {
+                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
+
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(v) = u.first + 1;
+                        }
+
+                      Q.push({v, alt});
+
+                      counter.improve (Q.size ());
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Counter>
+    void do_graydist1D (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      using image_elem = typename ImageType::element_type;
+
+      const std::vector<T> weights {static_cast<T> (.5 * (spacing.empty () ? 1 : spacing[0]))};
+
+      if (use_pair_table<image_elem> (f.numel (), 2, weights.size ()))
+        propagate1D (pair_table_cost<T, gray_step<T>> (cost, weights, image_elem ()), counter);
+      else
+        propagate1D (level_cost<T, gray_step<T>> (cost, weights), counter);
+    }
+
+    template <typename Counter>
+    void do_graydist2D (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
+
+      using image_elem = typename ImageType::element_type;
+
+      const octave_idx_type dim1 = f.dim1();
+
+      bool only_direct_neghbors = method == distance_type::cityblock;
+
+      bool quasi = method == distance_type::quasieuclidean;
+
+      const auto& offset = create_offset_to_neighbors (dim1, only_direct_neghbors);
+
+      const auto& neighbor_class = spacing.empty ()
+                                   ? create_neighbor_classes (offset, quasi)
+                                   : create_axis_classes (only_direct_neghbors);
+
+      const std::vector<T> weights = ! spacing.empty ()
+                                     ? axis_weights<T> (spacing, [&] (int mask) { return .5 * step_length (mask, spacing, quasi); })
+                                     : quasi
+                                     ? std::vector<T> {static_cast<T> (.5), static_cast<T> (sqrt (.5))}
+                                     : std::vector<T> {static_cast<T> (.5)};
+
+      if (use_pair_table<image_elem> (f.numel (), only_direct_neghbors ? 4 : 8, weights.size ()))
+        propagate2D (pair_table_cost<T, gray_step<T>> (cost, weights, image_elem ()), offset, neighbor_class, counter);
+      else
+        propagate2D (level_cost<T, gray_step<T>> (cost, weights), offset, neighbor_class, counter);
+    }
+
+    template <typename Counter>
+    void do_graydist(Counter& counter)
+    {
+      const octave_idx_type dim1 = f.dim1();
+
+      const octave_idx_type dim2 = f.dim2();
+
+      if (dim1 == 1 || dim2 == 1)
+        {
+           do_graydist1D (counter);
+        }
+      else
+        {
+           do_graydist2D (counter);
+        }
+    }
+
+    void run ()
+    {
+      const auto start = std::chrono::steady_clock::now ();
+
+      if (want_summary)
+        {
+          std::vector<octave_idx_type> seeds;
+
+          for (const auto& e : Q.storage ())
+            seeds.push_back (e.first);
+
+          summary.start (std::move (seeds));
+        }
+
+      monitor.start (f.numel ());
+
+      if (collect_stats)
+        do_graydist (stats);
+      else
+        {
+          no_stats counter;
+
+          do_graydist (counter);
+        }
+
+      stats.propagation_time = elapsed (start);
+
+      monitor.finish ();
+
+      finished = true;
+    }
+
+    ImageType f;
+
+    cost_transform<typename ResultType::element_type> cost;
+
+    const int nargout;
+
+    const bool collect_stats;
+
+    propagation_stats stats;
+
+    propagation_monitor monitor;
+
+    const octave_idx_type threads;
+
+    const std::vector<double> spacing;
+
+    const bool want_summary;
+
+    region_summary<ResultType> summary;
+
+    // the neighbors are only improved up to this distance
+    const typename ResultType::element_type cutoff;
+
+    const output_type output;
+
+    // the points in the order they are settled for the compact outputs
+    std::vector<octave_idx_type> settled;
+
+    // the propagation has completed, so the state can be kept for the next
+    // call
+    bool finished = false;
+
+    ResultType dist_mat;
+
+    IndexType idx_segment;
+
+    IndexType idx_predecessor;
+
+    scratch_queue<element_type, PointCmp> Q;
+
+    std::vector<char> inheap;
+
+    distance_type method;
+  };
+
+  template <typename ResultType, typename  IndexType, typename ImageType>
+  class GrayDistND
+  {
+  public:
+    using queue_elem_type = nd_queue_elem<typename ResultType::element_type>;
+
+    struct PointCmpND
+    {
+      PointCmpND ()  {}
+
+      bool operator()(const queue_elem_type& a , const queue_elem_type& b ) const
+      {return a.imageval > b.imageval;}
+    };
 
-    GrayDist2D (const ImageType& image, int nargout, const boolNDArray & mask, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    GrayDistND (const ImageType& image, int nargout, const options& opt, const boolNDArray & mask, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
 
-      if (image.numel () != 0)
-        {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+      f = image;
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+      init_state ();
 
-          f = image;
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (mask);
-          do_graydist();
-
+          stats.initialization_time = elapsed (start);
+          run ();
         }
 
     }
-
-    GrayDist2D (const ImageType& image, int nargout, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    GrayDistND (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
 
-      if (image.numel () != 0)
-        {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+      f = image;
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+      init_state ();
 
-          f = image;
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (C , R);
-          do_graydist();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
-    GrayDist2D (const ImageType& image, int nargout, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
+    GrayDistND (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
+    : f(), nargout (nargout), collect_stats (opt.stats), monitor (opt), spacing (opt.spacing), radius (opt.neighborhood / 2), want_summary (opt.summary), cutoff (opt.max_distance), output (opt.output)
     {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+      const auto start = std::chrono::steady_clock::now ();
 
-      if (image.numel () != 0)
-        {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+      f = image;
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+      init_state ();
 
-          f = image;
+      if (image.numel () != 0)
+        {
+          cost = cost_transform<typename ResultType::element_type> (opt, image);
           init_method (method);
-          inheap = std::vector<char>  (image.numel (), (char)5);
-          init_mask2D();
           initialize_from_seed (ind);
-          do_graydist();
+          stats.initialization_time = elapsed (start);
+          run ();
         }
     }
 
+    ~GrayDistND ()
+    {
+      if (finished && output != output_type::full)
+        keep_state ();
+      else
+        give_back_scratch (std::move (inheap));
+
+      give_back_scratch (Q.storage ());
+    }
+
     const ResultType&
     value () const
     {
@@ -141,20 +2622,93 @@ namespace image
     octave_value_list
     get_result ()
     {
+      if (output != output_type::full)
+        return compact_result (output, dist_mat, idx_segment, idx_predecessor, nargout, settled);
+
       return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
     }
 
+    octave_scalar_map
+    get_summary () const
+    {
+      return summary.get ();
+    }
+
+    octave_scalar_map
+    get_info (double conversion_time) const
+    {
+      octave_scalar_map bytes;
+
+      bytes.assign ("distance", static_cast<double> (dist_mat.numel () * sizeof (typename ResultType::element_type)));
+      bytes.assign ("inheap", static_cast<double> ((inheap.size () + 7) / 8));
+      bytes.assign ("idx", static_cast<double> (idx_segment.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("pred", static_cast<double> (idx_predecessor.numel () * sizeof (typename IndexType::element_type)));
+      bytes.assign ("queue", static_cast<double> (stats.max_queue_size * sizeof (queue_elem_type)));
+
+      octave_scalar_map time;
+
+      time.assign ("conversion", conversion_time);
+      time.assign ("initialization", stats.initialization_time);
+      time.assign ("propagation", stats.propagation_time);
+
+      octave_scalar_map info;
+
+      info.assign ("pushes", static_cast<double> (stats.pushes));
+      info.assign ("pops", static_cast<double> (stats.pops));
+      info.assign ("stale_pops", static_cast<double> (stats.stale_pops));
+      info.assign ("relaxations", static_cast<double> (stats.relaxations));
+      info.assign ("improvements", static_cast<double> (stats.improvements));
+      info.assign ("max_queue_size", static_cast<double> (stats.max_queue_size));
+      info.assign ("bytes", bytes);
+      info.assign ("time", time);
+
+      return info;
+    }
+
   private:
 
-    struct PointCmp
+    octave_idx_type
+    image_to_mask_index (octave_idx_type idximg, const std::vector<octave_idx_type>& cumimgdim, const std::vector<octave_idx_type>& cummskdim, octave_idx_type sumcummask)
     {
-      PointCmp ()  {}
+      octave_idx_type idxmsk = 0;
 
-      bool operator()(const element_type& a , const element_type& b ) const
-      {return a.second > b.second;}
-    };
+      for (octave_idx_type n = (octave_idx_type)(cumimgdim.size ())-2; n >= 0; n--)
+        {
+          idxmsk += idximg / cumimgdim[n] * cummskdim[n];
 
-    void init_method (const std::string& method)
+          idximg %= cumimgdim[n];
+        }
+
+      return idxmsk + idximg + radius * (sumcummask + 1);
+    }
+
+    std::tuple<std::vector <octave_idx_type>,std::vector <octave_idx_type>, octave_idx_type>
+    create_cumulative_dims(const dim_vector& dimimg, const dim_vector& dimmsk)
+    {
+      std::vector <octave_idx_type> cumdimimg(dimimg.length());
+
+      std::vector <octave_idx_type> cumdimmsk(dimimg.length());
+
+      octave_idx_type sumcummask = 0;
+
+      cumdimimg[0] = dimimg.xelem(0);
+
+      cumdimmsk[0] = dimmsk.xelem(0);
+
+      for (size_t i = 1 ; i < cumdimimg.size(); i++)
+        {
+            cumdimimg[i] = dimimg.xelem(i)*cumdimimg[i-1];
+
+            cumdimmsk[i] = dimmsk.xelem(i)*cumdimmsk[i-1];
+
+            sumcummask += cumdimmsk[i-1];
+        }
+
+      return {cumdimimg, cumdimmsk, sumcummask};
+    }
+
+    void
+    init_method (const std::string& method)
     {
       if (method == "chessboard")
         {
@@ -177,17 +2731,16 @@ namespace image
     void
     initialize_from_seed (const Array<octave_idx_type>& ind)
     {
-      std::vector<element_type> cache;
+      const dim_vector& dim = f.dims();
 
-      if (f.dim1 () == 1 || f.dim2 () == 1)
-        {
-          cache.reserve(ind.numel ()*2);
-        }
-      else
-        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
-      {PointCmp{}, std::move(cache)};
+      cache.reserve(dim.numel() - (dim+(-2)).numel());
+
+       Q = scratch_queue<queue_elem_type, PointCmpND>
+         {PointCmpND{}, std::move(cache)};
+
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
 
       try
         {
@@ -195,1037 +2748,1292 @@ namespace image
             {
               dist_mat.checkelem(ind(i)-1) = 0;
 
-              if (nargout >= 2)
-                {
-                  idx_segment.xelem(ind(i)-1) = ind(i);
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(ind(i)-1) = ind(i);
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(ind(i)-1) = 0;
+                }
+
+              Q.push({image_to_mask_index (ind(i)-1,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), ind(i)-1, 0});
+            }
+        }
+      catch (...)
+        {
+          error ("out of range seed values");
+        }
+    }
+
+    void
+    initialize_from_seed (const Array<octave_idx_type>& C, const Array<octave_idx_type>& R)
+    {
+      if (C.numel () != R.numel ())
+        error ("C and R should have equal sizes");
+
+      const dim_vector& dim = f.dims();
+
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
+
+      cache.reserve(dim.numel() - (dim+(-2)).numel());
+
+       Q = scratch_queue<queue_elem_type, PointCmpND>
+         {PointCmpND{}, std::move(cache)};
+
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
+
+      try
+        {
+          for (octave_idx_type i = 0; i < C.numel () ; i++)
+            {
+              octave_idx_type ind = ::compute_index (R.xelem(i)-1, C.xelem(i)-1 , dim);
+
+              dist_mat(ind) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(ind) = ind + 1;
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(ind) = 0;
+                }
+
+              Q.push({image_to_mask_index (ind,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), ind, 0});
+            }
+        }
+      catch (...)
+        {
+          error ("out of range seed values");
+        }
+    }
+
+    void
+    initialize_from_seed (const boolNDArray& mask)
+    {
+      if (mask.numel () != f.numel ())
+        error ("mask and I should have equal sizes");
+
+      const dim_vector& dim = f.dims();
+
+      std::vector<queue_elem_type> cache = take_scratch<queue_elem_type> ();
+
+      cache.reserve(dim.numel() - (dim+(-2)).numel());
+
+      Q = scratch_queue<queue_elem_type, PointCmpND>
+         {PointCmpND{}, std::move(cache)};
+
+      auto cum = create_cumulative_dims(dim, dim + 2 * radius);
+
+      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+        {
+          if (mask.xelem(i))
+            {
+              dist_mat(i) = 0;
+
+              if (nargout >= 2)
+                {
+                  idx_segment.xelem(i) = i + 1;
+
+                  if (nargout >= 3)
+                    idx_predecessor.xelem(i) = 0;
+                }
+              Q.push({image_to_mask_index (i,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), i, 0});
+            }
+        }
+    }
+
+    // offsets of the neighbors of the chamfer neighborhood in the mask and in
+    // the image. Neighbors with the same spatial length are in the same
+    // class, the squared length of each class is returned.
+    std::vector<double>
+    create_chamfer_neighbors (std::vector<octave_idx_type>& mask_neighbor_idx, std::vector<octave_idx_type>& image_neighbor_idx, std::vector<char>& neighbor_class)
+    {
+      const dim_vector& dims = f.dims ();
+
+      const dim_vector mask_dims = dims + 2 * radius;
+
+      std::vector<double> squared_lengths;
+
+      for (const auto& step : chamfer_steps (dims.ndims ()))
+        {
+          octave_idx_type mask_offset = 0;
+
+          octave_idx_type image_offset = 0;
+
+          octave_idx_type mask_stride = 1;
+
+          octave_idx_type image_stride = 1;
+
+          double squared_length = 0;
+
+          for (int k = 0; k < dims.ndims (); k++)
+            {
+              mask_offset += step[k] * mask_stride;
+
+              image_offset += step[k] * image_stride;
+
+              mask_stride *= mask_dims(k);
+
+              image_stride *= dims(k);
+
+              const double length = step[k] * (spacing.empty () ? 1 : spacing[k]);
+
+              squared_length += length * length;
+            }
+
+          auto cls = std::find (squared_lengths.begin (), squared_lengths.end (), squared_length) - squared_lengths.begin ();
+
+          if (cls == static_cast<octave_idx_type> (squared_lengths.size ()))
+            {
+              if (cls > std::numeric_limits<char>::max ())
+                error ("too many neighbor classes for Neighborhood 5");
+
+              squared_lengths.push_back (squared_length);
+            }
+
+          mask_neighbor_idx.push_back (mask_offset);
+
+          image_neighbor_idx.push_back (image_offset);
+
+          neighbor_class.push_back (cls);
+        }
+
+      return squared_lengths;
+    }
+
+    // class of each neighbor from the axes in which it differs from the
+    // center, used with anisotropic spacing
+    std::vector<char>
+    create_axis_classes (bool only_direct_neghbors)
+    {
+      if (f.ndims () > 7)
+        error ("graydist: Spacing can only be used with images of up to 7 dimensions");
+
+      dim_vector dims = f.dims ();
+
+      for (int k = 0; k < dims.ndims (); k++)
+        dims(k) = 3;
+
+      const auto& offset = create_offset_to_neighbors (dims, only_direct_neghbors);
+
+      std::vector<char> result;
+
+      for (auto o : offset)
+        result.push_back (axes_of_offset (o) - 1);
+
+      return result;
+    }
+
+    // class of each neighbor in the offset table. With distance_class the
+    // class is the number of coordinates in which the neighbor differs from
+    // the center minus one, otherwise all neighbors are of class 0.
+    std::vector<char>
+    create_neighbor_classes (const dim_vector& array_dims, octave_idx_type nneighbors, bool distance_class)
+    {
+      if (! distance_class)
+        return std::vector<char> (nneighbors, 0);
+
+      MArray<octave_idx_type> start(dim_vector(3,1));
+
+      start(0) = 1;
+
+      start(1) = 0;
+
+      start(2) = 1;
+
+      auto dist = start;
+
+      for (int i = 2; i <= array_dims.length (); i++)
+        {
+          dim_vector shpsz = dim_vector::alloc(i);
+
+          for (int j = 0; j < i-1; j++)
+            shpsz(j) = 1;
+
+          shpsz(i-1) = 3;
+
+          dist = dist + start.reshape(shpsz);
+        }
+
+      const octave_idx_type result_size = pow(3,array_dims.length());
+
+      std::vector<char> cls (result_size-1);
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(ind(i)-1) = 0;
-                }
+      octave_idx_type s = 0;
 
-              Q.push({ind(i)-1, 0});
-            }
-        }
-      catch (...)
+      for (int j = 0; j < result_size; j++)
         {
-          error ("out of range seed values");
+          if (j != result_size/2)
+            cls[s++] = dist(j) - 1;
         }
+
+      return cls;
     }
 
-    void
-    initialize_from_seed (const Array<octave_idx_type>& C, const Array<octave_idx_type>& R)
+    std::vector<octave_idx_type>
+    create_offset_to_neighbors(const dim_vector& dim, bool only_direct_neghbors = false)
     {
-      if (C.numel () != R.numel ())
-        error ("C and R should have equal sizes");
-
-      std::vector<element_type> cache;
+      octave_idx_type result_size;
 
-      if (f.dim1 () == 1 || f.dim2 () == 1)
-        {
-          cache.reserve(C.numel () * 2);
-        }
+      if (only_direct_neghbors)
+        result_size = dim.length() * 2;
       else
-        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+        result_size = pow (3, dim.length ())-1;
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
-      {PointCmp{}, std::move(cache)};
+      Array<octave_idx_type> idx (dim_vector (1, dim.length ()), 1);
 
-      const dim_vector& dim = f.dims();
+      std::vector<octave_idx_type> offset (result_size);
 
-      try
-        {
-          for (octave_idx_type i = 0; i < C.numel () ; i++)
-            {
-              octave_idx_type ind = ::compute_index (R.xelem(i)-1, C.xelem(i)-1 , dim);
+      octave_idx_type center_idx = compute_index (idx, dim);
 
-              dist_mat(ind) = 0;
+      if (only_direct_neghbors)
+        {
+          octave_idx_type k = 0;
 
-              if (nargout >= 2)
+          for (int i = 0; i < dim.length (); i++)
+            {
+              for (int j : {0, 2})
                 {
-                  idx_segment.xelem(ind) = ind + 1;
+                  idx(i) = j;
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(ind) = 0;
+                  offset[k++] = compute_index (idx,dim) - center_idx;
                 }
 
-              Q.push({ind, 0});
+              idx(i) = 1;
             }
         }
-      catch (...)
+      else
         {
-          error ("out of range seed values");
+          idx.fill(0);
+
+          octave_idx_type k = 0;
+
+          offset[k++] = -center_idx;
+
+          for (int j = 1; j <= result_size; j++)
+            {
+              for (int i = 0; i < dim.length (); i++)
+                {
+                  if (++idx.xelem (i) == 3)
+                    {
+                      idx.xelem (i) = 0;
+                    }
+                  else
+                    {
+                      break;
+                    }
+                }
+
+              if (j != (result_size+1)/2)
+                offset[k++] = compute_index (idx,dim) - center_idx;
+            }
         }
+
+      return offset;
     }
 
+    // allocates the distances, idx, pred and the processed flags. The
+    // compact outputs reuse the arrays that a finished call on an image of
+    // the same size and with the same padding has kept, see keep_state
     void
-    initialize_from_seed (const boolNDArray& mask)
+    init_state ()
     {
-      if (mask.numel () != f.numel ())
-        error ("mask and I should have equal sizes");
+      using T = typename ResultType::element_type;
 
+      const dim_vector& dims = f.dims ();
 
-      std::vector<element_type> cache;
+      auto& state = compact_state_slot<ResultType, IndexType, bool> ();
 
-      if (f.dim1 () == 1 || f.dim2 () == 1)
+      if (output != output_type::full && state.dims == dims && state.layout == radius && ! state.inheap.empty ())
         {
-          octave_idx_type nseed = 0;
+          dist_mat = take_state_array (state.dist, dims, numeric_limits<T>::infinity ());
 
-          for (octave_idx_type i = 0; i < mask.numel () ; i++)
-            if (mask.xelem(i))
-              ++nseed;
+          if (nargout >= 2)
+            idx_segment = take_state_array (state.segment, dims, typename IndexType::element_type (0));
 
-          cache.reserve(nseed * 2);
-        }
-      else
-        cache.reserve((f.dim1 () + f.dim2 ()) * 2);
+          if (nargout >= 3)
+            idx_predecessor = take_state_array (state.predecessor, dims, typename IndexType::element_type (0));
 
-      Q = std::priority_queue<element_type, std::vector<element_type>, PointCmp>
-      {PointCmp{}, std::move(cache)};
+          inheap = std::move (state.inheap);
 
-      for (octave_idx_type i = 0; i < mask.numel () ; i++)
-        {
-          if (mask.xelem(i))
-            {
-              dist_mat(i) = 0;
+          state.inheap.clear ();
 
-              if (nargout >= 2)
-                {
-                  idx_segment.xelem(i) = i + 1;
+          return;
+        }
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(i) = 0;
-                }
+      dist_mat = ResultType (dims, numeric_limits<T>::infinity ());
 
-              Q.push({i, 0});
-            }
-        }
-    }
+      if (f.numel () == 0)
+        return;
 
-    template<typename T>
-    const std::vector<std::vector<T>>&
-    create_quasi_euclidean_chamfer_weights() const
-    {
-      static const T h {.5};
-      static const T sq2 {sqrt(.5)};
-      static const std::vector<std::vector<T>> weight_quasi
-        {
-          {},
-            {h,   sq2, h},
-            {h,   h,   sq2, h,   sq2},
-            {h,   sq2, h},
-            {h,   sq2, h,   h,   sq2},
-            {sq2, h,   sq2, h,   h,  sq2, h, sq2},
-            {sq2, h,   h,   sq2, h},
-            {h,   sq2, h},
-            {sq2, h,   sq2, h,   h},
-            {sq2, h,   h}
+      if (nargout >= 2)
+        idx_segment = IndexType (dims);
 
-        };
-      return weight_quasi;
+      if (nargout >= 3)
+        idx_predecessor = IndexType (dims);
+
+      inheap = create_zero_padded_maskND (dims);
     }
 
-    std::vector<std::vector<octave_idx_type>>
-    create_offset_to_neighbors(octave_idx_type dim1, bool only_direct_neghbors = false)
+    // resets the points that the call has reached and keeps the arrays for
+    // the next call on an image of the same size
+    void
+    keep_state ()
     {
-      std::vector<std::vector<octave_idx_type>> offset_4
-        {
-          {},
-          {1,dim1},
-          {-1, 1, dim1},
-          {-1,dim1},
-          {-dim1, 1, dim1},
-          {-dim1, -1 , 1, dim1},
-          {-dim1,-1,dim1},
-          {-dim1, 1},
-          {-dim1,-1,1},
-          {-dim1,-1}
-        };
+      using T = typename ResultType::element_type;
 
-      std::vector<std::vector<octave_idx_type>> offset_8
+      for (size_t k = 0; k < settled.size (); k++)
         {
-          {},
-          {1,dim1,dim1+1},
-          {-1,1,dim1 -1, dim1 , dim1 +1},
-          {-1,dim1-1,dim1},
-          {-dim1,-dim1+1, 1, dim1, dim1 +1},
-          {-dim1 -1, -dim1, -dim1 +1, -1 , 1 , dim1-1, dim1 , dim1+1},
-          {-dim1-1,-dim1,-1,dim1-1,dim1},
-          {-dim1, -dim1 +1, 1},
-          {-dim1-1,-dim1,-dim1+1,-1,1},
-          {-dim1-1,-dim1,-1}
-        };
+          const octave_idx_type p = settled[k];
 
-      if (only_direct_neghbors)
-        {
-          return offset_4;
-        }
-      else
-        {
-          return offset_8;
-        }
-    }
+          dist_mat.xelem (p) = numeric_limits<T>::infinity ();
 
-    void
-    init_mask2D()
-    {
-      const octave_idx_type dim1 = f.dim1();
+          if (nargout >= 2)
+            idx_segment.xelem (p) = 0;
 
-      const octave_idx_type dim2 = f.dim2();
+          if (nargout >= 3)
+            idx_predecessor.xelem (p) = 0;
 
-      if (dim1 == 1 || dim2 == 1)
-        return;
+          inheap[settled_mask[k]] = true;
+        }
 
-      inheap[0] = 1;
+      auto& state = compact_state_slot<ResultType, IndexType, bool> ();
 
-      for (octave_idx_type i = 1; i < dim1 -1; i++)
-        inheap[i] = 2;
+      if (state.dims != f.dims () || state.layout != radius)
+        state = compact_state<ResultType, IndexType, bool> ();
 
-      inheap[dim1-1] = 3;
+      state.dims = f.dims ();
 
-      for (octave_idx_type i = 1; i < dim2-1 ; i++)
-        inheap[i*dim1] = 4;
+      state.layout = radius;
 
-      for (octave_idx_type i = 1; i < dim2 -1; i++)
-        inheap[i*dim1+dim1-1] = 6;
+      state.dist = dist_mat;
 
-      inheap[dim1*dim2-dim1] = 7;
+      if (nargout >= 2)
+        state.segment = idx_segment;
 
-      for (octave_idx_type i = dim1*dim2-dim1+1; i < dim1*dim2 -1; i++)
-        inheap[i] = 8;
+      if (nargout >= 3)
+        state.predecessor = idx_predecessor;
 
-      inheap[dim1*dim2 - 1] = 9;
+      state.inheap = std::move (inheap);
     }
 
-    void do_graydist1D ()
+    std::vector<bool>
+    create_zero_padded_maskND( dim_vector dims)
     {
-      octave_idx_type n = f.numel ();
-
-      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+      // zero padded mask to handle boundary pixels
+      octave_idx_type size = 1;
 
-      while (! Q.empty ())
+      for (int i = 0 ;i < dims.length (); i++)
         {
-          auto u = Q.top ();
+          dims(i) += 2 * radius;
 
-          Q.pop ();
+          size *= dims(i);
+        }
 
-          if (! inheap[u.first])
-            {
-              continue;
-            }
+      std::vector<bool> result = take_scratch<bool> ();
 
-          inheap[u.first] = 0;
+      result.assign (size, true);
 
-          typename ResultType::element_type fu = f(u.first);
+      std::vector<std::pair<octave_idx_type,octave_idx_type>> bounds;
 
-          for (auto p : {-1, 1})
+      Array<octave_idx_type> indexes(dim_vector(1,dims.length()));
+
+      bounds.reserve(dims.length());
+
+      for (octave_idx_type i = 0 ;i < dims.length(); i++)
+        {
+          bounds.emplace_back (0, dims(i));
+        }
+
+      octave_idx_type sz = size;
+
+      for (octave_idx_type k = 0 ;k < dims.length(); k++)
+        {
+          sz = sz/dims(k);
+          for (octave_idx_type r = 0; r < 2 * radius; r++)
             {
-              auto v = u.first + p;
+              const octave_idx_type pad = r < radius ? r + 1 : dims(k) - 2 * radius + r + 1;
 
-              if (v >= 0 && v < n && inheap[v])
+              bounds[k] = {pad-1, pad};
+
+              for (octave_idx_type s = 0 ;s < dims.length(); s++)
                 {
-                  typename ResultType::element_type alt = u.second + static_cast<typename ResultType::element_type>(0.5) * (fu + static_cast<typename ResultType::element_type>(f(v)));
+                  indexes.xelem(s)=bounds[s].first;
+                }
 
-                  if (alt < dist[v])
-                    {
-                      dist[v] = alt;
+              result[compute_index(indexes,dims)] = false;
 
-                      if (nargout >= 2)
+              for (octave_idx_type j = 1 ; j < sz; j++)
+                {
+                  for (int i = 0; i < dims.length(); i++)
+                    {
+                      if (++indexes.xelem(i) == bounds[i].second)
                         {
-                          idx_segment.xelem(v) = idx_segment.xelem(u.first);
-
-                          if (nargout == 3)
-                            idx_predecessor.xelem(v) = u.first + 1;
+                          indexes.xelem(i) = bounds[i].first;
+                        }
+                      else
+                        {
+                          break;
                         }
-
-                      Q.push({v, alt});
                     }
+
+                  result[compute_index(indexes,dims)] = false;
                 }
             }
+          sz = sz*(dims(k) - 2 * radius);
+
+          bounds[k] = {radius, dims(k) - radius};
         }
+
+      return result;
     }
 
-    void do_graydist2D ()
+    template <typename Kernel, typename Counter>
+    void
+    propagateND (const Kernel& step, const std::vector<octave_idx_type>& mask_neighbor_idx, const std::vector<octave_idx_type>& image_neighbor_idx, const std::vector<char>& neighbor_class, Counter& counter)
     {
-      const octave_idx_type dim1 = f.dim1();
-
       typename ResultType::element_type* dist = dist_mat.fortran_vec ();
 
-      bool only_direct_neghbors = method == distance_type::cityblock;
-
-      const auto& offset = create_offset_to_neighbors (dim1, only_direct_neghbors);
+      counter.start (Q.size ());
 
-      if (method == distance_type::chessboard || method == distance_type::cityblock)
+      while (! Q.empty ())
         {
-          while (! Q.empty ())
+          auto u = Q.top ();
+
+          Q.pop ();
+
+          counter.pop ();
+
+          if (! inheap[u.maskindex])
             {
-              auto u = Q.top ();
+              counter.stale_pop ();
+
+              continue;
+            }
+
+          inheap[u.maskindex] = 0;
 
-              Q.pop ();
+          monitor.settle ();
 
-              auto idx_to_w = inheap[u.first];
+          if (want_summary)
+            summary.add (idx_segment.xelem (u.imageindex).value () - 1, u.imageindex, u.imageval);
 
-              if (! idx_to_w)
-                {
-                  continue;
-                }
+          if (output != output_type::full)
+            {
+              settled.push_back (u.imageindex);
 
-              inheap[u.first] = 0;
+              settled_mask.push_back (u.maskindex);
+            }
 
-              const auto& neighbor_idx = offset[idx_to_w];
+          const typename Kernel::key_type ku = step.key (f(u.imageindex));
 
-              typename ResultType::element_type fu = f(u.first);
+          for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
+            {
+              auto vmask = u.maskindex + mask_neighbor_idx[i];
 
-              for (size_t i = 0 ; i < neighbor_idx.size(); i++)
+              if (inheap[vmask])
                 {
-                  octave_idx_type v = u.first + neighbor_idx[i];
+                  counter.relax ();
+
+                  auto vimage = u.imageindex + image_neighbor_idx[i];
 
-                  if (inheap[v])
+                  typename ResultType::element_type alt = u.imageval + step (ku, step.key (f(vimage)), neighbor_class[i]);
+
+                  if (alt < dist[vimage] && alt <= cutoff)
                     {
-                      typename ResultType::element_type alt = u.second + static_cast<typename ResultType::element_type>(0.5) * (fu + static_cast<typename ResultType::element_type>(f(v)));
+                      dist[vimage] = alt;
 
-                      if (alt < dist[v])
+                      if (nargout >= 2)
                         {
-                          dist[v] = alt;
+                          idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(v) = idx_segment.xelem(u.first);
+                          if (nargout >= 3)
+                            idx_predecessor.xelem(vimage) = u.imageindex + 1;
+                        }
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(v) = u.first + 1;
-                            }
+                      Q.push({vmask, vimage, alt});
 
-                          Q.push({v, alt});
-                        }
+                      counter.improve (Q.size ());
                     }
                 }
-
-              OCTAVE_QUIT;
             }
         }
-      else if (method == distance_type::quasieuclidean)
-        {
-          const auto& weight_quasi = create_quasi_euclidean_chamfer_weights<typename ResultType::element_type> ();
+    }
 
-          while (! Q.empty ())
-            {
-              auto u = Q.top ();
+    template <typename Counter>
+    void
+    do_graydistND (Counter& counter)
+    {
+      using T = typename ResultType::element_type;
 
-              Q.pop ();
+      using image_elem = typename ImageType::element_type;
 
-              auto idx_to_w = inheap[u.first];
+      bool only_direct_neghbors = method == distance_type::cityblock;
 
-              if (! idx_to_w)
-                {
-                  continue;
-                }
+      bool quasi = method == distance_type::quasieuclidean;
 
-              inheap[u.first] = 0;
+      if (radius == 2)
+        {
+          if (! quasi)
+            error ("graydist: Neighborhood 5 can only be used with the quasi-euclidean metric");
 
-              const auto& neighbor_idx = offset[idx_to_w];
+          std::vector<octave_idx_type> mask_neighbor_idx, image_neighbor_idx;
 
-              const auto& wei = weight_quasi[idx_to_w];
+          std::vector<char> neighbor_class;
 
-              typename ResultType::element_type fu = f(u.first);
+          std::vector<T> weights;
 
-              for (size_t i = 0 ; i < neighbor_idx.size(); i++)
-                {
-                  auto v = u.first + neighbor_idx[i];
+          for (double squared_length : create_chamfer_neighbors (mask_neighbor_idx, image_neighbor_idx, neighbor_class))
+            weights.push_back (.5 * std::sqrt (squared_length));
 
-                  if (inheap[v])
-                    {
-                      typename ResultType::element_type alt = u.second + wei[i] * (fu + static_cast<typename ResultType::element_type>(f(v)));
+          if (use_pair_table<image_elem> (f.numel (), image_neighbor_idx.size (), weights.size ()))
+            propagateND (pair_table_cost<T, gray_step<T>> (cost, weights, image_elem ()), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+          else
+            propagateND (level_cost<T, gray_step<T>> (cost, weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
 
-                      if (alt < dist[v])
-                        {
-                          dist[v] = alt;
+          return;
+        }
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(v) = idx_segment.xelem(u.first);
+      auto mask_neighbor_idx = create_offset_to_neighbors (f.dims () + 2, only_direct_neghbors);
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(v) = u.first + 1;
-                            }
+      auto image_neighbor_idx = create_offset_to_neighbors (f.dims (), only_direct_neghbors);
 
-                          Q.push({v, alt});
-                        }
-                    }
-                }
+      auto neighbor_class = spacing.empty ()
+                            ? create_neighbor_classes (f.dims (), image_neighbor_idx.size (), quasi)
+                            : create_axis_classes (only_direct_neghbors);
 
-              OCTAVE_QUIT;
-            }
+      std::vector<T> weights {static_cast<T> (.5)};
+
+      if (! spacing.empty ())
+        weights = axis_weights<T> (spacing, [&] (int mask) { return .5 * step_length (mask, spacing, quasi); });
+      else if (quasi)
+        {
+          weights.resize (f.ndims ());
+
+          for (int d = 1; d <= f.ndims (); d++)
+            weights[d-1] = sqrt (d) / 2;
         }
+
+      if (use_pair_table<image_elem> (f.numel (), image_neighbor_idx.size (), weights.size ()))
+        propagateND (pair_table_cost<T, gray_step<T>> (cost, weights, image_elem ()), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
+      else
+        propagateND (level_cost<T, gray_step<T>> (cost, weights), mask_neighbor_idx, image_neighbor_idx, neighbor_class, counter);
     }
 
-    void do_graydist()
+    void run ()
     {
-      const octave_idx_type dim1 = f.dim1();
+      const auto start = std::chrono::steady_clock::now ();
 
-      const octave_idx_type dim2 = f.dim2();
-
-      if (dim1 == 1 || dim2 == 1)
+      if (want_summary)
         {
-           do_graydist1D ();
+          std::vector<octave_idx_type> seeds;
+
+          for (const auto& e : Q.storage ())
+            seeds.push_back (e.imageindex);
+
+          summary.start (std::move (seeds));
         }
+
+      monitor.start (f.numel ());
+
+      if (collect_stats)
+        do_graydistND (stats);
       else
         {
-           do_graydist2D ();
+          no_stats counter;
+
+          do_graydistND (counter);
         }
+
+      stats.propagation_time = elapsed (start);
+
+      monitor.finish ();
+
+      finished = true;
     }
 
     ImageType f;
 
+    cost_transform<typename ResultType::element_type> cost;
+
     const int nargout;
 
+    const bool collect_stats;
+
+    propagation_stats stats;
+
+    propagation_monitor monitor;
+
+    const std::vector<double> spacing;
+
+    // number of points of the neighborhood on each side of the center, it is
+    // also the width of the padding of the mask
+    const int radius;
+
+    const bool want_summary;
+
+    region_summary<ResultType> summary;
+
+    // the neighbors are only improved up to this distance
+    const typename ResultType::element_type cutoff;
+
+    const output_type output;
+
+    // the points in the order they are settled for the compact outputs and
+    // their indexes in the padded mask
+    std::vector<octave_idx_type> settled;
+
+    std::vector<octave_idx_type> settled_mask;
+
+    // the propagation has completed, so the state can be kept for the next
+    // call
+    bool finished = false;
+
     ResultType dist_mat;
 
     IndexType idx_segment;
 
     IndexType idx_predecessor;
 
-    std::priority_queue<std::pair<octave_idx_type, typename ResultType::element_type>,std::vector<std::pair<octave_idx_type, typename ResultType::element_type>>, PointCmp> Q;
+    scratch_queue<queue_elem_type, PointCmpND> Q;
 
-    std::vector<char> inheap;
+    std::vector<bool> inheap;
 
     distance_type method;
   };
 
-  template <typename ResultType, typename  IndexType, typename ImageType>
-  class GrayDistND
+  // approximate distances of large 2D images. The transformed gray values
+  // are reduced to a pyramid by averaging 2x2 blocks, a step between two
+  // coarse pixels is twice as long as a fine step so the distances of a
+  // level are doubled when they are moved to the next finer level. The
+  // distances are computed on the coarsest level and at each finer level
+  // only a band around the seed points and around the boundaries between
+  // the regions of different seed points is computed again.
+  template <typename ResultType, typename ArrayType, typename Transform>
+  ResultType
+  reduce_cost (const ArrayType& c, const Transform& value)
   {
-  public:
-    struct queue_elem_type
-    {
-      octave_idx_type maskindex = 0;
-      octave_idx_type imageindex = 0;
-      typename ResultType::element_type imageval = 0;
-    };
+    using T = typename ResultType::element_type;
 
-    struct PointCmpND
-    {
-      PointCmpND ()  {}
+    const octave_idx_type rows = c.rows ();
 
-      bool operator()(const queue_elem_type& a , const queue_elem_type& b ) const
-      {return a.imageval > b.imageval;}
-    };
+    const octave_idx_type cols = c.columns ();
 
-    GrayDistND (const ImageType& image, int nargout, const boolNDArray & mask, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
-    {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+    const octave_idx_type coarse_rows = (rows + 1) / 2;
 
-      if (image.numel () != 0)
+    ResultType result (dim_vector (coarse_rows, (cols + 1) / 2));
+
+    for (octave_idx_type j = 0; j < result.columns (); j++)
+      for (octave_idx_type i = 0; i < coarse_rows; i++)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          T sum = 0;
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+          int n = 0;
 
-          f = image;
-          init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
-          initialize_from_seed (mask);
-          do_graydistND();
+          for (octave_idx_type jj = 2 * j; jj < std::min (2 * j + 2, cols); jj++)
+            for (octave_idx_type ii = 2 * i; ii < std::min (2 * i + 2, rows); ii++)
+              {
+                sum += value (c.xelem (ii + jj * rows));
+
+                n++;
+              }
+
+          result.xelem (i + j * coarse_rows) = sum / static_cast<T> (n);
         }
 
-    }
-    GrayDistND (const ImageType& image, int nargout, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
-    {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+    return result;
+  }
 
-      if (image.numel () != 0)
-        {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+  // a coarse pixel is a seed if one of its fine pixels is a seed, it gets
+  // the index of the first of them
+  Array<octave_idx_type>
+  reduce_seeds (const Array<octave_idx_type>& seeds)
+  {
+    const octave_idx_type rows = seeds.rows ();
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
+    const octave_idx_type cols = seeds.columns ();
 
-          f = image;
-          init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
-          initialize_from_seed (C , R);
-          do_graydistND();
-        }
-    }
+    const octave_idx_type coarse_rows = (rows + 1) / 2;
 
-    GrayDistND (const ImageType& image, int nargout, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
-    : f(), nargout (nargout)
-    {
-      dist_mat = ResultType(image.dims(), numeric_limits<typename ResultType::element_type>::infinity());
+    Array<octave_idx_type> result (dim_vector (coarse_rows, (cols + 1) / 2), 0);
 
-      if (image.numel () != 0)
+    for (octave_idx_type j = 0; j < cols; j++)
+      for (octave_idx_type i = 0; i < rows; i++)
         {
-          if (nargout >= 2)
-                idx_segment = IndexType (image.dims ());
+          octave_idx_type& r = result.xelem (i / 2 + (j / 2) * coarse_rows);
 
-          if (nargout == 3)
-                idx_predecessor = IndexType (image.dims ());
-
-          f = image;
-          init_method (method);
-          inheap  = create_zero_padded_maskND (image.dims ());
-          initialize_from_seed (ind);
-          do_graydistND();
+          if (r == 0)
+            r = seeds.xelem (i + j * rows);
         }
-    }
 
-    const ResultType&
-    value () const
-    {
-      return dist_mat;
-    }
+    return result;
+  }
 
-    octave_value_list
-    get_result ()
-    {
-      return ovl (octave_value (value ()), octave_value (idx_segment), octave_value (idx_predecessor));
-    }
+  // position of a finer pixel between the centers of the coarse pixels
+  void
+  coarse_position (octave_idx_type i, octave_idx_type n, octave_idx_type& lo, octave_idx_type& hi, double& w)
+  {
+    const double y = (i - 0.5) / 2;
 
-  private:
+    lo = static_cast<octave_idx_type> (std::floor (y));
 
-    octave_idx_type
-    image_to_mask_index (octave_idx_type idximg, const std::vector<octave_idx_type>& cumimgdim, const std::vector<octave_idx_type>& cummskdim, octave_idx_type sumcummask)
-    {
-      octave_idx_type idxmsk = 0;
+    w = y - lo;
 
-      for (octave_idx_type n = (octave_idx_type)(cumimgdim.size ())-2; n >= 0; n--)
-        {
-          idxmsk += idximg / cumimgdim[n] * cummskdim[n];
+    if (lo < 0)
+      {
+        lo = 0;
 
-          idximg %= cumimgdim[n];
-        }
+        w = 0;
+      }
 
-      return idxmsk + idximg + sumcummask + 1  ;
-    }
+    hi = std::min (lo + 1, n - 1);
 
-    std::tuple<std::vector <octave_idx_type>,std::vector <octave_idx_type>, octave_idx_type>
-    create_cumulative_dims(const dim_vector& dimimg, const dim_vector& dimmsk)
-    {
-      std::vector <octave_idx_type> cumdimimg(dimimg.length());
+    if (hi == lo)
+      w = 0;
+  }
 
-      std::vector <octave_idx_type> cumdimmsk(dimimg.length());
+  // bilinear interpolation of the coarse distances, where one of the coarse
+  // pixels can not be reached the distance of the parent pixel is used
+  template <typename ResultType>
+  ResultType
+  upsample_distance (const ResultType& coarse, const dim_vector& dims)
+  {
+    using T = typename ResultType::element_type;
 
-      octave_idx_type sumcummask = 0;
+    const octave_idx_type coarse_rows = coarse.rows ();
 
-      cumdimimg[0] = dimimg.xelem(0);
+    const octave_idx_type coarse_cols = coarse.columns ();
 
-      cumdimmsk[0] = dimmsk.xelem(0);
+    ResultType result (dims);
 
-      for (size_t i = 1 ; i < cumdimimg.size(); i++)
-        {
-            cumdimimg[i] = dimimg.xelem(i)*cumdimimg[i-1];
+    for (octave_idx_type j = 0; j < dims(1); j++)
+      {
+        octave_idx_type j0, j1;
 
-            cumdimmsk[i] = dimmsk.xelem(i)*cumdimmsk[i-1];
+        double wj;
 
-            sumcummask += cumdimmsk[i-1];
-        }
+        coarse_position (j, coarse_cols, j0, j1, wj);
 
-      return {cumdimimg, cumdimmsk, sumcummask};
-    }
+        for (octave_idx_type i = 0; i < dims(0); i++)
+          {
+            octave_idx_type i0, i1;
 
-    void
-    init_method (const std::string& method)
-    {
-      if (method == "chessboard")
-        {
-          this->method = distance_type::chessboard;
-        }
-      else if (method == "cityblock")
-        {
-          this->method = distance_type::cityblock;
-        }
-      else if (method == "quasi-euclidean")
-        {
-          this->method = distance_type::quasieuclidean;
-        }
-      else
-        {
-          error ("graydist: unregignized distance metric");
-        }
-    }
+            double wi;
 
-    void
-    initialize_from_seed (const Array<octave_idx_type>& ind)
-    {
-      const dim_vector& dim = f.dims();
+            coarse_position (i, coarse_rows, i0, i1, wi);
 
-      std::vector<queue_elem_type> cache;
+            const T d = static_cast<T> ((1 - wi) * (1 - wj)) * coarse.xelem (i0 + j0 * coarse_rows)
+                        + static_cast<T> (wi * (1 - wj)) * coarse.xelem (i1 + j0 * coarse_rows)
+                        + static_cast<T> ((1 - wi) * wj) * coarse.xelem (i0 + j1 * coarse_rows)
+                        + static_cast<T> (wi * wj) * coarse.xelem (i1 + j1 * coarse_rows);
 
-      cache.reserve(dim.numel() - (dim+(-2)).numel());
+            const T parent = coarse.xelem (i / 2 + (j / 2) * coarse_rows);
 
-       Q =std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
-         {PointCmpND{}, std::move(cache)};
+            result.xelem (i + j * dims(0)) = 2 * (d < numeric_limits<T>::infinity () ? d : parent);
+          }
+      }
+
+    return result;
+  }
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+  template <typename IndexType>
+  IndexType
+  upsample_index (const IndexType& coarse, const dim_vector& dims)
+  {
+    const octave_idx_type coarse_rows = coarse.rows ();
 
-      try
+    IndexType result (dims);
+
+    for (octave_idx_type j = 0; j < dims(1); j++)
+      for (octave_idx_type i = 0; i < dims(0); i++)
+        result.xelem (i + j * dims(0)) = coarse.xelem (i / 2 + (j / 2) * coarse_rows);
+
+    return result;
+  }
+
+  // the finer pixels whose parents are within width pixels of a seed point
+  // or of a boundary between the regions of two seed points
+  template <typename IndexType>
+  boolNDArray
+  refinement_band (const IndexType& labels, const Array<octave_idx_type>& seeds, octave_idx_type width, const dim_vector& dims)
+  {
+    const octave_idx_type rows = labels.rows ();
+
+    const octave_idx_type cols = labels.columns ();
+
+    boolNDArray mark (labels.dims (), false);
+
+    for (octave_idx_type j = 0; j < cols; j++)
+      for (octave_idx_type i = 0; i < rows; i++)
         {
-          for (octave_idx_type i = 0; i < ind.numel () ; i++)
+          const octave_idx_type p = i + j * rows;
+
+          if (seeds.xelem (p))
             {
-              dist_mat.checkelem(ind(i)-1) = 0;
+              mark.xelem (p) = true;
 
-              if (nargout >= 2)
+              continue;
+            }
+
+          for (octave_idx_type jj = std::max (j - 1, octave_idx_type (0)); jj <= std::min (j + 1, cols - 1) && ! mark.xelem (p); jj++)
+            for (octave_idx_type ii = std::max (i - 1, octave_idx_type (0)); ii <= std::min (i + 1, rows - 1); ii++)
+              if (labels.xelem (ii + jj * rows) != labels.xelem (p))
                 {
-                  idx_segment.xelem(ind(i)-1) = ind(i);
+                  mark.xelem (p) = true;
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(ind(i)-1) = 0;
+                  break;
                 }
-
-              Q.push({image_to_mask_index (ind(i)-1,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), ind(i)-1, 0});
-            }
-        }
-      catch (...)
-        {
-          error ("out of range seed values");
         }
-    }
 
-    void
-    initialize_from_seed (const Array<octave_idx_type>& C, const Array<octave_idx_type>& R)
-    {
-      if (C.numel () != R.numel ())
-        error ("C and R should have equal sizes");
+    // separable dilation by a square of size 2*width+1
+    boolNDArray dilated_cols (labels.dims (), false);
 
-      const dim_vector& dim = f.dims();
+    for (octave_idx_type j = 0; j < cols; j++)
+      for (octave_idx_type i = 0; i < rows; i++)
+        if (mark.xelem (i + j * rows))
+          for (octave_idx_type jj = std::max (j - width, octave_idx_type (0)); jj <= std::min (j + width, cols - 1); jj++)
+            dilated_cols.xelem (i + jj * rows) = true;
 
-      std::vector<queue_elem_type> cache;
+    boolNDArray dilated (labels.dims (), false);
 
-      cache.reserve(dim.numel() - (dim+(-2)).numel());
+    for (octave_idx_type j = 0; j < cols; j++)
+      for (octave_idx_type i = 0; i < rows; i++)
+        if (dilated_cols.xelem (i + j * rows))
+          for (octave_idx_type ii = std::max (i - width, octave_idx_type (0)); ii <= std::min (i + width, rows - 1); ii++)
+            dilated.xelem (ii + j * rows) = true;
 
-       Q = std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
-         {PointCmpND{}, std::move(cache)};
+    boolNDArray band (dims);
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+    for (octave_idx_type j = 0; j < dims(1); j++)
+      for (octave_idx_type i = 0; i < dims(0); i++)
+        band.xelem (i + j * dims(0)) = dilated.xelem (i / 2 + (j / 2) * rows);
 
-      try
-        {
-          for (octave_idx_type i = 0; i < C.numel () ; i++)
-            {
-              octave_idx_type ind = ::compute_index (R.xelem(i)-1, C.xelem(i)-1 , dim);
+    return band;
+  }
 
-              dist_mat(ind) = 0;
+  // number of levels of the pyramid. The coarsest level has at least 8
+  // pixels in each dimension, automatic selection stops when its larger
+  // dimension is not greater than 512.
+  octave_idx_type
+  pyramid_levels (const dim_vector& dims, octave_idx_type requested)
+  {
+    octave_idx_type levels = 0;
 
-              if (nargout >= 2)
-                {
-                  idx_segment.xelem(ind) = ind + 1;
+    octave_idx_type rows = dims(0);
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(ind) = 0;
-                }
+    octave_idx_type cols = dims(1);
 
-              Q.push({image_to_mask_index (ind,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), ind, 0});
-            }
-        }
-      catch (...)
-        {
-          error ("out of range seed values");
-        }
-    }
+    while ((requested < 0 ? std::max (rows, cols) > 512 : levels < requested)
+           && (rows + 1) / 2 >= 8 && (cols + 1) / 2 >= 8)
+      {
+        rows = (rows + 1) / 2;
 
-    void
-    initialize_from_seed (const boolNDArray& mask)
+        cols = (cols + 1) / 2;
+
+        levels++;
+      }
+
+    return levels;
+  }
+
+  template <typename ResultType, typename IndexType, typename ImageType>
+  class ApproximateGrayDist
+  {
+  public:
+
+    using T = typename ResultType::element_type;
+
+    ApproximateGrayDist (const ImageType& image, int nargout, const options& opt, const boolNDArray & mask, const std::string& method = "chessboard")
+    : nargout (nargout), opt (opt)
     {
-      if (mask.numel () != f.numel ())
+      if (mask.numel () != image.numel ())
         error ("mask and I should have equal sizes");
 
-      const dim_vector& dim = f.dims();
+      Array<octave_idx_type> seeds (image.dims (), 0);
 
-      std::vector<queue_elem_type> cache;
+      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+        if (mask.xelem (i))
+          seeds.xelem (i) = i + 1;
 
-      cache.reserve(dim.numel() - (dim+(-2)).numel());
+      compute (image, seeds, method);
+    }
 
-      Q = std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND>
-         {PointCmpND{}, std::move(cache)};
+    ApproximateGrayDist (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & C, const Array<octave_idx_type> & R, const std::string& method = "chessboard")
+    : nargout (nargout), opt (opt)
+    {
+      if (C.numel () != R.numel ())
+        error ("C and R should have equal sizes");
 
-      auto cum = create_cumulative_dims(dim, dim+2);
+      Array<octave_idx_type> seeds (image.dims (), 0);
 
-      for (octave_idx_type i = 0; i < mask.numel () ; i++)
+      for (octave_idx_type i = 0; i < C.numel () ; i++)
         {
-          if (mask.xelem(i))
-            {
-              dist_mat(i) = 0;
+          if (R.xelem (i) < 1 || R.xelem (i) > image.rows () || C.xelem (i) < 1 || C.xelem (i) > image.columns ())
+            error ("out of range seed values");
 
-              if (nargout >= 2)
-                {
-                  idx_segment.xelem(i) = i + 1;
+          const octave_idx_type ind = ::compute_index (R.xelem (i) - 1, C.xelem (i) - 1, image.dims ());
 
-                  if (nargout == 3)
-                    idx_predecessor.xelem(i) = 0;
-                }
-              Q.push({image_to_mask_index (i,std::get<0>(cum), std::get<1>(cum),std::get<2>(cum)), i, 0});
-            }
+          seeds.xelem (ind) = ind + 1;
         }
+
+      compute (image, seeds, method);
     }
 
-    template<typename T>
-    std::vector<T>
-    create_quasi_euclidean_chamfer_weights(const dim_vector& array_dims)
+    ApproximateGrayDist (const ImageType& image, int nargout, const options& opt, const Array<octave_idx_type> & ind, const std::string& method = "chessboard")
+    : nargout (nargout), opt (opt)
     {
-      MArray<octave_idx_type> start(dim_vector(3,1));
+      Array<octave_idx_type> seeds (image.dims (), 0);
 
-      start(0) = 1;
+      for (octave_idx_type i = 0; i < ind.numel () ; i++)
+        {
+          if (ind.xelem (i) < 1 || ind.xelem (i) > image.numel ())
+            error ("out of range seed values");
 
-      start(1) = 0;
+          seeds.xelem (ind.xelem (i) - 1) = ind.xelem (i);
+        }
 
-      start(2) = 1;
+      compute (image, seeds, method);
+    }
 
-      auto dist = start;
+    octave_value_list
+    get_result ()
+    {
+      return result;
+    }
 
-      for (int i = 2; i <= array_dims.length (); i++)
-        {
-          dim_vector shpsz = dim_vector::alloc(i);
+    octave_scalar_map
+    get_summary () const
+    {
+      return summary;
+    }
 
-          for (int j = 0; j < i-1; j++)
-            shpsz(j) = 1;
+    octave_scalar_map
+    get_info (double conversion_time) const
+    {
+      octave_scalar_map result_info = info;
 
-          shpsz(i-1) = 3;
+      octave_scalar_map time = result_info.getfield ("time").scalar_map_value ();
 
-          dist = dist + start.reshape(shpsz);
-        }
+      time.assign ("conversion", conversion_time);
 
-      const octave_idx_type result_size = pow(3,array_dims.length());
+      time.assign ("pyramid", pyramid_time);
 
-      std::vector<T> wei (result_size-1);
+      result_info.assign ("time", time);
 
-      octave_idx_type s = 0;
+      octave_scalar_map approximation;
 
-      for (int j = 0; j < result_size; j++)
-        {
-          if (j != result_size/2)
-            wei[s++] = sqrt(dist(j))/2;
-        }
+      approximation.assign ("levels", static_cast<double> (levels));
+      approximation.assign ("band_fraction", band_fraction);
+      approximation.assign ("max_delta", static_cast<double> (max_delta));
+
+      result_info.assign ("approximation", approximation);
 
-      return wei;
+      return result_info;
     }
 
-    std::vector<octave_idx_type>
-    create_offset_to_neighbors(const dim_vector& dim, bool only_direct_neghbors = false)
+  private:
+
+    void
+    compute (const ImageType& image, const Array<octave_idx_type>& seeds, const std::string& method)
     {
-      octave_idx_type result_size;
+      const auto start = std::chrono::steady_clock::now ();
 
-      if (only_direct_neghbors)
-        result_size = dim.length() * 2;
-      else
-        result_size = pow (3, dim.length ())-1;
+      levels = pyramid_levels (image.dims (), opt.approximate_levels);
 
-      Array<octave_idx_type> idx (dim_vector (1, dim.length ()), 1);
+      // the coarse levels hold the transformed gray values
+      options coarse_opt = opt;
 
-      std::vector<octave_idx_type> offset (result_size);
+      coarse_opt.scale = 1;
+      coarse_opt.offset = 0;
+      coarse_opt.exponent = 1;
+      coarse_opt.has_lookup_table = false;
 
-      octave_idx_type center_idx = compute_index (idx, dim);
+      // the progress is reported only for the finest level that has most of
+      // the points, otherwise it would restart from 0% at each level
+      coarse_opt.progress = octave_value ();
 
-      if (only_direct_neghbors)
-        {
-          octave_idx_type k = 0;
+      std::vector<ResultType> costs (levels + 1);
 
-          for (int i = 0; i < dim.length (); i++)
-            {
-              for (int j : {0, 2})
-                {
-                  idx(i) = j;
+      std::vector<Array<octave_idx_type>> seed_pyramid {seeds};
 
-                  offset[k++] = compute_index (idx,dim) - center_idx;
-                }
+      const cost_transform<T> cost (opt, image);
 
-              idx(i) = 1;
-            }
-        }
-      else
+      for (octave_idx_type l = 1; l <= levels; l++)
         {
-          idx.fill(0);
+          if (l == 1)
+            costs[l] = reduce_cost<ResultType> (image, cost);
+          else
+            costs[l] = reduce_cost<ResultType> (costs[l-1], [] (const T& x) { return x; });
 
-          octave_idx_type k = 0;
+          seed_pyramid.push_back (reduce_seeds (seed_pyramid.back ()));
+        }
 
-          offset[k++] = -center_idx;
+      pyramid_time = elapsed (start);
 
-          for (int j = 1; j <= result_size; j++)
-            {
-              for (int i = 0; i < dim.length (); i++)
-                {
-                  if (++idx.xelem (i) == 3)
-                    {
-                      idx.xelem (i) = 0;
-                    }
-                  else
-                    {
-                      break;
-                    }
-                }
+      dim_vector dims = levels > 0 ? costs[levels].dims () : image.dims ();
 
-              if (j != (result_size+1)/2)
-                offset[k++] = compute_index (idx,dim) - center_idx;
-            }
-        }
+      // the coarsest level is computed completely
+      ResultType initial (dims, numeric_limits<T>::infinity ());
 
-      return offset;
-    }
+      IndexType initial_idx (dims);
 
-    std::vector<bool>
-    create_zero_padded_maskND( dim_vector dims)
-    {
-      // zero padded mask to handle boundary pixels
-      octave_idx_type size = 1;
+      boolNDArray band (dims, true);
 
-      for (int i = 0 ;i < dims.length (); i++)
+      for (octave_idx_type l = levels; l >= 0; l--)
         {
-          dims(i) += 2;
+          if (l < levels)
+            {
+              dims = l > 0 ? costs[l].dims () : image.dims ();
 
-          size *= dims(i);
-        }
+              const IndexType& coarse_idx = initial_idx;
 
-      std::vector<bool> result(size, true);
+              band = refinement_band (coarse_idx, seed_pyramid[l+1], opt.band_width, dims);
 
-      std::vector<std::pair<octave_idx_type,octave_idx_type>> bounds;
+              initial = upsample_distance (initial, dims);
 
-      Array<octave_idx_type> indexes(dim_vector(1,dims.length()));
+              initial_idx = upsample_index (coarse_idx, dims);
+            }
 
-      bounds.reserve(dims.length());
+          if (l > 0)
+            {
+              GrayDist2D<ResultType, IndexType, ResultType> engine (costs[l], 2, coarse_opt, initial, initial_idx, seed_pyramid[l], band, method);
 
-      for (octave_idx_type i = 0 ;i < dims.length(); i++)
-        {
-          bounds.emplace_back (0, dims(i));
-        }
+              update_delta (initial, engine.value (), band, l, l < levels);
 
-      octave_idx_type sz = size;
+              initial = engine.value ();
 
-      for (octave_idx_type k = 0 ;k < dims.length(); k++)
-        {
-          sz = sz/dims(k);
-          for (octave_idx_type pad : {octave_idx_type (1), dims(k)})
+              initial_idx = engine.segment ();
+            }
+          else
             {
-              bounds[k] = {pad-1, pad};
+              GrayDist2D<ResultType, IndexType, ImageType> engine (image, std::max (nargout, 2), opt, initial, initial_idx, seeds, band, method);
 
-              for (octave_idx_type s = 0 ;s < dims.length(); s++)
-                {
-                  indexes.xelem(s)=bounds[s].first;
-                }
+              update_delta (initial, engine.value (), band, l, l < levels);
 
-              result[compute_index(indexes,dims)] = false;
+              band_fraction = static_cast<double> (band.nnz ()) / std::max (band.numel (), octave_idx_type (1));
 
-              for (octave_idx_type j = 1 ; j < sz; j++)
+              if (opt.stats)
+                info = engine.get_info (0);
+
+              result = engine.get_result ();
+
+              if (opt.summary)
                 {
-                  for (int i = 0; i < dims.length(); i++)
-                    {
-                      if (++indexes.xelem(i) == bounds[i].second)
-                        {
-                          indexes.xelem(i) = bounds[i].first;
-                        }
-                      else
-                        {
-                          break;
-                        }
-                    }
+                  // the points outside the band are not settled
+                  region_summary<ResultType> regions;
 
-                  result[compute_index(indexes,dims)] = false;
+                  std::vector<octave_idx_type> points;
+
+                  for (octave_idx_type i = 0; i < seeds.numel (); i++)
+                    if (seeds.xelem (i) != 0)
+                      points.push_back (i);
+
+                  regions.start (std::move (points));
+
+                  regions.collect (engine.value (), engine.segment ());
+
+                  summary = regions.get ();
                 }
             }
-          sz = sz*(dims(k)-2);
-
-          bounds[k] = {1, dims(k)-1};
         }
-
-      return result;
     }
 
+    // largest change of the refined points in units of the finest pixels
     void
-    do_graydistND ()
+    update_delta (const ResultType& before, const ResultType& after, const boolNDArray& band, octave_idx_type level, bool refined)
     {
-      typename ResultType::element_type* dist = dist_mat.fortran_vec ();
+      if (! refined)
+        return;
 
-      bool only_direct_neghbors = method == distance_type::cityblock;
+      const T inf = numeric_limits<T>::infinity ();
 
-      auto mask_neighbor_idx = create_offset_to_neighbors (f.dims () + 2, only_direct_neghbors);
+      for (octave_idx_type i = 0; i < band.numel (); i++)
+        if (band.xelem (i) && before.xelem (i) < inf && after.xelem (i) < inf)
+          max_delta = std::max (max_delta, std::abs (after.xelem (i) - before.xelem (i)) * static_cast<T> (octave_idx_type (1) << level));
+    }
 
-      auto image_neighbor_idx = create_offset_to_neighbors (f.dims (), only_direct_neghbors);
+    const int nargout;
 
-      if (method == distance_type::chessboard || method == distance_type::cityblock)
-        {
-          while (! Q.empty ())
-            {
-              auto u = Q.top ();
+    const options opt;
 
-              Q.pop ();
+    octave_idx_type levels = 0;
 
-              if (! inheap[u.maskindex])
-                {
-                  continue;
-                }
+    double band_fraction = 1;
 
-              inheap[u.maskindex] = 0;
+    double pyramid_time = 0;
 
-              typename ResultType::element_type fu = f(u.imageindex);
+    T max_delta = 0;
 
-              for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
-                {
-                  auto vmask = u.maskindex + mask_neighbor_idx[i];
+    octave_value_list result;
 
-                  if (inheap[vmask])
-                    {
-                      auto vimage = u.imageindex + image_neighbor_idx[i];
+    octave_scalar_map info;
 
-                      typename ResultType::element_type alt = u.imageval + (static_cast<typename ResultType::element_type>(.5) * (fu + static_cast<typename ResultType::element_type>(f(vimage))));
+    octave_scalar_map summary;
+  };
 
-                      if (alt < dist[vimage])
-                        {
-                          dist[vimage] = alt;
+  template <typename Engine, typename ImageType, typename ... Args>
+  octave_value_list
+  run_engine (const ImageType& im, int nargout, const options& opt, octave_scalar_map& info, octave_scalar_map& summary, double conversion_time, Args...args)
+  {
+    Engine engine (im, nargout, opt, args...);
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
+    if (opt.stats)
+      info = engine.get_info (conversion_time);
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(vimage) = u.imageindex + 1;
-                            }
+    if (opt.summary)
+      summary = engine.get_summary ();
 
-                          Q.push({vmask, vimage, alt});
-                        }
-                    }
-                }
+    return engine.get_result ();
+  }
 
-              OCTAVE_QUIT;
-            }
-        }
-      else if (method == distance_type::quasieuclidean)
-        {
-          auto wei = create_quasi_euclidean_chamfer_weights<typename ResultType::element_type> (f.dims ());
+  // the statistics are returned as the fourth output
+  void
+  append_info (octave_value_list& retval, const options& opt, octave_scalar_map& info, const std::chrono::steady_clock::time_point& reshape_start)
+  {
+    if (! opt.stats)
+      return;
 
-          while (! Q.empty ())
-            {
-              auto u = Q.top ();
+    octave_scalar_map time = info.getfield ("time").scalar_map_value ();
 
-              Q.pop ();
+    time.assign ("reshape", elapsed (reshape_start));
 
-              if (! inheap[u.maskindex])
-                {
-                  continue;
-                }
+    info.assign ("time", time);
 
-              inheap[u.maskindex] = 0;
+    retval(3) = info;
+  }
 
-              typename ResultType::element_type fu = f(u.imageindex);
+  // the summary is inserted as the second output, the other outputs follow
+  // it
+  void
+  insert_summary (octave_value_list& retval, const options& opt, const octave_scalar_map& summary)
+  {
+    if (! opt.summary)
+      return;
 
-              for (size_t i = 0 ; i < mask_neighbor_idx.size(); i++)
-                {
-                  auto vmask = u.maskindex + mask_neighbor_idx[i];
+    octave_value_list result = ovl (retval(0), summary);
 
-                  if (inheap[vmask])
-                    {
-                      auto vimage = u.imageindex + image_neighbor_idx[i];
+    for (octave_idx_type k = 1; k < retval.length (); k++)
+      result(k+1) = retval(k);
 
-                      typename ResultType::element_type alt = u.imageval + wei[i] * (fu + static_cast<typename ResultType::element_type>(f(vimage)));
+    retval = result;
+  }
 
-                      if (alt < dist[vimage])
-                        {
-                          dist[vimage] = alt;
+  template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
+  octave_value_list
+  run_approximate (std::true_type, const ImageType& im, int nargout, const options& opt, octave_scalar_map& info, octave_scalar_map& summary, double conversion_time, Args...args)
+  {
+    return run_engine<ApproximateGrayDist<ResultType, IndexType, ImageType>> (im, nargout, opt, info, summary, conversion_time, args...);
+  }
 
-                          if (nargout >= 2)
-                            {
-                              idx_segment.xelem(vimage) = idx_segment.xelem(u.imageindex);
+  template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
+  octave_value_list
+  run_approximate (std::false_type, const ImageType&, int, const options&, octave_scalar_map&, octave_scalar_map&, double, Args...)
+  {
+    error ("graydist: Approximate can not be used with complex images");
+  }
 
-                              if (nargout == 3)
-                                idx_predecessor.xelem(vimage) = u.imageindex + 1;
-                            }
+  template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
+  octave_value_list do_graydist (const ImageType& image, int nargout, const options& opt, Args...args)
+  {
+    const double conversion_time = elapsed (opt.start_time);
 
-                          Q.push({vmask, vimage, alt});
-                        }
-                    }
-                }
+    octave_scalar_map info;
 
-              OCTAVE_QUIT;
-            }
-        }
-    }
+    octave_scalar_map summary;
 
-    ImageType f;
+    // the engine computes idx for the summary, the outputs after T are
+    // shifted by the summary
+    const int engine_nargout = opt.summary ? std::max (nargout - 1, 2) : nargout;
 
-    const int nargout;
+    if (! opt.spacing.empty () && static_cast<int> (opt.spacing.size ()) != image.ndims ())
+      error ("graydist: Spacing should have one element for each dimension of I");
 
-    ResultType dist_mat;
+    const ImageType im = image.squeeze();
 
-    IndexType idx_segment;
+    options engine_opt = opt;
 
-    IndexType idx_predecessor;
+    engine_opt.spacing = squeeze_spacing (image.dims (), opt.spacing);
 
-    std::priority_queue<queue_elem_type,std::vector<queue_elem_type>, PointCmpND> Q;
+    octave_value_list retval;
 
-    std::vector<bool> inheap;
+    const bool approximate = opt.approximate_levels != 0 && im.ndims () == 2 && opt.neighborhood == 3
+                             && opt.output == output_type::full && std::isinf (opt.max_distance)
+                             && pyramid_levels (im.dims (), opt.approximate_levels) > 0;
 
-    distance_type method;
-  };
+    if (approximate)
+      retval = run_approximate<ResultType, IndexType> (std::is_floating_point<typename ResultType::element_type> (), im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
+    else if (im.ndims () <= 2 && opt.neighborhood == 3)
+      retval = run_engine<GrayDist2D<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
+    else
+      retval = run_engine<GrayDistND<ResultType, IndexType, ImageType>> (im, engine_nargout, engine_opt, info, summary, conversion_time, args...);
 
-  template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list do_graydist (const ImageType& image, int nargout, Args...args)
-  {
-    const ImageType im = image.squeeze();
+    const auto reshape_start = std::chrono::steady_clock::now ();
 
-    octave_value_list retval;
+    if (opt.output == output_type::bbox)
+      unsqueeze_bbox (retval, engine_nargout, image.dims (), im.dims ());
+    else if (opt.output == output_type::full)
+      {
+        retval(0) = retval(0).reshape(image.dims ());
 
-    if (im.ndims () <= 2)
-      retval = GrayDist2D<ResultType, IndexType, ImageType>(im, nargout, args...).get_result ();
-    else
-      retval = GrayDistND<ResultType, IndexType, ImageType>(im, nargout, args...).get_result ();
+        if (engine_nargout >= 2)
+          retval(1) = retval(1).reshape(image.dims ());
 
-    retval(0) = retval(0).reshape(image.dims ());
+        if (engine_nargout >= 3)
+          retval(2) = retval(2).reshape(image.dims ());
+      }
 
-    if (nargout >= 2)
-      retval(1) = retval(1).reshape(image.dims ());
+    append_info (retval, opt, info, reshape_start);
 
-    if (nargout >= 3)
-      retval(2) = retval(2).reshape(image.dims ());
+    insert_summary (retval, opt, summary);
 
     return retval;
   }
 
   template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list dispatch4 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch4 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin == 4)
       {
         if (unprocessed_args(n).is_string ())
-          return do_graydist<ResultType, IndexType> (image, nargout, args..., unprocessed_args(n).string_value ());
+          return do_graydist<ResultType, IndexType> (image, nargout, opt, args..., unprocessed_args(n).string_value ());
         else
           error ("invalid type for 'method'");
       }
     else
-      return do_graydist<ResultType, IndexType> (image, nargout, args...);
+      return do_graydist<ResultType, IndexType> (image, nargout, opt, args...);
   }
 
   template <typename ResultType, typename IndexType, typename ImageType,  typename ... Args>
-  octave_value_list dispatch3 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch3 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin >= 3 && n < 3)
       {
         if (unprocessed_args(n).is_string ())
-          return do_graydist< ResultType, IndexType> (image, nargout, args..., unprocessed_args(n).string_value ());
+          return do_graydist< ResultType, IndexType> (image, nargout, opt, args..., unprocessed_args(n).string_value ());
         else if (unprocessed_args(n).isnumeric ())
-          return dispatch4< ResultType, IndexType> (unprocessed_args, n+1, image, nargout, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
+          return dispatch4< ResultType, IndexType> (unprocessed_args, n+1, image, nargout, opt, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
         else
           error ("invalid type for argument number %s", std::to_string (n+1).c_str ());
       }
     else
-      return do_graydist<ResultType, IndexType> (image, nargout, args...);
+      return do_graydist<ResultType, IndexType> (image, nargout, opt, args...);
   }
 
   template < typename ResultType, typename IndexType, typename ImageType, typename ... Args>
-  octave_value_list dispatch2 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, Args...args)
+  octave_value_list dispatch2 (const octave_value_list& unprocessed_args,int n,const ImageType& image, int nargout, const options& opt, Args...args)
   {
     octave_idx_type nargin = unprocessed_args.length ();
 
     if (nargin >= 2 && n < 2)
       {
         if (unprocessed_args(n).islogical ())
-          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1, image, nargout, args..., unprocessed_args(n).bool_array_value ());
+          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1, image, nargout, opt, args..., unprocessed_args(n).bool_array_value ());
         else if (unprocessed_args(n).isnumeric ())
-          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1,image, nargout, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
+          return dispatch3< ResultType,IndexType> (unprocessed_args, n+1,image, nargout, opt, args...,  unprocessed_args(n).octave_idx_type_vector_value ());
         else
           error ("invalid type for argument number %s", std::to_string (n+1).c_str ());
       }
@@ -1234,9 +4042,19 @@ namespace image
   }
 
   template <typename IndexType>
-  octave_value_list dispatch (const octave_value_list& args, int nargout)
+  octave_value_list dispatch (const octave_value_list& all_args, int nargout)
   {
-    octave_idx_type nargin = args.length ();
+    const auto start_time = std::chrono::steady_clock::now ();
+
+    const octave_idx_type nargin = count_positional_args (all_args);
+
+    options opt = parse_options (all_args, nargin);
+
+    opt.stats = nargout >= (opt.summary ? 5 : 4);
+
+    opt.start_time = start_time;
+
+    const octave_value_list args = all_args.slice (0, nargin);
 
     if (nargin < 2 || nargin > 4)
       error ("invalid number of arguments");
@@ -1244,36 +4062,36 @@ namespace image
     octave_value im = args(0);
 
     if (im.islogical ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.bool_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.bool_array_value (), nargout, opt);
     else if (im.is_int8_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int8_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int8_array_value (), nargout, opt);
     else if (im.is_int16_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int16_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int16_array_value (), nargout, opt);
     else if (im.is_int32_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int32_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int32_array_value (), nargout, opt);
     else if (im.is_int64_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int64_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.int64_array_value (), nargout, opt);
     else if (im.is_uint8_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint8_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint8_array_value (), nargout, opt);
     else if (im.is_uint16_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint16_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint16_array_value (), nargout, opt);
     else if (im.is_uint32_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint32_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint32_array_value (), nargout, opt);
     else if (im.is_uint64_type ())
-      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint64_array_value (), nargout);
+      return image::dispatch2 < FloatNDArray,IndexType>(args, 1, im.uint64_array_value (), nargout, opt);
     else if (im.isreal ())
       {
         if (im.is_single_type ())
-          return image::dispatch2 < FloatNDArray,IndexType>(args, 1,im.float_array_value (), nargout);
+          return image::dispatch2 < FloatNDArray,IndexType>(args, 1,im.float_array_value (), nargout, opt);
         else
-          return image::dispatch2 < NDArray,IndexType>(args, 1, im.array_value (), nargout);
+          return image::dispatch2 < NDArray,IndexType>(args, 1, im.array_value (), nargout, opt);
       }
     else if (im.iscomplex ())
       {
         if (im.is_single_type ())
-          return image::dispatch2 < FloatComplexNDArray,IndexType>(args, 1, im.float_complex_array_value (), nargout);
+          return image::dispatch2 < FloatComplexNDArray,IndexType>(args, 1, im.float_complex_array_value (), nargout, opt);
         else
-          return image::dispatch2 < ComplexNDArray,IndexType>(args, 1, im.complex_array_value (), nargout);
+          return image::dispatch2 < ComplexNDArray,IndexType>(args, 1, im.complex_array_value (), nargout, opt);
       }
     else
       return octave_value_list ();
@@ -1286,8 +4104,12 @@ DEFUN_DLD (graydist, args, nargout,
 @deftypefnx {Loadable Function} {T =} graydist(@var{I}, @var{C}, @var{R})
 @deftypefnx {Loadable Function} {T =} graydist(@var{I}, @var{ind})
 @deftypefnx {Loadable Function} {T =} graydist(@var{___}, @var{method})
+@deftypefnx {Loadable Function} {T =} graydist(@var{___}, @var{name}, @var{value})
 @deftypefnx {Loadable Function} {[T, idx] =} graydist(@var{___})
 @deftypefnx {Loadable Function} {[T, idx, pred] =} graydist(@var{___})
+@deftypefnx {Loadable Function} {[T, idx, pred, info] =} graydist(@var{___})
+@deftypefnx {Loadable Function} {[T, S, idx, pred, info] =} graydist(@var{___}, "Summary", true)
+@deftypefnx {Loadable Function} {} graydist("clear")
 
 Compute gray weighted distance transform GWD of image.
 
@@ -1340,19 +4162,95 @@ sq2 1@ @ sq2@*
 where sq2 is equal to sqrt(2).
 @end table
 
+The gray values can be transformed on the fly, without creating a transformed copy of the image, using the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"Scale"}, @qcode{"Offset"}, @qcode{"Exponent"}
+I(x) in the step cost is replaced by @code{Scale * I(x)^Exponent + Offset}. Defaults are 1, 0 and 1.
+@item @qcode{"LookupTable"}
+For int8, uint8, int16 and uint16 images a vector of 256 or 65536 elements that I(x) is mapped through before the other transforms are applied. The first element corresponds to the smallest value of the image class.
+@end table
+
+Images with anisotropic sampling, like medical volumes with thicker slices, can be computed with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Spacing"}
+A vector with the distance between neighboring points along each dimension of @var{I}. The spatial length of a step to a neighbor is the largest spacing of the dimensions in which they differ for @qcode{"chessboard"} and @qcode{"cityblock"} and the euclidean length of the step for @qcode{"quasi-euclidean"}. Default is 1 for all dimensions.
+@end table
+
+More accurate quasi-euclidean distances can be computed with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Neighborhood"}
+Width of the neighborhood, 3 or 5. With 5 the neighbors of a point are the points that are at most two points away in each dimension and are not in the direction of a nearer neighbor, like the knight moves in 2D, and each step has its euclidean length. The largest relative error of the distance in a constant image falls from about 8% to 3% in 2D and from about 13% to 5% in 3D. It can only be used with the @qcode{"quasi-euclidean"} metric. The @qcode{"Threads"} and @qcode{"Approximate"} options are not used with it. Default is 3.
+@end table
+
+Propagations that only need the neighborhood of the seed points can be bounded with the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"MaxDistance"}
+Points whose distance is greater than this value are not processed, their distance is Inf and their @var{idx} and @var{pred} are zero. Default is Inf.
+@item @qcode{"Output"}
+Format of the outputs, @qcode{"full"}, @qcode{"sparse"} or @qcode{"bbox"}. With @qcode{"sparse"} @var{T} is a struct with the column vectors @qcode{ind} and @qcode{value} with the linear indexes and the distances of the points that are reached, in increasing order of index, and @var{idx} and @var{pred} are column vectors of the same points. With @qcode{"bbox"} @var{T} is a struct where @qcode{value} is the distance map cropped to the bounding box of the points that are reached and @qcode{offset} is the subscript of the first point of the box, and @var{idx} and @var{pred} are cropped to the same box. Default is @qcode{"full"}.
+@end table
+
+The @qcode{"Approximate"} option is not used with them.
+
+Long computations can be monitored with the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"InterruptInterval"}
+Number of points that are processed between checks for Ctrl-C. Default is 4096.
+@item @qcode{"Progress"}
+If true a line with the percentage of processed points, the elapsed time and the estimated remaining time is printed periodically. It can also be a function handle that is called as @code{fcn (fraction, elapsed, remaining)} with the times in seconds. After the computation it is called once more. Default is false.
+@item @qcode{"ProgressInterval"}
+Minimum time in seconds between two progress reports. Default is 1.
+@end table
+
+Large 2D images can be computed in parallel with the following @var{name}, @var{value} pair:
+
+@table @asis
+@item @qcode{"Threads"}
+Number of threads for 2D images. The image is split into strips of columns that are computed in parallel and exchange the distances at their boundaries until no distance changes. The distances are the same as with one thread, @var{idx} and @var{pred} can differ in points with more than one shortest path. Ctrl-C and the progress are checked while the strips are computed, points that are processed again in a later exchange are counted again in the progress. Default is 1.
+@end table
+
+Approximate distances of large 2D images can be computed with the following @var{name}, @var{value} pairs:
+
+@table @asis
+@item @qcode{"Approximate"}
+If true the distances are computed on a pyramid of the image where each level averages 2x2 blocks of the transformed gray values of the finer level. The coarsest level is computed completely. On each finer level only a band around the seed points and around the boundaries between the regions of different seed points is computed again, the other points get the interpolated distances of the coarser level. The number of levels is chosen so that the larger dimension of the coarsest level is not greater than 512, it can also be given as a number. It is ignored for images that are not 2D. @var{pred} is zero outside the band of the finest level. Progress is reported only for the finest level. Default is false.
+@item @qcode{"BandWidth"}
+Half width of the band in pixels of the coarser level. Default is 2.
+@end table
+
+In the approximate mode @var{info} also contains the field @qcode{approximation} with the number of @qcode{levels}, the fraction of the points of the image that are computed again (@qcode{band_fraction}) and the largest change of a distance by the refinement of a band (@qcode{max_delta}) that shows the error of the coarser levels.
+
 @var{idx} is index of the nearest seed point. @*
 @var{pred} is the predecessor map. pred(a) is the predecessor of 'a' in the shortest paths tree (that starts from seed points). In other words 'a' is the nearest neghbor to pred(a). Its value in seed points is zero.@*
 The type of @var{T} is double if the type of @var{I} is double. For other input types the type of output is single.@*
-The type of @var{idx} and @var{pred} depends on the size of the image. For an image of size less than 2^32 it is 'uint32' .For larger images it is 'uint64'.
+The type of @var{idx} and @var{pred} depends on the size of the image. For an image of size less than 2^32 it is 'uint32' .For larger images it is 'uint64'.@*
+@var{info} is a struct with statistics of the computation. It contains the number of heap @qcode{pushes} and @qcode{pops}, the number of @qcode{stale_pops} (points that were popped after they were already processed), the number of @qcode{relaxations} (steps to unprocessed neighbors) and @qcode{improvements} (relaxations that decreased a distance), @qcode{max_queue_size}, the number of @qcode{bytes} allocated for the distance map, the processed flags, @var{idx}, @var{pred} and the queue, and the wall-clock @qcode{time} in seconds of the conversion of the arguments, the initialization, the propagation and the reshape of the outputs. The statistics are only collected when @var{info} is requested.
+
+With the @qcode{"Summary"} option set to true the second output @var{S} is a struct with statistics of the region of each seed point, that is the points that have it as their nearest seed. Its fields are column vectors with one element per seed point: the linear index of the @qcode{seed}, the number of points of the region (@qcode{area}), the @qcode{max_distance} and the @qcode{mean_distance} of the points of the region and the linear index of the @qcode{farthest} point. The statistics are accumulated while the points are settled, so @var{idx} does not have to be requested to compute them. @var{idx}, @var{pred} and @var{info} follow @var{S}.
+
+The queue and the processed flags are kept between calls so repeated calls on images of the same size do not allocate them again. With the @qcode{"sparse"} and @qcode{"bbox"} outputs the distance map, @var{idx} and @var{pred} are kept as well and a call only resets the points that it has reached, so repeated calls take time in proportion to the reached region instead of the size of the image. The kept arrays have the size of the image. @code{graydist ("clear")} frees them.
 
 [1] Fouard C., Gedda M. (2006) An Objective Comparison Between Gray Weighted Distance Transforms and Weighted Distance Transforms on Curved Spaces. In: Kuba A., Nyúl L.G., Palágyi K. (eds) Discrete Geometry for Computer Imagery. DGCI 2006. Lecture Notes in Computer Science, vol 4245. Springer, Berlin, Heidelberg.
 
 @seealso{bwdist, curvdist}
 @end deftypefn)helpdoc")
 {
+  if (args.length () == 1 && args(0).is_string ())
+    {
+      if (args(0).string_value () != "clear")
+        error ("graydist: unrecognized command '%s'", args(0).string_value ().c_str ());
 
+      image::clear_scratch ();
+
+      return ovl ();
+    }
 
-  octave_idx_type nargin = args.length ();
+  octave_idx_type nargin = image::count_positional_args (args);
 
   if (nargin < 2 || nargin > 4)
     error ("invalid number of arguments");
@@ -14,6 +14,14 @@
 // this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <numeric>
+#include <random>
+#include <thread>
 #include <vector>
 #include <octave/oct.h>
 
@@ -271,6 +279,19 @@ template<typename Type>
   struct is_complex<std::complex<T>> : std::true_type
   { };
 
+  // abs and arg of a complex element that are computed once before the
+  // selection instead of in each comparison
+  template <typename T>
+  struct complex_key
+  {
+    T abs;
+
+    T arg;
+
+    // the element is nan
+    bool nan;
+  };
+
   template <typename T>
   struct remove
   {
@@ -351,6 +372,48 @@ template<typename Type>
       }) != last;
   }
 
+  // tests if an element is one that less_nan orders after all of the
+  // others. Complex elements that are compared by abs are nan if their abs
+  // is nan.
+  template <bool by_abs>
+  struct nan_test
+  {
+  template <typename T,
+    typename std::enable_if<
+    std::is_floating_point<T>::value
+    >::type* = nullptr>
+    bool operator ()(const T& a) const
+    {
+      return octave::math::isnan (a);
+    }
+
+  template <typename Cmplx,
+    typename std::enable_if<
+    is_complex<Cmplx>::value
+    >::type* = nullptr>
+    bool operator ()(const Cmplx& a) const
+    {
+      return by_abs ? octave::math::isnan (std::abs (a)) : octave::math::isnan (a);
+    }
+
+  template <typename T,
+    typename std::enable_if<
+      !(std::is_floating_point<T>::value
+    ||  is_complex<T>::value
+    ||  is_pair<T>::value)
+    >::type* = nullptr>
+    bool operator ()(const T&) const
+    {
+      return false;
+    }
+
+  template <typename T>
+    bool operator ()(const std::pair<octave_idx_type, T>& a) const
+    {
+      return (*this) (a.second);
+    }
+  };
+
   struct comp_auto
   {
   template <typename Order>
@@ -423,6 +486,18 @@ template<typename Type>
 
         return Order{} (a.first , b.first);
       }
+
+    template <typename T>
+      bool operator ()(const std::pair<octave_idx_type, complex_key<T>>& a, const std::pair<octave_idx_type, complex_key<T>>& b)
+      {
+        if (a.second.abs < b.second.abs)
+          return true;
+
+        if (b.second.abs < a.second.abs)
+          return false;
+
+        return Order{} (a.first , b.first);
+      }
     };
 
   template <typename Order>
@@ -530,6 +605,32 @@ template<typename Type>
         return false;
       }
 
+    template <typename T>
+      bool operator ()(const std::pair<octave_idx_type, complex_key<T>>& a, const std::pair<octave_idx_type, complex_key<T>>& b)
+      {
+        const auto absa = a.second.abs;
+        const auto absb = b.second.abs;
+
+        if (absa < absb)
+          return true;
+
+        if (absb < absa)
+          return false;
+
+        if (absa == absb)
+          return Order{} (a.first , b.first);
+
+        if (octave::math::isnan(absb))
+          {
+            if ( octave::math::isnan(absa))
+              return Order{} (a.first , b.first);
+
+            return true;
+          }
+
+        return false;
+      }
+
     template <typename Cmplx,
       typename std::enable_if<
       is_complex<Cmplx>::value
@@ -585,6 +686,8 @@ template<typename Type>
     using less = less_impl<std::less<octave_idx_type>>;
 
     using less_nan = less_nan_impl<std::less<octave_idx_type>>;
+
+    using is_nan = nan_test<true>;
   };
 
   struct comp_real
@@ -835,6 +938,8 @@ template<typename Type>
 
     using less_nan = less_nan_impl<std::less<octave_idx_type>>;
 
+    using is_nan = nan_test<false>;
+
     struct equal
     {
     template <typename T>
@@ -1000,6 +1105,24 @@ template<typename Type>
 
         return Order{} (a.first , b.first);
       }
+
+    template <typename T>
+      bool operator ()(const std::pair<octave_idx_type, complex_key<T>>& a, const std::pair<octave_idx_type, complex_key<T>>& b)
+      {
+        if (a.second.abs < b.second.abs)
+          return true;
+
+        if (b.second.abs < a.second.abs)
+          return false;
+
+        if (a.second.arg < b.second.arg)
+          return true;
+
+        if (b.second.arg < a.second.arg)
+          return false;
+
+        return Order{} (a.first , b.first);
+      }
     };
 
   template <typename Order>
@@ -1188,12 +1311,45 @@ template<typename Type>
 
         return Order{} (a.first , b.first);
       }
+
+    template <typename T>
+      bool operator ()(const std::pair<octave_idx_type, complex_key<T>>& a, const std::pair<octave_idx_type, complex_key<T>>& b)
+      {
+        if (b.second.nan)
+          {
+            if (a.second.nan)
+              return Order{} (a.first , b.first);
+
+            return true;
+          }
+
+        if (a.second.nan)
+          {
+            return false;
+          }
+
+        if (a.second.abs < b.second.abs)
+          return true;
+
+        if (b.second.abs < a.second.abs)
+          return false;
+
+        if (a.second.arg < b.second.arg)
+          return true;
+
+        if (b.second.arg < a.second.arg)
+          return false;
+
+        return Order{} (a.first , b.first);
+      }
     };
 
     using less = less_impl<std::less<octave_idx_type>>;
 
     using less_nan = less_nan_impl<std::less<octave_idx_type>>;
 
+    using is_nan = nan_test<false>;
+
     struct equal
     {
     template <typename T,
@@ -1271,6 +1427,19 @@ template<typename Type>
         }
     }
 
+    // moves to the first element of slice number j
+    void seek (octave_idx_type j)
+    {
+      for (int i = 0; i < dims.length(); i++)
+        {
+          const octave_idx_type n = bounds[i].second - bounds[i].first;
+
+          indexes.xelem (i) = bounds[i].first + j % n;
+
+          j /= n;
+        }
+    }
+
     octave_idx_type operator++ (int)
     {
       octave_idx_type result = compute_index(indexes,dims);
@@ -1308,157 +1477,1113 @@ template<typename Type>
     return offset;
   }
 
-  template <typename Comp>
-  octave_value_list
-  do_maxk (const Range& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  // index of the first element of slice j when the slices have n elements
+  // that are offset apart
+  octave_idx_type
+  slice_start (octave_idx_type j, octave_idx_type n, octave_idx_type offset)
   {
-    auto base = input.base ();
-    auto inc = input.inc ();
-    auto num = input.numel ();
+    return j % offset + (j / offset) * offset * n;
+  }
 
-    if (dim > 1)
+  // number of adjacent slices of n elements that are offset apart that are
+  // selected together. Their copies should stay in the cache.
+  template <typename T>
+  octave_idx_type
+  gather_count (octave_idx_type n, octave_idx_type offset)
+  {
+    const octave_idx_type fit = (1 << 18) / (n * sizeof (T));
+
+    return std::max<octave_idx_type> (1, std::min (offset, fit));
+  }
+
+  // calls fn (j, count) for the runs of at most block slices of [first, last)
+  // whose elements are adjacent in memory
+  template <typename Fn>
+  void
+  for_each_run (octave_idx_type first, octave_idx_type last, octave_idx_type offset, octave_idx_type block, const Fn& fn)
+  {
+    for (octave_idx_type j = first; j < last;)
       {
-        if (k == 0)
-          {
-            dim_vector dims_output (num>0, num);
+        const octave_idx_type count = std::min (std::min (last - j, block), offset - j % offset);
 
-            dims_output.resize (dim + 1, 1);
+        fn (j, count);
 
-            dims_output (dim) = k;
+        j += count;
+      }
+  }
 
-            octave_value_list retval {octave_value (NDArray (dims_output))};
+  // copies the n elements of count adjacent slices that are offset apart
+  // to count contiguous slices of buf, with fn applied to them. The input
+  // is read in storage order a row at a time, so each cache line that is
+  // loaded feeds all of the slices instead of one.
+  template <typename T, typename U, typename Fn>
+  void
+  gather_slices (const T* data, octave_idx_type n, octave_idx_type offset, octave_idx_type count, U* buf, const Fn& fn)
+  {
+    for (octave_idx_type c = 0; c < n; c++)
+      {
+        const T* row = data + c * offset;
 
-            if (compute_index)
-              retval.append (octave_value (NDArray (dims_output)));
+        for (octave_idx_type b = 0; b < count; b++)
+          buf[b * n + c] = fn (row[b]);
+      }
+  }
 
-            return retval;
-          }
+  template <typename T>
+  void
+  gather_slices (const T* data, octave_idx_type n, octave_idx_type offset, octave_idx_type count, T* buf)
+  {
+    gather_slices (data, n, offset, count, buf,
+      [] (const T& a)
+      {
+        return a;
+      });
+  }
 
-        octave_value_list retval {octave_value (input)};
+  // algorithm of the selection of the k first elements of a slice
+  enum class select_method
+  {
+    automatic,
+    heap,
+    select,
+    sort,
+    radix
+  };
 
-        if (compute_index)
-          retval.append (octave_value (NDArray (dim_vector (num>0, num), 1)));
+  struct options
+  {
+    std::string comparison_method = "auto";
 
-        return retval;
-      }
+    select_method algorithm = select_method::automatic;
 
-    if (k == 0)
-      {
-        dim_vector dims_output (1, num);
+    // number of threads, 0 chooses it from the size of the input
+    octave_idx_type threads = 0;
+  };
 
-        dims_output (dim) = k;
+  // strict weak ordering of a nan aware comparator. They compare nan as
+  // less than nan that is harmless for the heap of partial_sort_copy but
+  // not for nth_element and sort.
+  template <typename Compare>
+  struct strict_order
+  {
+  template <typename T>
+    bool operator () (const T& a, const T& b)
+    {
+      return Compare{} (a, b) && ! Compare{} (b, a);
+    }
+  };
 
-        octave_value_list retval {octave_value (NDArray (dims_output))};
+  // The heap of partial_sort_copy reads the input once and does work only
+  // for the elements that enter it, so it is used while k is a small
+  // fraction of n. Otherwise the slice is copied and partitioned by
+  // nth_element in linear time and only the first k elements are sorted,
+  // and when k is close to n the whole copy is sorted. Larger elements are
+  // more expensive to copy so they keep the heap up to a larger k.
+  template <typename T>
+  select_method
+  choose_select_method (octave_idx_type n, octave_idx_type k, select_method method)
+  {
+    if (method != select_method::automatic)
+      return method;
 
-        if (compute_index)
-          retval.append (octave_value (NDArray (dims_output)));
+    const octave_idx_type heap_fraction = sizeof (T) > 8 ? 32 : 64;
 
-        return retval;
-      }
+    if (k <= 16 || k <= n / heap_fraction)
+      return select_method::heap;
 
-    if (num == 0)
-      {
-        octave_value_list retval {octave_value (input)};
+    if (2 * k >= n)
+      return select_method::sort;
 
-        if (compute_index)
-          retval.append (octave_value (NDArray(dim_vector(num>0, num))));
+    return select_method::select;
+  }
 
-        return retval;
-      }
+  // runs fn (0) ... fn (n-1) in parallel, fn (0) in the calling thread.
+  // An exception of fn, or of starting a thread, is thrown again in the
+  // calling thread after all of the started threads have finished.
+  template <typename Fn>
+  void
+  run_parallel (octave_idx_type n, const Fn& fn)
+  {
+    std::vector<std::exception_ptr> errors (n);
 
-    if (num == 1)
+    auto guarded = [&] (octave_idx_type t)
       {
-        octave_value_list retval {octave_value (input)};
-
-        if (compute_index)
+        try
           {
-              retval.append (octave_value (1.0));
+            fn (t);
+          }
+        catch (...)
+          {
+            errors[t] = std::current_exception ();
           }
+      };
 
-        return retval;
-      }
+    std::vector<std::thread> workers;
 
-    k = std::min (k, num);
+    try
+      {
+        for (octave_idx_type t = 1; t < n; t++)
+          workers.emplace_back (guarded, t);
 
-    if (dim == 0)
+        guarded (0);
+      }
+    catch (...)
       {
-        octave_value_list retval {octave_value (input)};
+        errors[0] = std::current_exception ();
+      }
 
-        if (compute_index)
-          retval.append (octave_value (NDArray (dim_vector (num>0, num), 1.0)));
+    for (auto& w : workers)
+      w.join ();
 
-        return retval;
-      }
+    for (const auto& e : errors)
+      if (e)
+        std::rethrow_exception (e);
+  }
 
-    if (std::is_same<Comp,comp_abs>::value)
-      {
-        if ((base < 0 && input.elem(num-1) > 0) || (base > 0 && input.elem(num-1) < 0))
-          {
-            index_iterator it {0};
-            NDArray output(dim_vector (1, k));
-            NDArray second_output;
-            auto* output_data = output.fortran_vec ();
+  // copies the first elements of a range in sorted order to the output
+  // range like partial_sort_copy. The copy that is used by the selection
+  // is kept between the slices. With more than one thread the range is
+  // split in contiguous chunks whose first k elements are selected in
+  // parallel and merged.
+  template <typename T>
+  class k_selector
+  {
+  public:
 
-            if (!compute_index)
-              {
-                std::partial_sort_copy (it, it+num, output_data, output_data+k,
-                  [&input] (octave_idx_type a, octave_idx_type b)
-                  {
-                    auto A = std::make_pair(a, input.elem(a));
-                    auto B = std::make_pair(b, input.elem(b));
-                    return typename Comp::greater{} (A, B);
-                  }
-                );
+    k_selector (select_method method, octave_idx_type threads = 1)
+    : method (method), threads (threads) {}
 
-                for (octave_idx_type s = 0; s < k; s++)
-                  {
-                    output_data[s] = input.elem((octave_idx_type)output_data[s]);
-                  }
-              }
-            else
-              {
-                second_output = NDArray (dim_vector (1, k));
+  template <typename InputIt, typename OutputIt, typename Compare>
+    void operator () (InputIt first, InputIt last, OutputIt result_first, OutputIt result_last, Compare comp)
+    {
+      (*this) (first, last, result_first, result_last, comp, keep_all {});
+    }
 
-                auto * second_output_data = second_output.fortran_vec ();
+    // selects only the elements that are not skipped, in the same pass
+    // that reads the range. The first min (k, n - skipped) places of the
+    // output are written and the number of skipped elements is returned.
+  template <typename InputIt, typename OutputIt, typename Compare, typename Skip>
+    octave_idx_type operator () (InputIt first, InputIt last, OutputIt result_first, OutputIt result_last, Compare comp, Skip skip)
+    {
+      const octave_idx_type n = last - first;
 
-                std::partial_sort_copy (it, it+num, second_output_data, second_output_data + k,
-                  [&input] (octave_idx_type a, octave_idx_type b)
-                  {
-                    auto A = std::make_pair(a, input.elem(a));
-                    auto B = std::make_pair(b, input.elem(b));
-                    return typename Comp::greater{} (A, B);
-                  }
-                );
+      const octave_idx_type k = std::min<octave_idx_type> (result_last - result_first, n);
 
-                for (octave_idx_type s = 0; s < k; s++)
-                  {
-                    output_data[s] = input.elem((octave_idx_type)second_output_data[s]);
-                    ++second_output_data[s];
-                  }
-              }
-            if (!compute_index)
-              {
-                return ovl (octave_value (output));
-              }
-            else
-              {
-                return ovl (octave_value (output), octave_value (second_output));
-              }
-          }
+      if (threads > 1)
+        return select_chunks (first, n, result_first, k, comp, skip);
 
-        if (base < 0 || input.elem(num-1) < 0)
-          {
-            if (inc < 0)
-              {
-                octave_value_list retval {octave_value (Range (input.elem(num-1),input.elem(num-k),-inc))};
+      if (method == select_method::automatic && n >= sample_from && k > small_k && k <= n / 16)
+        {
+          octave_idx_type skipped = 0;
 
-                if (compute_index)
-                  {
-                    retval.append (octave_value (Range (num, num - k + 1, -1.0)));
-                  }
+          if (select_sampled (first, n, result_first, k, comp, skip, skipped))
+            return skipped;
+        }
 
-                return retval;
-              }
+      const select_method m = choose_select_method<T> (n, k, method);
+
+      if (m == select_method::heap)
+        {
+          // with k = 1 the heap is a single element already
+          if (method == select_method::automatic && k > 1 && k <= small_k)
+            return select_small (first, last, result_first, k, comp, skip);
+
+          return select_heap (first, last, result_first, k, comp, skip);
+        }
+
+      if (n > capacity)
+        {
+          buf.reset (new T[n]);
+
+          capacity = n;
+        }
+
+      T* data = buf.get ();
+
+      const octave_idx_type len = std::copy_if (first, last, data,
+        [&skip] (const T& a)
+        {
+          return ! skip (a);
+        }) - data;
+
+      const octave_idx_type kept = std::min (k, len);
+
+      // elements that have no radix keys are partitioned
+      if (m == select_method::select || m == select_method::radix)
+        {
+          std::nth_element (data, data + kept, data + len, comp);
+
+          std::sort (data, data + kept, comp);
+        }
+      else
+        std::sort (data, data + len, comp);
+
+      std::copy (data, data + kept, result_first);
+
+      return n - len;
+    }
+
+  private:
+
+    // largest k that is selected by select_small
+    static const octave_idx_type small_k = 16;
+
+    // shortest slice that is selected by select_sampled
+    static const octave_idx_type sample_from = 1 << 20;
+
+    struct keep_all
+    {
+    template <typename U>
+      bool operator () (const U&) const
+      {
+        return false;
+      }
+    };
+
+    // the heap of partial_sort_copy that is built in the output and only
+    // sees the elements that are not skipped
+  template <typename InputIt, typename OutputIt, typename Compare, typename Skip>
+    octave_idx_type select_heap (InputIt first, InputIt last, OutputIt result, octave_idx_type k, Compare comp, Skip skip)
+    {
+      octave_idx_type len = 0;
+
+      octave_idx_type skipped = 0;
+
+      for (; first != last; ++first)
+        {
+          const T a = *first;
+
+          if (skip (a))
+            {
+              skipped++;
+
+              continue;
+            }
+
+          if (len < k)
+            {
+              result[len++] = a;
+
+              if (len == k)
+                std::make_heap (result, result + k, comp);
+            }
+          else if (k > 0 && comp (a, result[0]))
+            replace_top (result, k, a, comp);
+        }
+
+      if (len < k)
+        std::make_heap (result, result + len, comp);
+
+      std::sort_heap (result, result + len, comp);
+
+      return skipped;
+    }
+
+    // for small k the selected elements are kept sorted in a local buffer
+    // and a new one is put in place by moving the greater ones, which is
+    // cheaper than the heap. Elements that are equal to a selected one do
+    // not enter it, so the order of the comparator is kept. In long slices
+    // the last selected element rarely changes after the first elements,
+    // so the rest are tested against it a run at a time in a loop without
+    // branches that the compiler can vectorize, and the runs that have no
+    // element that can enter the buffer are skipped.
+  template <typename InputIt, typename OutputIt, typename Compare, typename Skip>
+    octave_idx_type select_small (InputIt first, InputIt last, OutputIt result, octave_idx_type k, Compare comp, Skip skip)
+    {
+      // number of elements that are tested together
+      const octave_idx_type run = 16;
+
+      // elements that are put one at a time before testing runs
+      const octave_idx_type filter_from = 256;
+
+      T top[small_k];
+
+      octave_idx_type len = 0;
+
+      octave_idx_type skipped = 0;
+
+      const octave_idx_type n = last - first;
+
+      for (octave_idx_type c = 0; c < n;)
+        {
+          octave_idx_type end = n;
+
+          if (c < filter_from)
+            end = std::min (n, filter_from);
+          else if (len == k && n - c >= run)
+            {
+              InputIt next = first;
+
+              bool any = false;
+
+              for (octave_idx_type r = 0; r < run; r++, ++next)
+                {
+                  const T a = *next;
+
+                  any |= comp (a, top[k - 1]) | skip (a);
+                }
+
+              if (! any)
+                {
+                  first += run;
+
+                  c += run;
+
+                  continue;
+                }
+
+              end = c + run;
+            }
+
+          for (; c < end; c++, ++first)
+            {
+              const T a = *first;
+
+              if (skip (a))
+                {
+                  skipped++;
+
+                  continue;
+                }
+
+              if (len == k)
+                {
+                  if (! comp (a, top[k - 1]))
+                    continue;
+
+                  len--;
+                }
+
+              octave_idx_type p = len++;
+
+              for (; p > 0 && comp (a, top[p - 1]); p--)
+                top[p] = top[p - 1];
+
+              top[p] = a;
+            }
+        }
+
+      std::copy (top, top + len, result);
+
+      return skipped;
+    }
+
+    // for long slices the element of a random sample that has a bit more
+    // than k * size / n sampled elements before it is a threshold that
+    // likely has more than k elements of the slice before it. The elements
+    // that are not after it are copied in one pass, with one comparison for
+    // most of them, and only they are selected. The result is exact. It
+    // returns false and the slice is selected as usual if the threshold
+    // has fewer than k elements before it, or many more than expected.
+  template <typename InputIt, typename OutputIt, typename Compare, typename Skip>
+    bool select_sampled (InputIt first, octave_idx_type n, OutputIt result, octave_idx_type k, Compare comp, Skip skip, octave_idx_type& skipped)
+    {
+      const octave_idx_type size = std::min (n / 16, 16 * k + 1024);
+
+      std::unique_ptr<T[]> sample {new T[size]};
+
+      std::mt19937_64 gen (n);
+
+      octave_idx_type len = 0;
+
+      for (octave_idx_type s = 0; s < size; s++)
+        {
+          InputIt it = first;
+
+          it += gen () % n;
+
+          const T a = *it;
+
+          if (! skip (a))
+            sample[len++] = a;
+        }
+
+      const double mean = double (k) * size / n;
+
+      const octave_idx_type rank = mean + 3 * std::sqrt (mean) + 4;
+
+      if (rank >= len)
+        return false;
+
+      std::nth_element (sample.get (), sample.get () + rank, sample.get () + len, comp);
+
+      const T threshold = sample[rank];
+
+      const octave_idx_type limit = std::min<double> (n, 4.0 * (rank + 1) * n / size + k);
+
+      std::unique_ptr<T[]> candidates {new T[limit]};
+
+      octave_idx_type count = 0;
+
+      octave_idx_type nans = 0;
+
+      for (octave_idx_type c = 0; c < n; c++, ++first)
+        {
+          const T a = *first;
+
+          if (skip (a))
+            {
+              nans++;
+
+              continue;
+            }
+
+          if (comp (threshold, a))
+            continue;
+
+          if (count == limit)
+            return false;
+
+          candidates[count++] = a;
+        }
+
+      if (count < k)
+        return false;
+
+      std::nth_element (candidates.get (), candidates.get () + k, candidates.get () + count, comp);
+
+      std::sort (candidates.get (), candidates.get () + k, comp);
+
+      std::copy (candidates.get (), candidates.get () + k, result);
+
+      skipped = nans;
+
+      return true;
+    }
+
+    // puts a in place of the top of the heap and sifts it down
+  template <typename RandomIt, typename Compare>
+    static void replace_top (RandomIt heap, octave_idx_type len, const T& a, Compare comp)
+    {
+      octave_idx_type hole = 0;
+
+      for (octave_idx_type child = 1; child < len; child = 2 * hole + 1)
+        {
+          if (child + 1 < len && comp (heap[child], heap[child + 1]))
+            child++;
+
+          if (! comp (a, heap[child]))
+            break;
+
+          heap[hole] = heap[child];
+
+          hole = child;
+        }
+
+      heap[hole] = a;
+    }
+
+    // The chunks are merged by taking the least of their first remaining
+    // elements, the one of the earlier chunk if they are equal. So when the
+    // comparator breaks ties by index the result is the same as with one
+    // thread.
+  template <typename InputIt, typename OutputIt, typename Compare, typename Skip>
+    octave_idx_type select_chunks (InputIt first, octave_idx_type n, OutputIt result, octave_idx_type k, Compare comp, Skip skip)
+    {
+      const octave_idx_type chunk = (n + threads - 1) / threads;
+
+      // chunk t keeps its first elements at part + t * k
+      std::unique_ptr<T[]> part {new T[threads * k]};
+
+      std::vector<octave_idx_type> len (threads, 0);
+
+      std::vector<octave_idx_type> skipped (threads, 0);
+
+      run_parallel (threads, [&] (octave_idx_type t)
+        {
+          const octave_idx_type chunk_n = std::max<octave_idx_type> (0, std::min (n - t * chunk, chunk));
+
+          if (chunk_n == 0)
+            return;
+
+          k_selector<T> selector (method);
+
+          // operator + of the iterators changes them for a moment, so each
+          // thread moves its own copy
+          InputIt chunk_first = first;
+
+          chunk_first += t * chunk;
+
+          const octave_idx_type chunk_k = std::min (k, chunk_n);
+
+          skipped[t] = selector (chunk_first, chunk_first + chunk_n, part.get () + t * k, part.get () + t * k + chunk_k, comp, skip);
+
+          len[t] = std::min (chunk_k, chunk_n - skipped[t]);
+        });
+
+      std::vector<octave_idx_type> head (threads, 0);
+
+      for (octave_idx_type s = 0; s < k; s++)
+        {
+          octave_idx_type best = -1;
+
+          for (octave_idx_type t = 0; t < threads; t++)
+            if (head[t] < len[t]
+                && (best < 0 || comp (part[t * k + head[t]], part[best * k + head[best]])))
+              best = t;
+
+          if (best < 0)
+            break;
+
+          *result++ = part[best * k + head[best]++];
+        }
+
+      return std::accumulate (skipped.begin (), skipped.end (), octave_idx_type (0));
+    }
+
+    const select_method method;
+
+    const octave_idx_type threads;
+
+    std::unique_ptr<T[]> buf;
+
+    octave_idx_type capacity = 0;
+  };
+
+  // selects the k first elements of a slice in one pass that leaves out
+  // nan. greater_nan orders nan before all other elements, so only if the
+  // slice has nan the selected elements are moved back and the first nan
+  // elements in index order are put before them.
+template <typename T, typename InputIt, typename OutputIt, typename Compare, typename IsNan>
+  void
+  select_with_nan (k_selector<T>& selector, InputIt first, InputIt last, OutputIt result, octave_idx_type k, Compare comp, IsNan is_nan)
+  {
+    const octave_idx_type nans = std::min (k, selector (first, last, result, result + k, comp, is_nan));
+
+    if (nans == 0)
+      return;
+
+    std::copy_backward (result, result + (k - nans), result + k);
+
+    for (octave_idx_type s = 0; s < nans; ++first)
+      if (is_nan (*first))
+        result[s++] = *first;
+  }
+
+  // number of threads for sz slices of n elements. By default a thread is
+  // started only for every 2^18 elements of the input.
+  octave_idx_type
+  slice_threads (octave_idx_type sz, octave_idx_type n, const options& opt)
+  {
+    octave_idx_type threads = opt.threads;
+
+    if (threads == 0)
+      threads = std::min<octave_idx_type> (std::thread::hardware_concurrency (), sz * n / (1 << 18));
+
+    return std::max<octave_idx_type> (1, std::min (threads, sz));
+  }
+
+  // threads that split a single slice of n elements when the k first
+  // elements are wanted. Each chunk should be much longer than k, otherwise
+  // merging the chunks costs more than it saves.
+  octave_idx_type
+  chunk_threads (octave_idx_type n, octave_idx_type k, const options& opt)
+  {
+    const octave_idx_type threads = slice_threads (n, 1, opt);
+
+    return std::max<octave_idx_type> (1, std::min (threads, n / (4 * std::max<octave_idx_type> (k, 1))));
+  }
+
+  // calls fn (first, last) for blocks of the slices [0, sz) of n elements.
+  // Each thread takes a contiguous range of the slices, so the threads are
+  // started once. Each block is a disjoint part of the output and fn keeps
+  // its own buffers. Interrupts are checked in the calling thread after
+  // each of its blocks, an interrupt or an exception of a thread makes the
+  // other threads stop after their current block.
+  template <typename Fn>
+  void
+  for_each_block (octave_idx_type sz, octave_idx_type n, octave_idx_type threads, const Fn& fn)
+  {
+    const octave_idx_type block = std::max<octave_idx_type> (1, (1 << 16) / std::max<octave_idx_type> (n, 1));
+
+    std::atomic<bool> stop {false};
+
+    auto run_range = [&] (octave_idx_type t)
+      {
+        const octave_idx_type last = sz * (t + 1) / threads;
+
+        try
+          {
+            for (octave_idx_type base = sz * t / threads; base < last && ! stop; base += block)
+              {
+                fn (base, std::min (base + block, last));
+
+                if (t == 0)
+                  OCTAVE_QUIT;
+              }
+          }
+        catch (...)
+          {
+            stop = true;
+
+            throw;
+          }
+      };
+
+    if (threads == 1)
+      run_range (0);
+    else
+      run_parallel (threads, run_range);
+  }
+
+  // order preserving unsigned key of a floating point value. nan is the
+  // greatest key like in less_nan and -0 and 0 have the same key. With
+  // 'abs' the sign is dropped.
+  template <typename U, typename T>
+  U
+  float_key (T x, bool by_abs)
+  {
+    const U sign = U (1) << (8 * sizeof (U) - 1);
+
+    if (octave::math::isnan (x))
+      return ~U (0);
+
+    if (x == 0)
+      return by_abs ? 0 : sign;
+
+    U bits;
+
+    std::memcpy (&bits, &x, sizeof (U));
+
+    if (by_abs)
+      return bits & ~sign;
+
+    return (bits & sign) ? ~bits : (bits | sign);
+  }
+
+  // element types whose comparison is the comparison of unsigned keys
+  template <typename T>
+  struct radix_key
+  {
+    static const bool value = false;
+  };
+
+  template <>
+  struct radix_key<double>
+  {
+    static const bool value = true;
+
+    using type = uint64_t;
+
+    static type
+    encode (double x, bool by_abs)
+    {
+      return float_key<type> (x, by_abs);
+    }
+  };
+
+  template <>
+  struct radix_key<float>
+  {
+    static const bool value = true;
+
+    using type = uint32_t;
+
+    static type
+    encode (float x, bool by_abs)
+    {
+      return float_key<type> (x, by_abs);
+    }
+  };
+
+  // order preserving unsigned key of an integer. With 'abs' it is the key
+  // of the saturated abs like in the comparators.
+  template <typename U, typename T>
+  U
+  int_key (const octave_int<T>& x, bool by_abs)
+  {
+    if (! std::is_signed<T>::value)
+      return static_cast<U> (x.value ());
+
+    if (by_abs)
+      return static_cast<U> (abs (x).value ());
+
+    return static_cast<U> (x.value ()) ^ (U (1) << (8 * sizeof (U) - 1));
+  }
+
+  template <typename T>
+  struct radix_key<octave_int<T>>
+  {
+    static const bool value = sizeof (T) <= 2;
+
+    using type = typename std::conditional<sizeof (T) == 1, uint8_t, uint16_t>::type;
+
+    static type
+    encode (const octave_int<T>& x, bool by_abs)
+    {
+      return int_key<type> (x, by_abs);
+    }
+  };
+
+  // char is compared as unsigned char by all of the methods
+  template <>
+  struct radix_key<char>
+  {
+    static const bool value = true;
+
+    using type = uint8_t;
+
+    static type
+    encode (char x, bool)
+    {
+      return static_cast<unsigned char> (x);
+    }
+  };
+
+  template <>
+  struct radix_key<bool>
+  {
+    static const bool value = true;
+
+    using type = uint8_t;
+
+    static type
+    encode (bool x, bool)
+    {
+      return x;
+    }
+  };
+
+  // finds the indexes of the k least keys of a slice in the order of
+  // (key, index). The threshold key is found a byte at a time from the
+  // most significant one with histograms of the keys that share the bytes
+  // found so far. The keys below the threshold and the first keys equal
+  // to it are gathered in index order and sorted by a stable LSD radix
+  // sort.
+  template <typename U>
+  class radix_selector
+  {
+  public:
+
+    void
+    operator () (const U* keys, octave_idx_type n, octave_idx_type k, octave_idx_type* result)
+    {
+      if (sizeof (U) == 1)
+        {
+          count_bytes (keys, n, k, result);
+
+          return;
+        }
+
+      const U* data = keys;
+
+      octave_idx_type m = n;
+
+      U prefix = 0;
+
+      U mask = 0;
+
+      // number of keys that are less than prefix
+      octave_idx_type below = 0;
+
+      for (int shift = 8 * sizeof (U) - 8; shift >= 0; shift -= 8)
+        {
+          octave_idx_type count[256] = {0};
+
+          for (octave_idx_type i = 0; i < m; i++)
+            if ((data[i] & mask) == prefix)
+              count[(data[i] >> shift) & 255]++;
+
+          int d = 0;
+
+          while (below + count[d] < k)
+            below += count[d++];
+
+          prefix |= U (d) << shift;
+
+          mask |= U (255) << shift;
+
+          // all of the keys with the prefix are taken
+          if (below + count[d] == k)
+            break;
+
+          if (count[d] < m)
+            {
+              // the keys with the prefix are moved to the front of the
+              // candidates, in place when they are the candidates already
+              if (data == keys)
+                candidates.resize (count[d]);
+
+              octave_idx_type w = 0;
+
+              for (octave_idx_type i = 0; i < m; i++)
+                if ((data[i] & mask) == prefix)
+                  candidates[w++] = data[i];
+
+              candidates.resize (w);
+
+              data = candidates.data ();
+
+              m = w;
+            }
+        }
+
+      const U last = prefix | ~mask;
+
+      octave_idx_type quota = k - below;
+
+      selected.clear ();
+
+      for (octave_idx_type i = 0; i < n; i++)
+        if (keys[i] < prefix || (keys[i] <= last && quota-- > 0))
+          selected.emplace_back (keys[i], i);
+
+      sort_selected ();
+
+      for (octave_idx_type s = 0; s < k; s++)
+        result[s] = selected[s].second;
+    }
+
+  private:
+
+    // a counting sort of single byte keys that keeps the first k places.
+    // The histogram gives the place of the first index of each key and the
+    // indexes are placed in index order so no comparison is needed.
+    void
+    count_bytes (const U* keys, octave_idx_type n, octave_idx_type k, octave_idx_type* result)
+    {
+      octave_idx_type place[256] = {0};
+
+      for (octave_idx_type i = 0; i < n; i++)
+        place[keys[i]]++;
+
+      octave_idx_type sum = 0;
+
+      for (int d = 0; d < 256; d++)
+        {
+          const octave_idx_type count = place[d];
+
+          place[d] = sum;
+
+          sum += count;
+        }
+
+      for (octave_idx_type i = 0; i < n; i++)
+        {
+          const octave_idx_type p = place[keys[i]]++;
+
+          if (p < k)
+            result[p] = i;
+        }
+    }
+
+    void
+    sort_selected ()
+    {
+      const size_t k = selected.size ();
+
+      if (k < 256)
+        {
+          std::sort (selected.begin (), selected.end ());
+
+          return;
+        }
+
+      buffer.resize (k);
+
+      for (int shift = 0; shift < 8 * int (sizeof (U)); shift += 8)
+        {
+          size_t count[257] = {0};
+
+          for (const auto& x : selected)
+            count[((x.first >> shift) & 255) + 1]++;
+
+          // the byte is the same in all of the keys
+          if (*std::max_element (count + 1, count + 257) == k)
+            continue;
+
+          for (int d = 0; d < 256; d++)
+            count[d + 1] += count[d];
+
+          for (const auto& x : selected)
+            buffer[count[(x.first >> shift) & 255]++] = x;
+
+          selected.swap (buffer);
+        }
+    }
+
+    std::vector<U> candidates;
+
+    std::vector<std::pair<U, octave_idx_type>> selected;
+
+    std::vector<std::pair<U, octave_idx_type>> buffer;
+  };
+
+  // radix selection is used for long slices when the heap would not be
+  // chosen or for single byte keys, or when it is requested
+  template <typename T>
+  bool
+  use_radix (octave_idx_type sz, octave_idx_type n, octave_idx_type k, const options& opt)
+  {
+    if (opt.algorithm == select_method::radix)
+      return true;
+
+    if (opt.algorithm != select_method::automatic)
+      return false;
+
+    // a single long slice is split between threads by k_selector instead
+    if (sz == 1 && chunk_threads (n, k, opt) > 1)
+      return false;
+
+    // single bytes are counted in two passes for any k
+    if (sizeof (typename radix_key<T>::type) == 1)
+      return n >= 64;
+
+    return n >= 1024 && choose_select_method<T> (n, k, opt.algorithm) != select_method::heap;
+  }
+
+  template <typename Comp>
+  octave_value_list
+  do_maxk (const Range& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    auto base = input.base ();
+    auto inc = input.inc ();
+    auto num = input.numel ();
+
+    if (dim > 1)
+      {
+        if (k == 0)
+          {
+            dim_vector dims_output (num>0, num);
+
+            dims_output.resize (dim + 1, 1);
+
+            dims_output (dim) = k;
+
+            octave_value_list retval {octave_value (NDArray (dims_output))};
+
+            if (compute_index)
+              retval.append (octave_value (NDArray (dims_output)));
+
+            return retval;
+          }
+
+        octave_value_list retval {octave_value (input)};
+
+        if (compute_index)
+          retval.append (octave_value (NDArray (dim_vector (num>0, num), 1)));
+
+        return retval;
+      }
+
+    if (k == 0)
+      {
+        dim_vector dims_output (1, num);
+
+        dims_output (dim) = k;
+
+        octave_value_list retval {octave_value (NDArray (dims_output))};
+
+        if (compute_index)
+          retval.append (octave_value (NDArray (dims_output)));
+
+        return retval;
+      }
+
+    if (num == 0)
+      {
+        octave_value_list retval {octave_value (input)};
+
+        if (compute_index)
+          retval.append (octave_value (NDArray(dim_vector(num>0, num))));
+
+        return retval;
+      }
+
+    if (num == 1)
+      {
+        octave_value_list retval {octave_value (input)};
+
+        if (compute_index)
+          {
+              retval.append (octave_value (1.0));
+          }
+
+        return retval;
+      }
+
+    k = std::min (k, num);
+
+    if (dim == 0)
+      {
+        octave_value_list retval {octave_value (input)};
+
+        if (compute_index)
+          retval.append (octave_value (NDArray (dim_vector (num>0, num), 1.0)));
+
+        return retval;
+      }
+
+    if (std::is_same<Comp,comp_abs>::value)
+      {
+        if ((base < 0 && input.elem(num-1) > 0) || (base > 0 && input.elem(num-1) < 0))
+          {
+            index_iterator it {0};
+            k_selector<octave_idx_type> selector (opt.algorithm);
+            NDArray output(dim_vector (1, k));
+            NDArray second_output;
+            auto* output_data = output.fortran_vec ();
+
+            if (!compute_index)
+              {
+                selector (it, it+num, output_data, output_data+k,
+                  [&input] (octave_idx_type a, octave_idx_type b)
+                  {
+                    auto A = std::make_pair(a, input.elem(a));
+                    auto B = std::make_pair(b, input.elem(b));
+                    return typename Comp::greater{} (A, B);
+                  }
+                );
+
+                for (octave_idx_type s = 0; s < k; s++)
+                  {
+                    output_data[s] = input.elem((octave_idx_type)output_data[s]);
+                  }
+              }
+            else
+              {
+                second_output = NDArray (dim_vector (1, k));
+
+                auto * second_output_data = second_output.fortran_vec ();
+
+                selector (it, it+num, second_output_data, second_output_data + k,
+                  [&input] (octave_idx_type a, octave_idx_type b)
+                  {
+                    auto A = std::make_pair(a, input.elem(a));
+                    auto B = std::make_pair(b, input.elem(b));
+                    return typename Comp::greater{} (A, B);
+                  }
+                );
+
+                for (octave_idx_type s = 0; s < k; s++)
+                  {
+                    output_data[s] = input.elem((octave_idx_type)second_output_data[s]);
+                    ++second_output_data[s];
+                  }
+              }
+            if (!compute_index)
+              {
+                return ovl (octave_value (output));
+              }
+            else
+              {
+                return ovl (octave_value (output), octave_value (second_output));
+              }
+          }
+
+        if (base < 0 || input.elem(num-1) < 0)
+          {
+            if (inc < 0)
+              {
+                octave_value_list retval {octave_value (Range (input.elem(num-1),input.elem(num-k),-inc))};
+
+                if (compute_index)
+                  {
+                    retval.append (octave_value (Range (num, num - k + 1, -1.0)));
+                  }
+
+                return retval;
+              }
 
             if (inc > 0)
               {
@@ -1503,7 +2628,7 @@ template<typename Type>
 
   template <typename Comp, typename sparse_matrix>
   octave_value_list
-  do_maxk_sparse (const sparse_matrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk_sparse (const sparse_matrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     auto dims_input = input_matrix.dims ();
 
@@ -1660,133 +2785,140 @@ template<typename Type>
 
     typename sparse_matrix::element_type * odata = output.xdata ();
 
-    octave_idx_type j = 0;
+    // the work is the number of stored elements, not the dense size
+    const octave_idx_type per_col = cols > 0 ? (cidx[cols] + cols - 1) / cols : 0;
+
+    const octave_idx_type threads = slice_threads (cols, per_col, opt);
 
     if (! compute_index)
-      for (octave_idx_type i = 0 ; i < cols; i++)
+      for_each_block (cols, per_col, threads, [&] (octave_idx_type first, octave_idx_type last)
         {
-          auto no = ocidx[i+1] - ocidx[i];
+          k_selector<typename sparse_matrix::element_type> selector (opt.algorithm);
 
-          auto pos = std::min(positives[i], no);
+          for (octave_idx_type i = first ; i < last; i++)
+            {
+              octave_idx_type j = ocidx[i];
 
-          auto zer = k - no;
+              auto no = ocidx[i+1] - ocidx[i];
 
-          if (! has_nan (idata + cidx[i], idata + cidx [i+1]))
-            std::partial_sort_copy (idata + cidx[i], idata + cidx [i+1], odata + j, odata + j + no, typename Comp::greater {});
-          else
-            std::partial_sort_copy (idata + cidx[i], idata + cidx [i+1], odata + j, odata + j + no, typename Comp::greater_nan {});
+              auto pos = std::min(positives[i], no);
 
-          for (octave_idx_type s = 0; s < pos;s++)
-            oridx[j++] = s;
+              auto zer = k - no;
 
-          for (octave_idx_type s = pos+zer; s < k;s++)
-            oridx[j++] = s;
+              if (! has_nan (idata + cidx[i], idata + cidx [i+1]))
+                selector (idata + cidx[i], idata + cidx [i+1], odata + j, odata + j + no, typename Comp::greater {});
+              else
+                selector (idata + cidx[i], idata + cidx [i+1], odata + j, odata + j + no, strict_order<typename Comp::greater_nan> {});
 
-          OCTAVE_QUIT;
-        }
+              for (octave_idx_type s = 0; s < pos;s++)
+                oridx[j++] = s;
+
+              for (octave_idx_type s = pos+zer; s < k;s++)
+                oridx[j++] = s;
+            }
+        });
 
     NDArray second_output;
 
     if (compute_index)
       {
-        auto idata_col = idata;
-        auto ridx_col = ridx;
         if (should_transpose)
           second_output = NDArray(dim_vector(cols , k));
         else
           second_output = NDArray(dim_vector(k , cols));
 
-        double * second_data = second_output.fortran_vec ();
+        double * second_output_data = second_output.fortran_vec ();
 
         const octave_idx_type offset = should_transpose ? cols : 1;
         const octave_idx_type next_block = should_transpose ? 1 : k;
 
-        for (octave_idx_type i = 0 ; i < cols; i++)
+        for_each_block (cols, per_col, threads, [&] (octave_idx_type first, octave_idx_type last)
           {
-            const auto no = ocidx[i+1] - ocidx[i];
-            const auto ni = cidx[i+1] - cidx[i];
-            const auto pos = std::min(positives[i], no);
-            const auto zer = k - no;
-
-            const auto idx_bound = (zer+pos)*offset;
-
-            index_iterator colit (0);
-            if (! has_nan (idata_col , idata_col + ni))
-              std::partial_sort_copy (colit, colit+ni, oridx + j, oridx + j + no,
-                [&idata_col] (octave_idx_type a, octave_idx_type b)
-                {
-                  auto A = std::make_pair(a, idata_col[a]);
-                  auto B = std::make_pair(b, idata_col[b]);
-                  return typename Comp::greater {} (A, B);
-                }
-              );
-            else
-              std::partial_sort_copy (colit, colit+ni, oridx + j, oridx + j + no,
-                [&idata_col] (octave_idx_type a, octave_idx_type b)
-                {
-                  auto A = std::make_pair(a, idata_col[a]);
-                  auto B = std::make_pair(b, idata_col[b]);
-                  return typename Comp::greater_nan {} (A, B);
-                }
-              );
+            k_selector<octave_idx_type> selector (opt.algorithm);
 
-            octave_idx_type ct = 0;
-
-            for (octave_idx_type s = 0; s < pos;s++)
+            for (octave_idx_type i = first ; i < last; i++)
               {
-                odata[j] = idata_col[oridx[j]];
-                second_data[ct] = ridx_col[oridx[j]]+1;
-                oridx[j++] = s;
-                ct += offset;
-              }
+                octave_idx_type j = ocidx[i];
+                double * second_data = second_output_data + i * next_block;
+                const auto idata_col = idata + cidx[i];
+                const auto ridx_col = ridx + cidx[i];
+                const auto no = ocidx[i+1] - ocidx[i];
+                const auto ni = cidx[i+1] - cidx[i];
+                const auto pos = std::min(positives[i], no);
+                const auto zer = k - no;
+
+                const auto idx_bound = (zer+pos)*offset;
+
+                index_iterator colit (0);
+                if (! has_nan (idata_col , idata_col + ni))
+                  selector (colit, colit+ni, oridx + j, oridx + j + no,
+                    [&idata_col] (octave_idx_type a, octave_idx_type b)
+                    {
+                      auto A = std::make_pair(a, idata_col[a]);
+                      auto B = std::make_pair(b, idata_col[b]);
+                      return typename Comp::greater {} (A, B);
+                    }
+                  );
+                else
+                  selector (colit, colit+ni, oridx + j, oridx + j + no,
+                    [&idata_col] (octave_idx_type a, octave_idx_type b)
+                    {
+                      auto A = std::make_pair(a, idata_col[a]);
+                      auto B = std::make_pair(b, idata_col[b]);
+                      return typename Comp::greater_nan {} (A, B);
+                    }
+                  );
 
-            if (ni > 0)
-              for (octave_idx_type s = 0; s < ridx_col[0] && ct < idx_bound; s++)
-                {
-                  second_data[ct] = s+1;
-                  ct += offset;
-                }
-            else
-              for (octave_idx_type s = 0; s < k && ct < idx_bound; s++)
-                {
-                  second_data[ct] = s+1;
-                  ct += offset;
-                }
+                octave_idx_type ct = 0;
 
-            for (octave_idx_type s = 0; s < ni-1; s++)
-              {
-                for (octave_idx_type w = ridx_col[s] + 1; w < ridx_col[s+1] && ct < idx_bound; w++)
+                for (octave_idx_type s = 0; s < pos;s++)
                   {
-                    second_data[ct] = w+1;
+                    odata[j] = idata_col[oridx[j]];
+                    second_data[ct] = ridx_col[oridx[j]]+1;
+                    oridx[j++] = s;
                     ct += offset;
                   }
-              }
 
-            if (ni > 0)
-              for (octave_idx_type s = ridx_col[ni-1] + 1; s < rows && ct < idx_bound; s++)
-                {
-                  second_data[ct] = s+1;
-                  ct += offset;
-                }
+                if (ni > 0)
+                  for (octave_idx_type s = 0; s < ridx_col[0] && ct < idx_bound; s++)
+                    {
+                      second_data[ct] = s+1;
+                      ct += offset;
+                    }
+                else
+                  for (octave_idx_type s = 0; s < k && ct < idx_bound; s++)
+                    {
+                      second_data[ct] = s+1;
+                      ct += offset;
+                    }
 
-            for (octave_idx_type s = pos+zer; s < k;s++)
-              {
-                odata[j] = idata_col[oridx[j]];
-                second_data[ct] = ridx_col[oridx[j]]+1;
-                oridx[j++] = s;
-                ct += offset;
-              }
+                for (octave_idx_type s = 0; s < ni-1; s++)
+                  {
+                    for (octave_idx_type w = ridx_col[s] + 1; w < ridx_col[s+1] && ct < idx_bound; w++)
+                      {
+                        second_data[ct] = w+1;
+                        ct += offset;
+                      }
+                  }
 
-            second_data += next_block;
-            idata_col += ni;
-            ridx_col += ni;
+                if (ni > 0)
+                  for (octave_idx_type s = ridx_col[ni-1] + 1; s < rows && ct < idx_bound; s++)
+                    {
+                      second_data[ct] = s+1;
+                      ct += offset;
+                    }
 
-            OCTAVE_QUIT;
-          }
+                for (octave_idx_type s = pos+zer; s < k;s++)
+                  {
+                    odata[j] = idata_col[oridx[j]];
+                    second_data[ct] = ridx_col[oridx[j]]+1;
+                    oridx[j++] = s;
+                    ct += offset;
+                  }
+              }
+          });
       }
 
-    assert (j == nout);
-
     input = sparse_matrix ();
 
     octave_value_list retval (octave_value(should_transpose ? output.transpose () : output));
@@ -1799,21 +2931,21 @@ template<typename Type>
 
   template <typename Comp>
   octave_value_list
-  do_maxk(const SparseMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk(const SparseMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_sparse <Comp>(input_matrix, k, dim, compute_index);
+    return do_maxk_sparse <Comp>(input_matrix, k, dim, compute_index, opt);
   }
 
   template <typename Comp>
   octave_value_list
-  do_maxk(const SparseComplexMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk(const SparseComplexMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_sparse <Comp>(input_matrix, k, dim, compute_index);
+    return do_maxk_sparse <Comp>(input_matrix, k, dim, compute_index, opt);
   }
 
   template <typename Comp>
   octave_value_list
-  do_maxk(const SparseBoolMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk(const SparseBoolMatrix& input_matrix, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     auto dims_input = input_matrix.dims ();
 
@@ -2041,7 +3173,7 @@ template<typename Type>
 
 template <typename Comp>
   octave_value_list
-  do_maxk (const PermMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk (const PermMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     dim_vector dims = input.dims ();
 
@@ -2164,7 +3296,7 @@ template <typename Comp>
 
 template <typename Comp, typename diag_matrix>
   octave_value_list
-  do_maxk_diag (const diag_matrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk_diag (const diag_matrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     dim_vector dims = input.dims ();
 
@@ -2403,35 +3535,35 @@ template <typename Comp, typename diag_matrix>
 
 template <typename Comp>
   octave_value_list
-  do_maxk (const DiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk (const DiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_diag <Comp>(input, k, dim, compute_index);
+    return do_maxk_diag <Comp>(input, k, dim, compute_index, opt);
   }
 
 template <typename Comp>
   octave_value_list
-  do_maxk (const FloatDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk (const FloatDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_diag <Comp>(input, k, dim, compute_index);
+    return do_maxk_diag <Comp>(input, k, dim, compute_index, opt);
   }
 
 template <typename Comp>
   octave_value_list
-  do_maxk (const ComplexDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk (const ComplexDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_diag <Comp>(input, k, dim, compute_index);
+    return do_maxk_diag <Comp>(input, k, dim, compute_index, opt);
   }
 
 template <typename Comp>
   octave_value_list
-  do_maxk (const FloatComplexDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk (const FloatComplexDiagMatrix& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
-    return do_maxk_diag <Comp>(input, k, dim, compute_index);
+    return do_maxk_diag <Comp>(input, k, dim, compute_index, opt);
   }
 
 template <typename Comp,typename ArrayType>
   octave_value_list
-  do_maxk_vec_stable(const ArrayType& input, octave_idx_type k , octave_idx_type dim)
+  do_maxk_vec_stable(const ArrayType& input, octave_idx_type k , octave_idx_type dim, const options& opt)
   {
     auto dims_input = input.dims ();
 
@@ -2447,53 +3579,52 @@ template <typename Comp,typename ArrayType>
 
     typename ArrayType::element_type* output_data = output.fortran_vec ();
 
-    std::vector <octave_idx_type> buf (k);
+    const octave_idx_type sz = input.numel () / dims_input (dim);
+
+    // a single slice is split between the threads instead
+    const octave_idx_type threads = sz == 1 ? chunk_threads (dims_input (dim), dims_output (dim), opt) : 1;
 
-    for (const typename ArrayType::element_type* i = input_data; i < input_data + input.numel (); i+=dims_input (dim))
+    for_each_block (sz, dims_input (dim), slice_threads (sz, dims_input (dim), opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        if (! has_nan (i, i+dims_input (dim)))
+        std::vector <octave_idx_type> buf (k);
+
+        k_selector<octave_idx_type> selector (opt.algorithm, threads);
+
+        for (octave_idx_type j = first; j < last; j++)
           {
+            const typename ArrayType::element_type* i = input_data + j * dims_input (dim);
+
+            typename ArrayType::element_type* o = output_data + j * dims_output (dim);
+
             index_iterator it{0};
 
-            std::partial_sort_copy (it, it +dims_input (dim), buf.begin (), buf.end (), [i]
+            select_with_nan (selector, it, it + dims_input (dim), buf.begin (), dims_output (dim), [i]
               (octave_idx_type a, octave_idx_type b)
               {
                 auto A = std::make_pair(a, i[a]);
                 auto B = std::make_pair(b, i[b]);
                 return typename Comp::greater{} (A, B);
+              },
+              [i] (octave_idx_type a)
+              {
+                return typename Comp::is_nan {} (i[a]);
               }
             );
-          }
-        else
-          {
-            index_iterator it{0};
 
-            std::partial_sort_copy (it, it+dims_input (dim), buf.begin (), buf.end (), [i]
-              (octave_idx_type a, octave_idx_type b)
+            for (octave_idx_type s = 0; s < dims_output (dim); s++)
               {
-                auto A = std::make_pair(a, i[a]);
-                auto B = std::make_pair(b, i[b]);
-                return typename Comp::greater_nan{} (A, B);
+                o[s] = i[buf[s]];
               }
-            );
-          }
-
-        for (octave_idx_type s = 0; s < dims_output (dim); s++)
-          {
-            output_data[s] = i[buf[s]];
           }
-
-        output_data += dims_output (dim);
-
-        OCTAVE_QUIT;
-      }
+      });
 
     return ovl (octave_value (output));
   }
 
 template <typename Comp, typename ArrayType>
   octave_value_list
-  do_maxk_stable(const ArrayType& input, octave_idx_type k , octave_idx_type dim)
+  do_maxk_stable(const ArrayType& input, octave_idx_type k , octave_idx_type dim, const options& opt)
   {
     auto dims_input = input.dims ();
 
@@ -2534,16 +3665,13 @@ template <typename Comp, typename ArrayType>
 
     if (dim == 0 || dims_input.is_nd_vector ())
       {
-        return do_maxk_vec_stable<Comp> (input, k, dim);
+        return do_maxk_vec_stable<Comp> (input, k, dim, opt);
       }
 
     octave_idx_type sz = input.numel () / dims_input (dim);
 
     ArrayType output (dims_output);
 
-    start_elem_indexer input_indexer (dims_input, k, dim);
-    start_elem_indexer output_indexer (dims_output, k, dim);
-
     octave_idx_type offset_input = compute_offset (dims_input, dim);
 
     octave_idx_type offset_output = compute_offset (dims_output, dim);
@@ -2552,43 +3680,45 @@ template <typename Comp, typename ArrayType>
 
     typename ArrayType::element_type* output_data = output.fortran_vec ();
 
-    std::vector <std::pair<octave_idx_type, typename ArrayType::element_type>> buf (dims_output (dim));
+    const octave_idx_type n = dims_input (dim);
 
-    const bool contain_nan = has_nan (input_data, input_data+input.numel ());
+    const octave_idx_type block = gather_count<typename ArrayType::element_type> (n, offset_input);
 
-    for (octave_idx_type j = 0 ; j < sz; j++)
+    for_each_block (sz, n, slice_threads (sz, n, opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        auto idxin = input_indexer++;
+        std::unique_ptr<typename ArrayType::element_type[]> slices {new typename ArrayType::element_type[block * n]};
 
-        auto input_begin = index_value_iterator<const typename ArrayType::element_type> {input_data + idxin, offset_input};
+        std::vector <std::pair<octave_idx_type, typename ArrayType::element_type>> buf (block * k);
 
-        auto input_end = input_begin + (dims_input (dim) );
+        k_selector<std::pair<octave_idx_type, typename ArrayType::element_type>> selector (opt.algorithm);
 
-        auto idxout = output_indexer++;
+        for_each_run (first, last, offset_input, block,
+          [&] (octave_idx_type j, octave_idx_type count)
+          {
+            gather_slices (input_data + slice_start (j, n, offset_input), n, offset_input, count, slices.get ());
 
-        auto output_begin = value_iterator<typename ArrayType::element_type> {output_data + idxout, offset_output};
+            for (octave_idx_type b = 0; b < count; b++)
+              {
+                auto input_begin = index_value_iterator<const typename ArrayType::element_type> {slices.get () + b * n};
 
-        if (! contain_nan)
-          std::partial_sort_copy (input_begin, input_end, buf.begin(), buf.end(), typename Comp::greater {});
-        else
-          std::partial_sort_copy (input_begin, input_end, buf.begin(), buf.end(), typename Comp::greater_nan {});
+                select_with_nan (selector, input_begin, input_begin + n, buf.begin () + b * k, k, typename Comp::greater {}, typename Comp::is_nan {});
+              }
 
-        std::transform (buf.begin(), buf.end(), output_begin,
-          [] (const std::pair<octave_idx_type, typename ArrayType::element_type>& a)
-          {
-            return a.second;
-          }
-        );
+            typename ArrayType::element_type* o = output_data + slice_start (j, k, offset_output);
 
-        OCTAVE_QUIT;
-      }
+            for (octave_idx_type s = 0; s < k; s++)
+              for (octave_idx_type b = 0; b < count; b++)
+                o[s * offset_output + b] = buf[b * k + s].second;
+          });
+      });
 
     return ovl (octave_value (output));
   }
 
 template <typename Comp,typename ArrayType>
   octave_value_list
-  do_maxk_vec_index(const ArrayType& input, octave_idx_type k , octave_idx_type dim)
+  do_maxk_vec_index(const ArrayType& input, octave_idx_type k , octave_idx_type dim, const options& opt)
   {
     auto dims_input = input.dims ();
 
@@ -2606,53 +3736,53 @@ template <typename Comp,typename ArrayType>
 
     double* second_output_data = second_output.fortran_vec ();
 
-    for (const typename ArrayType::element_type* i = input_data; i < input_data + input.numel (); i+=dims_input (dim))
+    const octave_idx_type sz = input.numel () / dims_input (dim);
+
+    // a single slice is split between the threads instead
+    const octave_idx_type threads = sz == 1 ? chunk_threads (dims_input (dim), dims_output (dim), opt) : 1;
+
+    for_each_block (sz, dims_input (dim), slice_threads (sz, dims_input (dim), opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        if (! has_nan (i, i+dims_input (dim)))
+        k_selector<octave_idx_type> selector (opt.algorithm, threads);
+
+        for (octave_idx_type j = first; j < last; j++)
           {
+            const typename ArrayType::element_type* i = input_data + j * dims_input (dim);
+
+            typename ArrayType::element_type* o = output_data + j * dims_output (dim);
+
+            double* second_o = second_output_data + j * dims_output (dim);
+
             index_iterator it{0};
 
-            std::partial_sort_copy (it, it +dims_input (dim), second_output_data, second_output_data + dims_output (dim), [i]
+            select_with_nan (selector, it, it + dims_input (dim), second_o, dims_output (dim), [i]
               (octave_idx_type a, octave_idx_type b)
               {
                 auto A = std::make_pair(a, i[a]);
                 auto B = std::make_pair(b, i[b]);
                 return typename Comp::greater{} (A, B);
+              },
+              [i] (octave_idx_type a)
+              {
+                return typename Comp::is_nan {} (i[a]);
               }
             );
-          }
-        else
-          {
-            index_iterator it{0};
 
-            std::partial_sort_copy (it, it+dims_input (dim), second_output_data, second_output_data + dims_output (dim), [i]
-              (octave_idx_type a, octave_idx_type b)
+            for (octave_idx_type s = 0; s < dims_output (dim); s++)
               {
-                auto A = std::make_pair(a, i[a]);
-                auto B = std::make_pair(b, i[b]);
-                return typename Comp::greater_nan{} (A, B);
+                o[s] = i[(octave_idx_type)second_o[s]];
+                ++second_o[s];
               }
-            );
           }
-
-        for (octave_idx_type s = 0; s < dims_output (dim); s++)
-          {
-            output_data[s] = i[(octave_idx_type)second_output_data[s]];
-            ++second_output_data[s];
-          }
-
-        second_output_data += dims_output (dim);
-        output_data += dims_output (dim);
-
-        OCTAVE_QUIT;
-      }
+      });
 
     return ovl (octave_value (output), octave_value (second_output));
   }
 
 template <typename Comp, typename ArrayType>
   octave_value_list
-  do_maxk_with_index(const ArrayType& input, octave_idx_type k , octave_idx_type dim)
+  do_maxk_with_index(const ArrayType& input, octave_idx_type k , octave_idx_type dim, const options& opt)
   {
     auto dims_input = input.dims ();
 
@@ -2693,7 +3823,7 @@ template <typename Comp, typename ArrayType>
 
     if (dim == 0 || dims_input.is_nd_vector ())
       {
-        return do_maxk_vec_index<Comp> (input, k, dim);
+        return do_maxk_vec_index<Comp> (input, k, dim, opt);
       }
 
     octave_idx_type sz = input.numel () / dims_input (dim);
@@ -2701,9 +3831,6 @@ template <typename Comp, typename ArrayType>
     NDArray second_output (dims_output);
     ArrayType output (dims_output);
 
-    start_elem_indexer input_indexer (dims_input, k, dim);
-    start_elem_indexer output_indexer (dims_output, k, dim);
-
     octave_idx_type offset_input = compute_offset (dims_input, dim);
 
     octave_idx_type offset_output = compute_offset (dims_output, dim);
@@ -2714,52 +3841,49 @@ template <typename Comp, typename ArrayType>
 
     typename NDArray::element_type* second_output_data = second_output.fortran_vec ();
 
-    std::vector <std::pair<octave_idx_type, typename ArrayType::element_type>> buf (dims_output (dim));
+    const octave_idx_type n = dims_input (dim);
 
-    const bool contain_nan = has_nan (input_data, input_data+input.numel ());
+    const octave_idx_type block = gather_count<typename ArrayType::element_type> (n, offset_input);
 
-    for (octave_idx_type j = 0 ; j < sz; j++)
+    for_each_block (sz, n, slice_threads (sz, n, opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        auto idxin = input_indexer++;
-
-        auto input_begin = index_value_iterator<const typename ArrayType::element_type> {input_data + idxin, offset_input};
+        std::unique_ptr<typename ArrayType::element_type[]> slices {new typename ArrayType::element_type[block * n]};
 
-        auto input_end = input_begin + (dims_input (dim) );
+        std::vector <std::pair<octave_idx_type, typename ArrayType::element_type>> buf (block * k);
 
-        auto idxout = output_indexer++;
+        k_selector<std::pair<octave_idx_type, typename ArrayType::element_type>> selector (opt.algorithm);
 
-        auto output_begin = value_iterator<typename ArrayType::element_type> {output_data + idxout, offset_output};
+        for_each_run (first, last, offset_input, block,
+          [&] (octave_idx_type j, octave_idx_type count)
+          {
+            gather_slices (input_data + slice_start (j, n, offset_input), n, offset_input, count, slices.get ());
 
-        auto second_output_begin = value_iterator<typename NDArray::element_type> {second_output_data + idxout, offset_output};
+            for (octave_idx_type b = 0; b < count; b++)
+              {
+                auto input_begin = index_value_iterator<const typename ArrayType::element_type> {slices.get () + b * n};
 
-        if (! contain_nan)
-          std::partial_sort_copy (input_begin, input_end, buf.begin(), buf.end(), typename Comp::greater {});
-        else
-          std::partial_sort_copy (input_begin, input_end, buf.begin(), buf.end(), typename Comp::greater_nan {});
+                select_with_nan (selector, input_begin, input_begin + n, buf.begin () + b * k, k, typename Comp::greater {}, typename Comp::is_nan {});
+              }
 
-        std::transform (buf.begin(), buf.end(), output_begin,
-          [] (const std::pair<octave_idx_type, typename ArrayType::element_type>& a)
-          {
-            return a.second;
-          }
-        );
+            const octave_idx_type idxout = slice_start (j, k, offset_output);
 
-        std::transform (buf.begin(), buf.end(), second_output_begin,
-          [] (const std::pair<octave_idx_type, typename ArrayType::element_type>& a)
-          {
-            return a.first + 1;
-          }
-        );
+            for (octave_idx_type s = 0; s < k; s++)
+              for (octave_idx_type b = 0; b < count; b++)
+                {
+                  output_data[idxout + s * offset_output + b] = buf[b * k + s].second;
 
-        OCTAVE_QUIT;
-      }
+                  second_output_data[idxout + s * offset_output + b] = buf[b * k + s].first + 1;
+                }
+          });
+      });
 
     return ovl (octave_value (output), octave_value (second_output));
   }
 
 template <typename Comp, typename ArrayType>
   octave_value_list
-  do_maxk_vec(const ArrayType& input, octave_idx_type k , octave_idx_type dim)
+  do_maxk_vec(const ArrayType& input, octave_idx_type k , octave_idx_type dim, const options& opt)
   {
     auto dims_input = input.dims ();
 
@@ -2776,47 +3900,204 @@ template <typename Comp, typename ArrayType>
 
     typename ArrayType::element_type* output_data = output.fortran_vec ();
 
-    for (const typename ArrayType::element_type* i = input_data; i < input_data + input.numel (); i+=dims_input (dim))
+    const octave_idx_type sz = input.numel () / dims_input (dim);
+
+    // a single slice is split between the threads instead
+    const octave_idx_type threads = sz == 1 ? chunk_threads (dims_input (dim), dims_output (dim), opt) : 1;
+
+    for_each_block (sz, dims_input (dim), slice_threads (sz, dims_input (dim), opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        if (! has_nan (i, i+dims_input (dim)))
-          std::partial_sort_copy (i, i+dims_input (dim), output_data, output_data + dims_output (dim), typename Comp::greater {});
-        else
-          std::partial_sort_copy (i, i+dims_input (dim), output_data, output_data + dims_output (dim), typename Comp::greater_nan {});
+        k_selector<typename ArrayType::element_type> selector (opt.algorithm, threads);
 
-        output_data += dims_output (dim);
+        for (octave_idx_type j = first; j < last; j++)
+          {
+            const typename ArrayType::element_type* i = input_data + j * dims_input (dim);
 
-        OCTAVE_QUIT;
-      }
+            typename ArrayType::element_type* o = output_data + j * dims_output (dim);
+
+            select_with_nan (selector, i, i+dims_input (dim), o, dims_output (dim), typename Comp::greater {}, typename Comp::is_nan {});
+          }
+      });
 
     return octave_value (output);
   }
 
-template <typename Comp>
+  // computes the keys of a slice of n elements that are offset apart,
+  // in parallel if threads is more than one. Returns true if the slice
+  // contains nan.
+template <typename T>
+  bool
+  complex_keys (const std::complex<T>* data, octave_idx_type n, octave_idx_type offset, bool want_arg, std::pair<octave_idx_type, complex_key<T>>* keys, octave_idx_type threads)
+  {
+    const octave_idx_type chunk = (n + threads - 1) / threads;
+
+    std::vector<char> contain_nan (threads, false);
+
+    auto decorate = [&] (octave_idx_type t)
+      {
+        bool nan = false;
+
+        for (octave_idx_type c = t * chunk; c < std::min (n, (t + 1) * chunk); c++)
+          {
+            const std::complex<T> z = data[c * offset];
+
+            const bool is_nan = octave::math::isnan (z);
+
+            keys[c] = {c, {std::abs (z), want_arg ? std::arg (z) : T (0), is_nan}};
+
+            nan = nan || is_nan;
+          }
+
+        contain_nan[t] = nan;
+      };
+
+    if (threads == 1)
+      decorate (0);
+    else
+      run_parallel (threads, decorate);
+
+    return std::find (contain_nan.begin (), contain_nan.end (), true) != contain_nan.end ();
+  }
+
+  // 'real' compares the components of complex numbers that is cheap
+template <typename Comp, typename ArrayType,
+  typename std::enable_if<
+    std::is_same<Comp, comp_real>::value
+  >::type* = nullptr>
   octave_value_list
-  do_maxk(const ComplexNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk_complex (const ArrayType& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     if (compute_index)
-      return do_maxk_with_index<Comp> (input, k, dim);
+      return do_maxk_with_index<Comp> (input, k, dim, opt);
 
-    return do_maxk_stable<Comp> (input, k, dim);
+    return do_maxk_stable<Comp> (input, k, dim, opt);
   }
 
-template <typename Comp>
+  // 'auto' and 'abs' compare complex numbers by abs and arg that are
+  // expensive. Each element is decorated once with its keys and index, the
+  // selection is done on the keys and the values are gathered from the
+  // selected indexes. The order is the same as of the comparators of the
+  // complex numbers.
+template <typename Comp, typename ArrayType,
+  typename std::enable_if<
+    ! std::is_same<Comp, comp_real>::value
+  >::type* = nullptr>
   octave_value_list
-  do_maxk(const FloatComplexNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk_complex (const ArrayType& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
+    using keyed = std::pair<octave_idx_type, complex_key<typename ArrayType::element_type::value_type>>;
+
+    auto dims_input = input.dims ();
+
+    auto dims_output = input.dims ();
+
+    // the heap compares most of the elements only with its top so the
+    // keys of all elements do not pay off
+    if ((dim + 1) > input.ndims () || k == 0 || input.numel () == 0 || dims_input (dim) == 1
+        || choose_select_method<keyed> (dims_input (dim), std::min (k, dims_input (dim)), opt.algorithm) == select_method::heap)
+      {
+        if (compute_index)
+          return do_maxk_with_index<Comp> (input, k, dim, opt);
+
+        return do_maxk_stable<Comp> (input, k, dim, opt);
+      }
+
+    const octave_idx_type n = dims_input (dim);
+
+    k = std::min (n, k);
+
+    dims_output (dim) = k;
+
+    const octave_idx_type sz = input.numel () / n;
+
+    ArrayType output (dims_output);
+
+    NDArray second_output;
+
+    if (compute_index)
+      second_output = NDArray (dims_output);
+
+    const typename ArrayType::element_type* input_data = input.fortran_vec ();
+
+    typename ArrayType::element_type* output_data = output.fortran_vec ();
+
+    double* second_output_data = compute_index ? second_output.fortran_vec () : nullptr;
+
+    const octave_idx_type offset_input = compute_offset (dims_input, dim);
+
+    const octave_idx_type offset_output = compute_offset (dims_output, dim);
+
+    // only 'abs' compares the angles
+    const bool want_arg = std::is_same<Comp, comp_abs>::value;
+
+    // a single slice is split between the threads instead
+    const octave_idx_type threads = sz == 1 ? chunk_threads (n, k, opt) : 1;
+
+    for_each_block (sz, n, slice_threads (sz, n, opt),
+      [&] (octave_idx_type first, octave_idx_type last)
+      {
+        start_elem_indexer input_indexer (dims_input, k, dim);
+
+        start_elem_indexer output_indexer (dims_output, k, dim);
+
+        input_indexer.seek (first);
+
+        output_indexer.seek (first);
+
+        std::vector<keyed> keys (n);
+
+        std::vector<keyed> buf (k);
+
+        k_selector<keyed> selector (opt.algorithm, threads);
+
+        for (octave_idx_type j = first; j < last; j++)
+          {
+            const typename ArrayType::element_type* i = input_data + input_indexer++;
+
+            const octave_idx_type idxout = output_indexer++;
+
+            if (! complex_keys (i, n, offset_input, want_arg, keys.data (), threads))
+              selector (keys.begin (), keys.end (), buf.begin (), buf.end (), typename Comp::greater {});
+            else
+              selector (keys.begin (), keys.end (), buf.begin (), buf.end (), typename Comp::greater_nan {});
+
+            for (octave_idx_type s = 0; s < k; s++)
+              {
+                output_data[idxout + s * offset_output] = i[buf[s].first * offset_input];
+
+                if (compute_index)
+                  second_output_data[idxout + s * offset_output] = buf[s].first + 1;
+              }
+          }
+      });
+
     if (compute_index)
-      return do_maxk_with_index<Comp> (input, k, dim);
+      return ovl (octave_value (output), octave_value (second_output));
+
+    return ovl (octave_value (output));
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const ComplexNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_complex<Comp> (input, k, dim, compute_index, opt);
+  }
 
-    return do_maxk_stable<Comp> (input, k, dim);
+template <typename Comp>
+  octave_value_list
+  do_maxk(const FloatComplexNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_complex<Comp> (input, k, dim, compute_index, opt);
   }
 
 template <typename Comp, typename ArrayType>
   octave_value_list
-  do_maxk(const ArrayType& input, octave_idx_type k , octave_idx_type dim, bool compute_index)
+  do_maxk(const ArrayType& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
   {
     if (compute_index)
-      return do_maxk_with_index<Comp> (input, k, dim);
+      return do_maxk_with_index<Comp> (input, k, dim, opt);
 
     auto dims_input = input.dims ();
 
@@ -2863,72 +4144,260 @@ template <typename Comp, typename ArrayType>
       contain_neg = has_neg (input_data, input_data + input.numel ());
 
     if (contain_neg)
-      return do_maxk_stable<Comp> (input, k, dim);
+      return do_maxk_stable<Comp> (input, k, dim, opt);
 
     if (dim == 0 || dims_input.is_nd_vector ())
       {
-        return do_maxk_vec<Comp> (input, k, dim);
+        return do_maxk_vec<Comp> (input, k, dim, opt);
       }
 
     octave_idx_type sz = input.numel () / dims_input (dim);
 
     ArrayType output (dims_output);
 
-    start_elem_indexer input_indexer (dims_input, k, dim);
-
-    start_elem_indexer output_indexer (dims_output, k, dim);
-
     typename ArrayType::element_type* output_data = output.fortran_vec ();
 
     octave_idx_type offset_input = compute_offset (dims_input, dim);
 
     octave_idx_type offset_output = compute_offset (dims_output, dim);
 
-    std::unique_ptr<typename ArrayType::element_type[]> buf{new typename ArrayType::element_type[k]};
+    const octave_idx_type n = dims_input (dim);
 
-    const bool contain_nan = has_nan (input_data, input_data + input.numel ());
+    const octave_idx_type block = gather_count<typename ArrayType::element_type> (n, offset_input);
 
-    for (octave_idx_type j = 0 ; j < sz; j++)
+    for_each_block (sz, n, slice_threads (sz, n, opt),
+      [&] (octave_idx_type first, octave_idx_type last)
       {
-        auto input_begin = value_iterator<const typename ArrayType::element_type> {input_data + input_indexer++, offset_input};
+        std::unique_ptr<typename ArrayType::element_type[]> slices {new typename ArrayType::element_type[block * n]};
 
-        auto input_end = input_begin + (dims_input (dim) );
+        std::unique_ptr<typename ArrayType::element_type[]> buf {new typename ArrayType::element_type[block * k]};
 
-        auto output_begin = value_iterator<typename ArrayType::element_type> {output_data + output_indexer++, offset_output};
-        auto output_end = output_begin + (dims_output (dim) );
+        k_selector<typename ArrayType::element_type> selector (opt.algorithm);
 
-        if (contain_nan)
-          {
-            std::partial_sort_copy (input_begin, input_end, buf.get(), buf.get() + k, typename Comp::greater_nan {});
-          }
-        else
+        for_each_run (first, last, offset_input, block,
+          [&] (octave_idx_type j, octave_idx_type count)
           {
-            std::partial_sort_copy (input_begin, input_end, buf.get(), buf.get() + k, typename Comp::greater {});
-          }
+            gather_slices (input_data + slice_start (j, n, offset_input), n, offset_input, count, slices.get ());
+
+            for (octave_idx_type b = 0; b < count; b++)
+              {
+                const typename ArrayType::element_type* i = slices.get () + b * n;
+
+                select_with_nan (selector, i, i + n, buf.get () + b * k, k, typename Comp::greater {}, typename Comp::is_nan {});
+              }
 
-        std::copy (buf.get(), buf.get() + k, output_begin);
+            typename ArrayType::element_type* o = output_data + slice_start (j, k, offset_output);
 
-        OCTAVE_QUIT;
-      }
+            for (octave_idx_type s = 0; s < k; s++)
+              for (octave_idx_type b = 0; b < count; b++)
+                o[s * offset_output + b] = buf[b * k + s];
+          });
+      });
 
     return octave_value (output);
   }
 
-  std::string
-  get_comparison_method (const octave_value_list& args, int idx)
+  // real floating point and narrow integer elements are compared by the order preserving
+  // unsigned keys of radix_key. The keys of a slice are computed once and
+  // the indexes of the k first elements are found by radix_selector, so
+  // the result is the same as with the comparators.
+template <typename Comp, typename ArrayType>
+  octave_value_list
+  do_maxk_radix (const ArrayType& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    using key_type = radix_key<typename ArrayType::element_type>;
+
+    auto dims_input = input.dims ();
+
+    auto dims_output = input.dims ();
+
+    if ((dim + 1) > input.ndims () || k == 0 || input.numel () == 0 || dims_input (dim) == 1
+        || ! use_radix<typename ArrayType::element_type> (input.numel () / dims_input (dim), dims_input (dim), std::min (k, dims_input (dim)), opt))
+      return do_maxk<Comp, ArrayType> (input, k, dim, compute_index, opt);
+
+    const octave_idx_type n = dims_input (dim);
+
+    k = std::min (n, k);
+
+    dims_output (dim) = k;
+
+    const octave_idx_type sz = input.numel () / n;
+
+    ArrayType output (dims_output);
+
+    NDArray second_output;
+
+    if (compute_index)
+      second_output = NDArray (dims_output);
+
+    const typename ArrayType::element_type* input_data = input.fortran_vec ();
+
+    typename ArrayType::element_type* output_data = output.fortran_vec ();
+
+    double* second_output_data = compute_index ? second_output.fortran_vec () : nullptr;
+
+    const octave_idx_type offset_input = compute_offset (dims_input, dim);
+
+    const octave_idx_type offset_output = compute_offset (dims_output, dim);
+
+    const bool by_abs = std::is_same<Comp, comp_abs>::value;
+
+    // the keys of adjacent slices are computed together
+    const octave_idx_type block = gather_count<typename key_type::type> (n, offset_input);
+
+    // the inverted keys put the greatest elements and nan first and keep
+    // equal elements in index order
+    for_each_block (sz, n, slice_threads (sz, n, opt),
+      [&] (octave_idx_type first, octave_idx_type last)
+      {
+        std::vector<typename key_type::type> keys (block * n);
+
+        std::vector<octave_idx_type> idx (block * k);
+
+        radix_selector<typename key_type::type> selector;
+
+        for_each_run (first, last, offset_input, block,
+          [&] (octave_idx_type j, octave_idx_type count)
+          {
+            const typename ArrayType::element_type* i = input_data + slice_start (j, n, offset_input);
+
+            const octave_idx_type idxout = slice_start (j, k, offset_output);
+
+            gather_slices (i, n, offset_input, count, keys.data (),
+              [by_abs] (const typename ArrayType::element_type& a)
+              {
+                return ~key_type::encode (a, by_abs);
+              });
+
+            for (octave_idx_type b = 0; b < count; b++)
+              selector (keys.data () + b * n, n, k, idx.data () + b * k);
+
+            for (octave_idx_type s = 0; s < k; s++)
+              for (octave_idx_type b = 0; b < count; b++)
+                {
+                  const octave_idx_type c = idx[b * k + s];
+
+                  output_data[idxout + s * offset_output + b] = i[c * offset_input + b];
+
+                  if (compute_index)
+                    second_output_data[idxout + s * offset_output + b] = c + 1;
+                }
+          });
+      });
+
+    if (compute_index)
+      return ovl (octave_value (output), octave_value (second_output));
+
+    return ovl (octave_value (output));
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const NDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const FloatNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const int8NDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const uint8NDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const int16NDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const uint16NDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const charNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+template <typename Comp>
+  octave_value_list
+  do_maxk(const boolNDArray& input, octave_idx_type k , octave_idx_type dim, bool compute_index, const options& opt)
+  {
+    return do_maxk_radix<Comp> (input, k, dim, compute_index, opt);
+  }
+
+  options
+  parse_options (const octave_value_list& args, int idx)
   {
-    if (args.length () != idx+2)
+    if ((args.length () - idx) % 2 != 0)
       error ("invalid number of inputs");
 
-    if (args (idx).string_value () != "ComparisonMethod")
-      error ("Invalid argument. Dp you mean ComparisonMethod?");
+    options opt;
+
+    for (int i = idx; i < args.length (); i += 2)
+      {
+        const std::string name = args (i).xstring_value ("argument number %s should be string", std::to_string (i + 1).c_str ());
+
+        if (name == "Threads")
+          {
+            opt.threads = args (i+1).xidx_type_value ("Threads should be a positive integer");
+
+            if (opt.threads < 1)
+              error ("Threads should be a positive integer");
+
+            continue;
+          }
+
+        const std::string value = args (i+1).xstring_value ("argument number %s should be string", std::to_string (i + 2).c_str ());
 
-    std::string ComparisonMethod = args (idx+1).xstring_value ("argument number %s should be string", std::to_string (idx +1).c_str ());
+        if (name == "ComparisonMethod")
+          {
+            if (! (value == "auto" || value == "real" || value == "abs" ))
+              error ("ComparisonMethod should be one of auto, real or abs");
 
-    if (! (ComparisonMethod == "auto" || ComparisonMethod == "real" || ComparisonMethod == "abs" ))
-      error ("ComparisonMethod should be one of auto, real or abs");
+            opt.comparison_method = value;
+          }
+        else if (name == "Algorithm")
+          {
+            if (value == "auto")
+              opt.algorithm = select_method::automatic;
+            else if (value == "heap")
+              opt.algorithm = select_method::heap;
+            else if (value == "select")
+              opt.algorithm = select_method::select;
+            else if (value == "sort")
+              opt.algorithm = select_method::sort;
+            else if (value == "radix")
+              opt.algorithm = select_method::radix;
+            else
+              error ("Algorithm should be one of auto, heap, select, sort or radix");
+          }
+        else
+          error ("Invalid argument. Dp you mean ComparisonMethod, Algorithm or Threads?");
+      }
 
-    return ComparisonMethod;
+    return opt;
   }
 
 template <typename ArrayType>
@@ -2976,45 +4445,31 @@ template <typename ArrayType>
           }
       }
 
-    std::string ComparisonMethod = "auto";
+    int idx = 2;
 
-    if (nargin > 2)
+    if (nargin > 2 && args (2).isnumeric ())
       {
-        if (args (2).isnumeric ())
-          {
-            if (args (2).numel () != 1)
-              error ("dim should be scalar");
+        if (args (2).numel () != 1)
+          error ("dim should be scalar");
 
-            dim = args (2).idx_type_value ();
+        dim = args (2).idx_type_value ();
 
-            if (dim <= 0)
-              error ("dim should be positive integer");
+        if (dim <= 0)
+          error ("dim should be positive integer");
 
-            dim--;
-          }
-        else if (args (2).is_string ())
-          {
-            ComparisonMethod = get_comparison_method (args, 2);
-          }
-      }
+        dim--;
 
-    if (nargin > 3)
-      {
-        if (args (3).is_string ())
-          {
-            if (! args (2).is_string ())
-              ComparisonMethod = get_comparison_method (args, 3);
-          }
-        else
-          error ("invalid argument 4");
+        idx = 3;
       }
 
-    if (ComparisonMethod == "auto")
-      return do_maxk<comp_auto> (array, k, dim, nargout == 2);
-    else if (ComparisonMethod == "real")
-      return do_maxk<comp_real> (array, k, dim, nargout == 2);
+    const options opt = parse_options (args, idx);
+
+    if (opt.comparison_method == "auto")
+      return do_maxk<comp_auto> (array, k, dim, nargout == 2, opt);
+    else if (opt.comparison_method == "real")
+      return do_maxk<comp_real> (array, k, dim, nargout == 2, opt);
 
-    return do_maxk<comp_abs> (array, k, dim, nargout == 2);
+    return do_maxk<comp_abs> (array, k, dim, nargout == 2, opt);
   }
 
   octave_value_list
@@ -3022,7 +4477,7 @@ template <typename ArrayType>
   {
     octave_idx_type nargin = args.length ();
 
-    if (nargin < 2 || nargin > 5)
+    if (nargin < 2)
       error ("invalid number of arguments");
 
     octave_value im = args(0);
@@ -3105,6 +4560,8 @@ DEFUN_DLD (maxk, args, nargout,
 @deftypefn {Loadable Function} {B =} maxk(@var{A}, @var{k})
 @deftypefnx {Loadable Function} {B =} maxk(@var{A}, @var{k}, @var{dim})
 @deftypefnx {Loadable Function} {B =} maxk(@var{___}, 'ComparisonMethod', @var{c})
+@deftypefnx {Loadable Function} {B =} maxk(@var{___}, 'Algorithm', @var{a})
+@deftypefnx {Loadable Function} {B =} maxk(@var{___}, 'Threads', @var{n})
 @deftypefnx {Loadable Function} {[B, I] =} maxk(@var{___})
 
 Partially sort and return @var{k} largest elements of @var{A}.
@@ -3126,6 +4583,23 @@ If @var{A} is complex compare elements using 'real' and for elements with equal
 Use 'abs' for comparing both real and complex @var{A} . In the case of complex @var{A} for elements with equal 'abs' use 'angle'.
 @end table
 
+If 'Algorithm' is provided @var{a} selects how the @var{k} elements are found in each slice:
+
+@table @asis
+@item @qcode{'auto'} (default)
+Choose one of the other algorithms from @var{k}, the length of the slice and the type of the elements. When it chooses 'heap' for @var{k} up to 16 it keeps the selected elements in a small sorted buffer instead and skips runs of elements that cannot enter it. For slices of more than 2^20 elements and larger @var{k} it first takes a bound from a random sample of the slice, that likely has more than @var{k} elements within it, and selects only the elements within the bound. It falls back to the other algorithms if the bound was too tight, so the result is the same.
+@item @qcode{'heap'}
+Keep a heap of @var{k} elements while scanning the slice. It is fast when @var{k} is small compared to the length of the slice.
+@item @qcode{'select'}
+Copy the slice to a buffer, partition it around the k-th element and sort only the first @var{k} elements.
+@item @qcode{'sort'}
+Copy the slice to a buffer and sort it completely. It is used when @var{k} is close to the length of the slice.
+@item @qcode{'radix'}
+For 'double', 'single', 8 and 16 bit integer, 'char' and 'logical' @var{A} map the elements to unsigned integer keys that have the same order and find the @var{k} first keys with radix selection and radix sort. Single byte keys are counted in one pass and placed with a stable counting sort. 'auto' uses it instead of 'select' and 'sort' for these types and also instead of 'heap' for single byte keys. For other types it is the same as 'select'.
+@end table
+
+If 'Threads' is provided the slices along the operating dimension are split between @var{n} threads. If there is only one slice, like for a vector, it is split in chunks whose @var{k} first elements are found in parallel and merged. By default the number of threads is chosen from the number of elements, the stored elements for sparse input, and the number of processors and small inputs are computed in one thread. The result does not depend on the number of threads.
+
 In all of the methods 'nan' is assumed to be the greatest element and order of equal elements are preserved.
 
 The return value @var{B} contains the @var{k} largest elements that are sorted in descending order.